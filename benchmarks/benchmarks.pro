@@ -0,0 +1,5 @@
+TARGET = tst_gphotobenchmarks
+
+include(../testlib/gphototestlib.pri)
+
+SOURCES += tst_gphotobenchmarks.cpp
@@ -0,0 +1,215 @@
+#include <algorithm>
+#include <numeric>
+
+#include <QAbstractVideoSurface>
+#include <QElapsedTimer>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+#include <QtTest>
+
+#include "gphotocontroller.h"
+#include "gphotomockbackend.h"
+#include "gphotomockcamera.h"
+
+namespace {
+    constexpr auto mockEnvironmentVariable = "GPHOTO_MOCK";
+    constexpr auto mockCameraCount = 4;
+    constexpr auto previewFrameCount = 200;
+    constexpr auto previewWarmupFrames = 10;
+    constexpr auto captureCount = 5;
+    constexpr auto parameterChangeCount = 50;
+    constexpr auto waitTimeout = GPhotoMockCamera::waitTimeout;
+}
+
+/// Surface counting frames that made it through the whole viewfinder pipeline
+class BenchmarkSurface final : public QAbstractVideoSurface
+{
+    Q_OBJECT
+public:
+    /// Delays from the mock producing a frame to the frame presented here, nsecs
+    QVector<qint64> latencies;
+
+    QList<QVideoFrame::PixelFormat> supportedPixelFormats(QAbstractVideoBuffer::HandleType type) const final
+    {
+        Q_UNUSED(type)
+        return {QVideoFrame::Format_RGB32, QVideoFrame::Format_ARGB32};
+    }
+
+    bool present(const QVideoFrame &frame) final
+    {
+        Q_UNUSED(frame)
+
+        // Every frame the mock produces is presented, in order, so the oldest time is of this one
+        const auto produced = GPhotoMockBackend::takePreviewTimestamp();
+        if (0 <= produced)
+            latencies.append(GPhotoMockBackend::clockNsecs() - produced);
+
+        emit framePresented();
+        return true;
+    }
+
+signals:
+    void framePresented();
+};
+
+/** Benchmarks of viewfinder, capture and config paths driven with mock cameras.
+ *
+ * Run with e.g. "-o results.xml,xml" or "-csv" to get machine readable results.
+ */
+class GPhotoBenchmarks final : public QObject
+{
+    Q_OBJECT
+private slots:
+    void enumeration();
+    void previewLatency_data();
+    void previewLatency();
+    void previewFps();
+    void captureToSaved_data();
+    void captureToSaved();
+    void setParameterTime();
+    void setParameterRoundTrips();
+};
+
+void GPhotoBenchmarks::enumeration()
+{
+    qputenv(mockEnvironmentVariable, QByteArray("cameras=") + QByteArray::number(mockCameraCount));
+
+    QBENCHMARK {
+        GPhotoController controller;
+        QVERIFY(controller.init());
+        QCOMPARE(controller.cameraNames().size(), mockCameraCount);
+    }
+}
+
+void GPhotoBenchmarks::previewLatency_data()
+{
+    // Zero gives the mean
+    QTest::addColumn<int>("percentile");
+
+    QTest::newRow("mean") << 0;
+    QTest::newRow("95th percentile") << 95;
+}
+
+void GPhotoBenchmarks::previewLatency()
+{
+    QFETCH(int, percentile);
+
+    auto camera = GPhotoMockCamera::open("preview=960x640");
+    QVERIFY(camera.waitForStatus(QCamera::LoadedStatus));
+
+    BenchmarkSurface surface;
+    camera.session->setSurface(&surface);
+    QSignalSpy frames(&surface, &BenchmarkSurface::framePresented);
+
+    // Delay from the camera producing a frame to the frame on the surface, once the viewfinder runs steadily
+    camera.session->setState(QCamera::ActiveState);
+    while (frames.count() < previewWarmupFrames)
+        QVERIFY(frames.wait(waitTimeout));
+
+    surface.latencies.clear();
+    while (surface.latencies.size() < previewFrameCount)
+        QVERIFY(frames.wait(waitTimeout));
+
+    auto latencies = surface.latencies.mid(0, previewFrameCount);
+    auto result = 0.0;
+    if (0 == percentile) {
+        result = std::accumulate(latencies.cbegin(), latencies.cend(), 0.0) / latencies.size();
+    } else {
+        auto nth = latencies.begin() + (latencies.size() * percentile + 99) / 100 - 1;
+        std::nth_element(latencies.begin(), nth, latencies.end());
+        result = *nth;
+    }
+
+    QTest::setBenchmarkResult(result / 1000000.0, QTest::WalltimeMilliseconds);
+}
+
+void GPhotoBenchmarks::previewFps()
+{
+    auto camera = GPhotoMockCamera::open("preview=960x640");
+    QVERIFY(camera.waitForStatus(QCamera::LoadedStatus));
+
+    BenchmarkSurface surface;
+    camera.session->setSurface(&surface);
+    QSignalSpy frames(&surface, &BenchmarkSurface::framePresented);
+
+    camera.session->setState(QCamera::ActiveState);
+    QVERIFY(frames.wait(waitTimeout));
+    frames.clear();
+
+    QElapsedTimer timer;
+    timer.start();
+
+    while (frames.count() < previewFrameCount)
+        QVERIFY(frames.wait(waitTimeout));
+
+    QTest::setBenchmarkResult(frames.count() * 1000000000.0 / timer.nsecsElapsed(), QTest::FramesPerSecond);
+}
+
+void GPhotoBenchmarks::captureToSaved_data()
+{
+    QTest::addColumn<qint64>("fileSize");
+
+    QTest::newRow("1 MB") << qint64(1) * 1024 * 1024;
+    QTest::newRow("8 MB") << qint64(8) * 1024 * 1024;
+    QTest::newRow("32 MB") << qint64(32) * 1024 * 1024;
+    QTest::newRow("64 MB") << qint64(64) * 1024 * 1024;
+}
+
+void GPhotoBenchmarks::captureToSaved()
+{
+    QFETCH(qint64, fileSize);
+
+    auto camera = GPhotoMockCamera::open(QByteArray("files=JPG:") + QByteArray::number(fileSize));
+    QVERIFY(camera.waitForStatus(QCamera::LoadedStatus));
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    QSignalSpy saved(camera.session.get(), &GPhotoCameraSession::imageSaved);
+    QSignalSpy errors(camera.session.get(), &GPhotoCameraSession::imageCaptureError);
+
+    // Mean time from capture request to the file saved on disk
+    QElapsedTimer timer;
+    timer.start();
+
+    for (auto i = 0; i < captureCount; ++i) {
+        camera.session->capture(dir.path() + QString(QLatin1String("/capture%1.JPG")).arg(i));
+        QVERIFY(saved.wait(waitTimeout));
+        QCOMPARE(errors.count(), 0);
+    }
+
+    QTest::setBenchmarkResult(timer.nsecsElapsed() / 1000000.0 / captureCount, QTest::WalltimeMilliseconds);
+}
+
+void GPhotoBenchmarks::setParameterTime()
+{
+    auto camera = GPhotoMockCamera::open("propertyEvents=1");
+    QVERIFY(camera.waitForStatus(QCamera::LoadedStatus));
+
+    auto i = 0;
+    QBENCHMARK {
+        const auto &value = (++i % 2) ? QLatin1String("4") : QLatin1String("5.6");
+        QVERIFY(camera.session->setParameter(QLatin1String("aperture"), QString(value)));
+    }
+}
+
+void GPhotoBenchmarks::setParameterRoundTrips()
+{
+    auto camera = GPhotoMockCamera::open("propertyEvents=1");
+    QVERIFY(camera.waitForStatus(QCamera::LoadedStatus));
+
+    // Config downloads and uploads per single parameter change
+    auto requests = GPhotoMockBackend::configRequestCount();
+
+    for (auto i = 0; i < parameterChangeCount; ++i) {
+        const auto &value = (i % 2) ? QLatin1String("4") : QLatin1String("5.6");
+        QVERIFY(camera.session->setParameter(QLatin1String("aperture"), QString(value)));
+    }
+
+    requests = GPhotoMockBackend::configRequestCount() - requests;
+    QTest::setBenchmarkResult(qreal(requests) / parameterChangeCount, QTest::Events);
+}
+
+QTEST_MAIN(GPhotoBenchmarks)
+
+#include "tst_gphotobenchmarks.moc"
@@ -17,16 +17,26 @@ SOURCES += \
     gphotocameraimagecapturecontrol.cpp \
     gphotocameralockcontrol.cpp \
     gphotocamerasession.cpp \
+    gphotocardindex.cpp \
     gphotocontroller.cpp \
+    gphotodevicebackend.cpp \
     gphotoexposurecontrol.cpp \
+    gphotofilewriter.cpp \
+    gphotoimporter.cpp \
+    gphotomediarecordercontrol.cpp \
     gphotomediaservice.cpp \
+    gphotometrics.cpp \
+    gphotosaveservice.cpp \
     gphotoserviceplugin.cpp \
+    gphototrace.cpp \
+    gphototransfermonitor.cpp \
     gphotovideoinputdevicecontrol.cpp \
     gphotovideoprobecontrol.cpp \
     gphotovideorenderercontrol.cpp \
     gphotoworker.cpp
 
 HEADERS += \
+    gphotobackend.h \
     gphotocamera.h \
     gphotocameracapturedestinationcontrol.h \
     gphotocameracontrol.h \
@@ -34,10 +44,19 @@ HEADERS += \
     gphotocameraimagecapturecontrol.h \
     gphotocameralockcontrol.h \
     gphotocamerasession.h \
+    gphotocardindex.h \
     gphotocontroller.h \
+    gphotodevicebackend.h \
     gphotoexposurecontrol.h \
+    gphotofilewriter.h \
+    gphotoimporter.h \
+    gphotomediarecordercontrol.h \
     gphotomediaservice.h \
+    gphotometrics.h \
+    gphotosaveservice.h \
     gphotoserviceplugin.h \
+    gphototrace.h \
+    gphototransfermonitor.h \
     gphotovideoinputdevicecontrol.h \
     gphotovideoprobecontrol.h \
     gphotovideorenderercontrol.h \
@@ -46,5 +65,21 @@ HEADERS += \
 OTHER_FILES += gphoto.json
 LIBS += -lgphoto2
 
+# Mock cameras are for tests and benchmarks, qmake CONFIG+=gphoto_mock builds them into the plugin
+gphoto_mock {
+    DEFINES += GPHOTO_MOCK_BACKEND
+    SOURCES += gphotomockbackend.cpp
+    HEADERS += gphotomockbackend.h
+}
+
+# io_uring writer is optional, pwrite is used without it
+CONFIG += link_pkgconfig
+packagesExist(liburing) {
+    DEFINES += HAVE_LIBURING
+    PKGCONFIG += liburing
+    SOURCES += gphotouringwriter.cpp
+    HEADERS += gphotouringwriter.h
+}
+
 target.path = $$[QT_INSTALL_PLUGINS]/mediaservice
 INSTALLS += target
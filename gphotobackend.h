@@ -0,0 +1,52 @@
+#ifndef GPHOTOBACKEND_H
+#define GPHOTOBACKEND_H
+
+#include <memory>
+
+#include <QString>
+
+#include <gphoto2/gphoto2-camera.h>
+#include <gphoto2/gphoto2-file.h>
+#include <gphoto2/gphoto2-list.h>
+
+using CameraListPtr = std::unique_ptr<CameraList, int (*)(CameraList*)>;
+
+/** Camera operations used by GPhotoCamera.
+ *
+ * Mirrors the libgphoto2 camera API, so the real implementation just
+ * forwards the calls to the device, while the mock one lets the rest
+ * of the plugin run without any hardware connected.
+ *
+ * All the methods except open() and isOpen() return libgphoto2 result codes.
+ */
+class GPhotoBackend
+{
+public:
+    virtual ~GPhotoBackend() = default;
+
+    /// Creates camera object, camera is connected on the first request or on init()
+    virtual bool open(QString *errorText) = 0;
+    virtual void close() = 0;
+    virtual bool isOpen() const = 0;
+
+    /// Connects to the camera immediately
+    virtual int init() = 0;
+
+    virtual int getConfig(CameraWidget **root) = 0;
+    virtual int setConfig(CameraWidget *root) = 0;
+    /// Runs the action of a GP_WIDGET_BUTTON widget of the config tree
+    virtual int pressButton(CameraWidget *button) = 0;
+
+    virtual int capturePreview(CameraFile *file) = 0;
+    virtual int triggerCapture() = 0;
+    virtual int waitForEvent(int timeout, CameraEventType *type, void **data) = 0;
+    virtual int fileGet(const char *folder, const char *name, CameraFileType type, CameraFile *file) = 0;
+    /// Reads up to @p size bytes from @p offset, @p size is set to the number of bytes read
+    virtual int fileRead(const char *folder, const char *name, CameraFileType type, uint64_t offset,
+                         char *buffer, uint64_t *size) = 0;
+    virtual int fileGetInfo(const char *folder, const char *name, CameraFileInfo *info) = 0;
+    virtual int folderListFiles(const char *folder, CameraList *list) = 0;
+    virtual int folderListFolders(const char *folder, CameraList *list) = 0;
+};
+
+#endif // GPHOTOBACKEND_H
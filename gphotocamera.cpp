@@ -1,17 +1,80 @@
+#include <algorithm>
+
 #include <QCameraImageCapture>
+#include <QDateTime>
+#include <QDir>
 #include <QThread>
 #include <QFileInfo>
+#include <QJsonValue>
+#include <QRegularExpression>
+#include <QTemporaryFile>
+
+#include <unistd.h>
 
+#include "gphotobackend.h"
 #include "gphotocamera.h"
+#include "gphotocardindex.h"
+#include "gphotoimporter.h"
+#include "gphotometrics.h"
+#include "gphototrace.h"
+#include "gphototransfermonitor.h"
 
 namespace {
     constexpr auto capturingFailLimit = 10;
+    constexpr auto captureBaseTimeout = 15000;
+    constexpr auto configAckTimeout = 1000;
+    constexpr auto configRefreshInterval = 250;
+    constexpr auto eventPollInterval = 100;
+    constexpr auto importRetryInterval = 50;
+    constexpr auto maxEventsPerPoll = 16;
+    constexpr auto minCaptureEventTimeout = 10;
+    constexpr auto maxCaptureEventTimeout = 100;
+    constexpr auto movieFinishTimeout = 60000;
+    constexpr auto movieChunkSize = 4 * 1024 * 1024;
+    constexpr auto autofocusdriveParameter = "autofocusdrive";
     constexpr auto cancelautofocusParameter = "cancelautofocus";
+    constexpr auto eosRemoteReleaseParameter = "eosremoterelease";
+    constexpr auto movieParameter = "movie";
+    constexpr auto serialNumberParameter = "serialnumber";
+    constexpr auto shutterSpeedParameter = "shutterspeed";
     constexpr auto viewfinderParameter = "viewfinder";
     constexpr auto waitForEventTimeout = 10;
+    constexpr auto timelapseMargin = 20;
+    constexpr auto nsecsPerMsec = 1000000;
+
+    bool isJpeg(const QString &fileName)
+    {
+        return QFileInfo(fileName).suffix().startsWith(QLatin1String("jp"), Qt::CaseInsensitive);
+    }
+
+    bool isMovie(const QString &fileName)
+    {
+        static const QStringList extensions{QLatin1String("avi"), QLatin1String("crm"), QLatin1String("m2ts"),
+                                            QLatin1String("mov"), QLatin1String("mp4"), QLatin1String("mts")};
+        return extensions.contains(QFileInfo(fileName).suffix(), Qt::CaseInsensitive);
+    }
+
+    /// Toggles which trigger camera actions, restoring them would start the action again
+    bool isActionWidget(const char *name)
+    {
+        static const QStringList names{QLatin1String(autofocusdriveParameter), QLatin1String(cancelautofocusParameter),
+                                       QLatin1String(eosRemoteReleaseParameter), QLatin1String(movieParameter),
+                                       QLatin1String(viewfinderParameter)};
+        return names.contains(QLatin1String(name));
+    }
+
+    /// Name of a file in the sequence of bracketing frames or timelapse shots
+    QString sequenceFileName(const QString &fileName, int index)
+    {
+        if (fileName.isEmpty())
+            return fileName;
+
+        const QFileInfo info(fileName);
+        return info.path() + QLatin1Char('/') + info.completeBaseName() + QLatin1Char('_')
+               + QString::number(index) + QLatin1Char('.') + info.suffix();
+    }
 }
 
-using CameraWidgetPtr = std::unique_ptr<CameraWidget, int (*)(CameraWidget*)>;
 using VoidPtr = std::unique_ptr<void, void (*)(void*)>;
 
 QDebug operator<<(QDebug dbg, const CameraWidgetType &t)
@@ -49,16 +112,41 @@ QDebug operator<<(QDebug dbg, const CameraWidgetType &t)
     return dbg.space();
 }
 
-GPhotoCamera::GPhotoCamera(GPContext *context, const CameraAbilities &abilities,
-                           const GPPortInfo &portInfo, QObject *parent)
+GPhotoCamera::GPhotoCamera(int cameraIndex, std::unique_ptr<GPhotoBackend> backend, GPhotoCameraMetrics *metrics,
+                           GPhotoTransferMonitor *transfers, QObject *parent)
     : QObject(parent)
-    , m_context(context)
-    , m_abilities(abilities)
-    , m_portInfo(portInfo)
-    , m_camera(nullptr, gp_camera_free)
+    , m_cameraIndex(cameraIndex)
+    , m_backend(std::move(backend))
+    , m_metrics(metrics)
+    , m_transfers(transfers)
     , m_file(nullptr, gp_file_free)
+    , m_config(nullptr, gp_widget_free)
+    , m_bracketConfig(nullptr, gp_widget_free)
+    , m_cardIndex(new GPhotoCardIndex(m_backend.get()))
+    , m_importer(new GPhotoImporter(m_backend.get(), m_cardIndex.get()))
 {
     connect(this, &GPhotoCamera::previewCaptured, this, &GPhotoCamera::capturePreview, Qt::QueuedConnection);
+
+    m_captureTimer.setSingleShot(true);
+    connect(&m_captureTimer, &QTimer::timeout, this, &GPhotoCamera::processCapture);
+
+    m_eventTimer.setInterval(eventPollInterval);
+    connect(&m_eventTimer, &QTimer::timeout, this, &GPhotoCamera::pollEvents);
+
+    m_downloadTimer.setSingleShot(true);
+    connect(&m_downloadTimer, &QTimer::timeout, this, &GPhotoCamera::processDownloads);
+
+    m_importTimer.setSingleShot(true);
+    connect(&m_importTimer, &QTimer::timeout, this, &GPhotoCamera::processImport);
+
+    // Coarse timers may fire 5% late, that's seconds for long intervals
+    m_timelapseTimer.setSingleShot(true);
+    m_timelapseTimer.setTimerType(Qt::PreciseTimer);
+    connect(&m_timelapseTimer, &QTimer::timeout, this, &GPhotoCamera::processTimelapse);
+
+    connect(m_importer.get(), &GPhotoImporter::fileImported, this, &GPhotoCamera::fileImported);
+    connect(m_importer.get(), &GPhotoImporter::finished, this, &GPhotoCamera::importFinished);
+    connect(m_importer.get(), &GPhotoImporter::progress, this, &GPhotoCamera::importProgress);
 }
 
 GPhotoCamera::~GPhotoCamera()
@@ -99,6 +187,10 @@ void GPhotoCamera::setCaptureMode(QCamera::CaptureModes captureMode)
     if (m_captureMode != captureMode) {
         m_captureMode = captureMode;
         emit captureModeChanged(captureMode);
+
+        // Movie doesn't outlive the video mode
+        if (!(captureMode & QCamera::CaptureVideo))
+            stopRecording();
     }
 }
 
@@ -109,114 +201,476 @@ void GPhotoCamera::capturePhoto(int id, const QString &fileName)
         return;
     }
 
-    setMirrorPosition(MirrorPosition::Down);
+    CaptureRequest request;
+    request.id = id;
+    request.fileName = fileName;
+    m_captureQueue.enqueue(request);
 
-    // Capture the frame from camera
-    // See https://github.com/gphoto/libgphoto2/issues/156 for RAW+JPEG fix
-    auto ret = gp_camera_trigger_capture(m_camera.get(), m_context);
-    if (ret < GP_OK) {
-        qWarning() << "GPhoto: Failed to capture frame:" << ret;
-        emit imageCaptureError(id, QCameraImageCapture::ResourceError, tr("Failed to capture frame"));
+    // Requests are processed one by one, next one is started when the current capture finishes
+    if (CaptureState::Idle == m_captureState) {
+        setMirrorPosition(MirrorPosition::Down);
+        startCapture();
+    }
+}
+
+void GPhotoCamera::captureBracket(int id, const QString &fileName, const QVariantList &steps)
+{
+    const auto &fail = [this, id, &steps] (const QString &errorString) {
+        for (auto i = 0; i < steps.size(); ++i)
+            emit imageCaptureError(id + i, QCameraImageCapture::ResourceError, errorString);
+    };
+
+    if (!isReadyForCapture()) {
+        for (auto i = 0; i < steps.size(); ++i)
+            emit imageCaptureError(id + i, QCameraImageCapture::NotReadyError, tr("Camera is not ready"));
         return;
     }
 
-    CameraEvent event;
-    auto done = false;
+    // Choices are resolved up front, so the frames don't wait for the config tree
+    QJsonObject restore;
+    QList<QJsonObject> settings;
+    for (const auto &step : steps) {
+        const auto &values = step.toMap();
+        QJsonObject frame;
+        for (auto it = values.cbegin(); values.cend() != it; ++it) {
+            const auto &choice = resolveBracketChoice(it.key(), it.value(), &restore);
+            if (choice.isEmpty()) {
+                fail(tr("Bracketing step is out of range of %1").arg(it.key()));
+                return;
+            }
+            frame.insert(it.key(), choice);
+        }
+        settings.append(frame);
+    }
 
-    do {
-        event = waitForNextEvent(1000); // todo: How long to wait for long exposures?
+    for (auto i = 0; i < settings.size(); ++i) {
+        CaptureRequest request;
+        request.id = id + i;
+        request.fileName = sequenceFileName(fileName, i);
+        request.settings = settings.at(i);
+        request.bracketFrame = i;
 
-        if (GP_EVENT_FILE_ADDED == event.event) {
-            // Download the file
-            CameraFile* file = nullptr;
-            gp_file_new(&file);
-            // Unique pointer will free memory on exit
-            auto filePtr = CameraFilePtr(file, gp_file_free);
+        if (settings.size() - 1 == i)
+            request.restore = restore;
 
-            auto ret = gp_camera_file_get(m_camera.get(), event.folderName.toLatin1(), event.fileName.toLatin1(),
-                                          GP_FILE_TYPE_NORMAL, file, m_context);
+        m_captureQueue.enqueue(request);
+    }
 
-            if (ret < GP_OK) {
-                qWarning() << "GPhoto: Failed to get file from camera:" << ret;
-                emit imageCaptureError(id, QCameraImageCapture::ResourceError, tr("Failed to download file from camera"));
-            } else {
-                const char* data = nullptr;
-                unsigned long int size = 0;
-
-                ret = gp_file_get_data_and_size(file, &data, &size);
-                if (ret < GP_OK) {
-                    qWarning() << "GPhoto: Failed to get file data and size from camera:" << ret;
-                    emit imageCaptureError(id, QCameraImageCapture::ResourceError, tr("Failed to download file from camera"));
-                } else {
-                    auto format = QFileInfo(event.fileName).suffix();
-
-                    if (fileName.isEmpty()) {
-                        // no proposal file name
-                        emit imageCaptured(id, QByteArray(data, int(size)), format, fileName);
-                    } else {
-                        if (QFileInfo(fileName).suffix() == format) {
-                            // extension matches, so use proposed name:
-                            emit imageCaptured(id, QByteArray(data, int(size)), format, fileName);
-                        } else {
-                            // other extension, so use empty name
-                            emit imageCaptured(id, QByteArray(data, int(size)), format, QString());
-                        }
-                    }
-                }
-            }
-        } else if (GP_EVENT_CAPTURE_COMPLETE == event.event) {
-            done = true;
-        }
-    } while (!done);
+    if (CaptureState::Idle == m_captureState && !m_captureQueue.isEmpty()) {
+        setMirrorPosition(MirrorPosition::Down);
+        startCapture();
+    }
+}
 
-    setMirrorPosition(MirrorPosition::Up);
+QString GPhotoCamera::resolveBracketChoice(const QString &name, const QVariant &step, QJsonObject *restore)
+{
+    // Exact choice, e.g. focus drive command which is repeated for every frame
+    if (QVariant::String == step.type())
+        return step.toString();
+
+    auto option = configWidget(name);
+    if (!option) {
+        qWarning() << "GPhoto: Unable to get option" << qPrintable(name) << "from gphoto";
+        return {};
+    }
+
+    const auto &current = restore->contains(name) ? restore->value(name).toString() : widgetValue(option).toString();
+    auto count = gp_widget_count_choices(option);
+    for (auto i = 0; i < count; ++i) {
+        const char *choice = nullptr;
+        if (gp_widget_get_choice(option, i, &choice) < GP_OK || current != QString::fromLocal8Bit(choice))
+            continue;
+
+        auto index = i + step.toInt();
+        if (index < 0 || count <= index || gp_widget_get_choice(option, index, &choice) < GP_OK)
+            return {};
+
+        restore->insert(name, current);
+        return QString::fromLocal8Bit(choice);
+    }
+
+    qWarning() << "GPhoto: Current value" << current << "of" << name << "is not one of its choices";
+    return {};
 }
 
-QVariant GPhotoCamera::parameter(const QString &name)
+bool GPhotoCamera::applyBracketSettings(const QJsonObject &settings)
 {
-    CameraWidget *root = nullptr;
-    auto ret = gp_camera_get_config(m_camera.get(), &root, m_context);
-    if (ret < GP_OK) {
-        qWarning() << "GPhoto: Unable to get root option from gphoto while getting parameter" << qPrintable(name);
-        return QVariant();
+    GPhotoTraceSpan span("applyBracket", m_cameraIndex);
+
+    // Tree is downloaded once per sequence, camera gets only the widgets which changed since the last frame
+    if (!m_bracketConfig) {
+        CameraWidget *root = nullptr;
+        if (m_backend->getConfig(&root) < GP_OK) {
+            qWarning() << "GPhoto: Unable to get root option from gphoto";
+            return false;
+        }
+        m_bracketConfig.reset(root);
     }
 
-    CameraWidget *option = nullptr;
-    ret = gp_widget_get_child_by_name(root, qPrintable(name), &option);
+    for (auto it = settings.constBegin(); settings.constEnd() != it; ++it) {
+        CameraWidget *option = nullptr;
+        if (gp_widget_get_child_by_name(m_bracketConfig.get(), qPrintable(it.key()), &option) < GP_OK
+                || !setWidgetValue(it.key(), option, it.value().toString())) {
+            return false;
+        }
+
+        // Radio and text widgets are marked only when the string differs, but the camera may have moved on since
+        gp_widget_set_changed(option, 1);
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    auto ret = m_backend->setConfig(m_bracketConfig.get());
+    m_metrics->record(GPhotoCameraMetrics::ConfigSet, timer.nsecsElapsed());
+
+    // Shared tree doesn't know about the change
+    invalidateConfig();
+
     if (ret < GP_OK) {
-        qWarning() << "GPhoto: Unable to get config widget from gphoto";
+        qWarning() << "GPhoto: Failed to set config to camera";
+        m_bracketConfig.reset();
+        return false;
+    }
+
+    waitForConfigAck(settings.keys());
+    return true;
+}
+
+void GPhotoCamera::downloadPipelinedFiles(int count)
+{
+    for (auto i = 0; i < count && !m_pipelinedFiles.isEmpty(); ++i) {
+        const auto file = m_pipelinedFiles.dequeue();
+
+        QElapsedTimer timer;
+        timer.start();
+        downloadFile(file.first, file.second);
+        m_lastDownloadNsecs = timer.nsecsElapsed();
+    }
+}
+
+void GPhotoCamera::startTimelapse(int id, const QString &fileName, int interval, int count)
+{
+    stopTimelapse();
+
+    m_timelapseId = id;
+    m_timelapseFileName = fileName;
+    m_timelapseInterval = qMax(interval, 0);
+    m_timelapseCount = qMax(count, 0);
+    m_timelapseShot = 0;
+
+    // Shutter speed is read once, property events keep it up to date
+    m_timelapseExposure = exposureTime();
+
+    // All the deadlines are counted from here, not from the previous shot
+    m_timelapseClock.start();
+    processTimelapse();
+}
+
+void GPhotoCamera::stopTimelapse()
+{
+    m_timelapseTimer.stop();
+    m_timelapseCount = m_timelapseShot;
+
+    // Viewfinder and downloads could be waiting for the shot which won't come
+    resumePreview();
+
+    if (!m_downloadQueue.isEmpty() || !m_pipelinedFiles.isEmpty())
+        m_downloadTimer.start(0);
+}
+
+void GPhotoCamera::processTimelapse()
+{
+    const auto interval = qint64(m_timelapseInterval) * nsecsPerMsec;
+    auto now = m_timelapseClock.nsecsElapsed();
+
+    // Shots we're too late for are skipped, so the rest of the plan stays where it was
+    while (isTimelapseRunning() && m_timelapseShot < m_timelapseCount - 1 && m_timelapseShot * interval + interval <= now)
+        skipTimelapseShot();
+
+    if (!isTimelapseRunning())
+        return;
+
+    if (!isReadyForCapture() || !m_captureQueue.isEmpty()) {
+        skipTimelapseShot();
+    } else {
+        CaptureRequest request;
+        request.id = m_timelapseId + m_timelapseShot;
+        request.fileName = sequenceFileName(m_timelapseFileName, m_timelapseShot);
+        request.timelapseShot = m_timelapseShot;
+        request.deadline = m_timelapseShot * interval;
+        request.timeout = captureBaseTimeout + 2 * m_timelapseExposure;
+        m_captureQueue.enqueue(request);
+        ++m_timelapseShot;
+
+        // Busy camera takes the shot as soon as it's done with the previous one.
+        // Mirror is usually down already, it's lowered before the shot window
+        if (CaptureState::Idle == m_captureState) {
+            setMirrorPosition(MirrorPosition::Down);
+            startCapture();
+        }
+    }
+
+    if (isTimelapseRunning()) {
+        now = m_timelapseClock.nsecsElapsed();
+        m_timelapseTimer.start(int(qMax<qint64>(0, m_timelapseShot * interval - now) / nsecsPerMsec));
+    }
+}
+
+void GPhotoCamera::skipTimelapseShot()
+{
+    emit imageCaptureError(m_timelapseId + m_timelapseShot, QCameraImageCapture::NotReadyError,
+                           tr("Timelapse shot skipped, camera was busy"));
+    ++m_timelapseShot;
+
+    // Viewfinder was paused for this shot
+    resumePreview();
+}
+
+void GPhotoCamera::resumePreview()
+{
+    if (m_previewPaused) {
+        m_previewPaused = false;
+        QMetaObject::invokeMethod(this, "capturePreview", Qt::QueuedConnection);
+    }
+}
+
+bool GPhotoCamera::isTimelapseRunning() const
+{
+    return m_timelapseShot < m_timelapseCount;
+}
+
+bool GPhotoCamera::isShotWindow(qint64 nsecs) const
+{
+    if (!isTimelapseRunning())
+        return false;
+
+    // Anything started now must be done before the shot, and so must lowering the mirror after it
+    auto mirror = (m_mirrorKnown && MirrorPosition::Down == m_mirrorPosition) ? 0 : m_lastMirrorNsecs;
+    auto guard = qMax(qMax(m_lastPreviewNsecs, m_lastDownloadNsecs), nsecs) + mirror + timelapseMargin * nsecsPerMsec;
+    auto deadline = m_timelapseShot * qint64(m_timelapseInterval) * nsecsPerMsec;
+    return deadline - m_timelapseClock.nsecsElapsed() < guard;
+}
+
+void GPhotoCamera::startRecording(int id, const QString &fileName)
+{
+    if (!(m_captureMode & QCamera::CaptureVideo)
+            || (QCamera::ActiveStatus != m_status && QCamera::LoadedStatus != m_status)) {
+        emit imageCaptureError(id, QCameraImageCapture::NotReadyError, tr("Camera is not ready"));
+        return;
+    }
+
+    // Movie can't start in the middle of a shot or of another movie
+    if (CaptureState::Idle != m_captureState) {
+        emit imageCaptureError(id, QCameraImageCapture::NotReadyError, tr("Camera is busy"));
+        return;
+    }
+
+    if (!setMovieRecording(true)) {
+        qWarning() << "GPhoto: Failed to start movie recording";
+        emit imageCaptureError(id, QCameraImageCapture::ResourceError, tr("Failed to start recording"));
+        return;
+    }
+
+    m_capture = CaptureRequest();
+    m_capture.id = id;
+    m_capture.fileName = fileName;
+    m_capture.movie = true;
+    m_captureState = CaptureState::Recording;
+
+    emit recordingChanged(id, true);
+}
+
+void GPhotoCamera::stopRecording()
+{
+    if (CaptureState::Recording != m_captureState)
+        return;
+
+    emit recordingChanged(m_capture.id, false);
+
+    // Movie file can't come before the camera is told to stop
+    if (!setMovieRecording(false)) {
+        qWarning() << "GPhoto: Failed to stop movie recording";
+        emit imageCaptureError(m_capture.id, QCameraImageCapture::ResourceError, tr("Failed to stop recording"));
+        finishCapture();
+        return;
+    }
+
+    // Camera writes the movie to the card and reports it like a captured photo
+    m_captureState = CaptureState::Exposing;
+    m_captureDeadline = movieFinishTimeout;
+    m_captureEventTimeout = minCaptureEventTimeout;
+    m_captureFileCount = 0;
+    m_captureFiles.clear();
+    m_captureElapsed.start();
+
+    if (GPhotoTrace::isEnabled())
+        m_captureTraceStart = GPhotoTrace::now();
+
+    m_captureTimer.start(0);
+}
+
+void GPhotoCamera::setTethered(bool tethered)
+{
+    m_tethered = tethered;
+}
+
+void GPhotoCamera::setDownloadPolicy(DownloadPolicy policy, const QStringList &extensions)
+{
+    m_downloadPolicy = policy;
+
+    m_downloadExtensions.clear();
+    for (const auto &extension : extensions)
+        m_downloadExtensions.append(extension.trimmed().toUpper());
+}
+
+void GPhotoCamera::setSaveDirectories(const QString &directory, const QVariantMap &formatDirectories)
+{
+    m_saveDirectory = directory;
+    m_formatDirectories = formatDirectories;
+}
+
+QStringList GPhotoCamera::deferredFiles() const
+{
+    return m_deferredFiles;
+}
+
+void GPhotoCamera::clearDeferredFiles()
+{
+    m_deferredFiles.clear();
+}
+
+void GPhotoCamera::importFiles(const QString &destination)
+{
+    if (m_importer->isRunning()) {
+        qWarning() << "GPhoto: Import is already running";
+        return;
+    }
+
+    // Import doesn't need the camera to be loaded, just connected
+    prewarm();
+
+    const auto &serialNumber = m_backend->isOpen() ? parameter(QLatin1String(serialNumberParameter)).toString()
+                                                   : QString();
+
+    // Events are read only while the camera is loaded, the index can't follow the card otherwise
+    if (!m_eventTimer.isActive())
+        m_cardIndex->stopTracking();
+
+    if (!m_backend->isOpen() || !m_importer->start(serialNumber, destination)) {
+        emit importFinished(0, 1);
+        return;
+    }
+
+    m_importTimer.start(0);
+}
+
+void GPhotoCamera::cancelImport()
+{
+    m_importTimer.stop();
+    m_importer->cancel();
+}
+
+void GPhotoCamera::cancelCapture()
+{
+    if (CaptureState::Idle == m_captureState && m_captureQueue.isEmpty())
+        return;
+
+    abortCaptures(QCameraImageCapture::NotReadyError, tr("Capture cancelled"));
+    finishCapture();
+}
+
+QVariant GPhotoCamera::parameter(const QString &name)
+{
+    auto option = configWidget(name);
+    if (!option) {
+        qWarning() << "GPhoto: Unable to get config widget" << qPrintable(name) << "from gphoto";
         return QVariant();
     }
 
-    // Unique pointer will free memory on exit
-    auto optionPtr = CameraWidgetPtr(option, gp_widget_free);
+    return widgetValue(option);
+}
 
+QVariant GPhotoCamera::widgetValue(CameraWidget *option)
+{
     CameraWidgetType type;
-    ret = gp_widget_get_type(option, &type);
+    auto ret = gp_widget_get_type(option, &type);
     if (ret < GP_OK) {
         qWarning() << "GPhoto: Unable to get config widget type from gphoto";
         return QVariant();
     }
 
-    if (type == GP_WIDGET_RADIO) {
-        char *value;
+    const char *name = nullptr;
+    gp_widget_get_name(option, &name);
+
+    switch (type) {
+    case GP_WIDGET_WINDOW:
+    case GP_WIDGET_SECTION: {
+        // Widget names are unique in the tree, so the values of nested sections go to the same map
+        QVariantMap values;
+        for (auto i = 0; i < gp_widget_count_children(option); ++i) {
+            CameraWidget *child = nullptr;
+            const char *childName = nullptr;
+            CameraWidgetType childType;
+            if (gp_widget_get_child(option, i, &child) < GP_OK || gp_widget_get_name(child, &childName) < GP_OK
+                    || gp_widget_get_type(child, &childType) < GP_OK) {
+                continue;
+            }
+
+            const auto &value = widgetValue(child);
+            if (GP_WIDGET_WINDOW == childType || GP_WIDGET_SECTION == childType) {
+                const auto &children = value.toMap();
+                for (auto it = children.cbegin(); children.cend() != it; ++it)
+                    values.insert(it.key(), it.value());
+            } else if (value.isValid()) {
+                values.insert(QString::fromLocal8Bit(childName), value);
+            }
+        }
+        return values;
+    }
+    case GP_WIDGET_TEXT:
+    case GP_WIDGET_RADIO:
+    case GP_WIDGET_MENU: {
+        char *value = nullptr;
         ret = gp_widget_get_value(option, &value);
         if (ret < GP_OK) {
-            qWarning() << "GPhoto: Unable to get value for option" << qPrintable(name) << "from gphoto";
+            qWarning() << "GPhoto: Unable to get value for option" << name << "from gphoto";
             return QVariant();
         }
         return QString::fromLocal8Bit(value);
     }
-
-    if (type == GP_WIDGET_TOGGLE) {
+    case GP_WIDGET_TOGGLE: {
         auto value = 0;
         ret = gp_widget_get_value(option, &value);
         if (ret < GP_OK) {
-            qWarning() << "GPhoto: Unable to get value for option" << qPrintable(name) << "from gphoto";
+            qWarning() << "GPhoto: Unable to get value for option" << name << "from gphoto";
             return QVariant();
         }
         return value != 0;
     }
+    case GP_WIDGET_RANGE: {
+        auto value = 0.0F;
+        ret = gp_widget_get_value(option, &value);
+        if (ret < GP_OK) {
+            qWarning() << "GPhoto: Unable to get value for option" << name << "from gphoto";
+            return QVariant();
+        }
+        return qreal(value);
+    }
+    case GP_WIDGET_DATE: {
+        // Seconds since epoch
+        auto value = 0;
+        ret = gp_widget_get_value(option, &value);
+        if (ret < GP_OK) {
+            qWarning() << "GPhoto: Unable to get value for option" << name << "from gphoto";
+            return QVariant();
+        }
+        return QDateTime::fromMSecsSinceEpoch(qint64(value) * 1000);
+    }
+    case GP_WIDGET_BUTTON:
+        // Buttons can only be pressed
+        return QVariant();
+    }
 
     qWarning() << "GPhoto: Options of type" << type << "are currently not supported";
     return QVariant();
@@ -224,33 +678,42 @@ QVariant GPhotoCamera::parameter(const QString &name)
 
 bool GPhotoCamera::setParameter(const QString &name, const QVariant &value)
 {
-    CameraWidget *root = nullptr;
-    auto ret = gp_camera_get_config(m_camera.get(), &root, m_context);
-    if (ret < GP_OK) {
-        qWarning() << "GPhoto: Unable to get root option from gphoto while setting parameter" << qPrintable(name);
+    // Get widget pointer
+    auto option = configWidget(name);
+    if (!option) {
+        qWarning() << "GPhoto: Unable to get option" << qPrintable(name) << "from gphoto";
         return false;
     }
 
-    // Get widget pointer
-    CameraWidget *option = nullptr;
-    ret = gp_widget_get_child_by_name(root, qPrintable(name), &option);
+    // Get option type
+    CameraWidgetType type;
+    auto ret = gp_widget_get_type(option, &type);
     if (ret < GP_OK) {
-        qWarning() << "GPhoto: Unable to get option" << qPrintable(name) << "from gphoto";
+        qWarning() << "GPhoto: Unable to get option type from gphoto";
         return false;
     }
 
-    // Unique pointer will free memory on exit
-    auto optionPtr = CameraWidgetPtr(option, gp_widget_free);
+    // Button acts right away, there's no value to upload
+    if (type == GP_WIDGET_BUTTON)
+        return pressButton(name, option);
 
-    // Get option type
+    if (!setWidgetValue(name, option, value))
+        return false;
+
+    // Works during an exposure too, events pumped while waiting for the ack are queued for the capture
+    return commitConfig();
+}
+
+bool GPhotoCamera::setWidgetValue(const QString &name, CameraWidget *option, const QVariant &value)
+{
     CameraWidgetType type;
-    ret = gp_widget_get_type(option, &type);
+    auto ret = gp_widget_get_type(option, &type);
     if (ret < GP_OK) {
         qWarning() << "GPhoto: Unable to get option type from gphoto";
         return false;
     }
 
-    if (type == GP_WIDGET_RADIO) {
+    if (type == GP_WIDGET_RADIO || type == GP_WIDGET_MENU) {
         if (value.type() == QVariant::String) {
             // String, need no conversion
             ret = gp_widget_set_value(option, qPrintable(value.toString()));
@@ -260,90 +723,32 @@ bool GPhotoCamera::setParameter(const QString &name, const QVariant &value)
                 return false;
             }
 
-            ret = gp_camera_set_config(m_camera.get(), root, m_context);
-
-            if (ret < GP_OK) {
-                qWarning() << "GPhoto: Failed to set config to camera";
-                return false;
-            }
-
-            waitForOperationCompleted();
             return true;
         }
 
         if (value.type() == QVariant::Double) {
             // Trying to find nearest possible value (with the distance of 0.1) and set it to property
             auto v = value.toDouble();
-
-            auto count = gp_widget_count_choices(option);
-            for (auto i = 0; i < count; ++i) {
-                const char *choice = nullptr;
-                gp_widget_get_choice(option, i, &choice);
-
-                // We use a workaround for flawed russian i18n of gphoto2 strings
-                auto ok = false;
-                auto choiceValue = QString::fromLocal8Bit(choice).replace(',', '.').toDouble(&ok);
-                if (!ok) {
-                    qDebug() << "GPhoto: Failed to convert value" << choice << "to double";
-                    continue;
-                }
-
-                if (qAbs(choiceValue - v) < 0.1) {
-                    ret = gp_widget_set_value(option, choice);
-                    if (ret < GP_OK) {
-                        qWarning() << "GPhoto: Failed to set value" << choice << "to" << name << "option:" << ret;
-                        return false;
-                    }
-
-                    ret = gp_camera_set_config(m_camera.get(), root, m_context);
-                    if (ret < GP_OK) {
-                        qWarning() << "GPhoto: Failed to set config to camera";
-                        return false;
-                    }
-
-                    waitForOperationCompleted();
-                    return true;
-                }
+            auto index = findNearestChoice(name, option, v);
+            if (index < 0) {
+                qWarning() << "GPhoto: Can't find value matching to" << v << "for option" << name;
+                return false;
             }
 
-            qWarning() << "GPhoto: Can't find value matching to" << v << "for option" << name;
-            return false;
+            return setChoice(name, option, index);
         }
 
         if (value.type() == QVariant::Int) {
             // Little hacks for 'ISO' option: if the value is -1, we pick the first non-integer value
             // we found and set it as a parameter
             auto v = value.toInt();
-
-
-            auto count = gp_widget_count_choices(option);
-            for (auto i = 0; i < count; ++i) {
-                const char *choice = nullptr;
-                gp_widget_get_choice(option, i, &choice);
-
-                auto ok = false;
-                auto choiceValue = QString::fromLocal8Bit(choice).toInt(&ok);
-
-                if ((ok && choiceValue == v) || (!ok && v == -1)) {
-                    ret = gp_widget_set_value(option, choice);
-                    if (ret < GP_OK) {
-                        qWarning() << "GPhoto: Failed to set value" << choice << "to" << name << "option:" << ret;
-                        return false;
-                    }
-
-                    ret = gp_camera_set_config(m_camera.get(), root, m_context);
-                    if (ret < GP_OK) {
-                        qWarning() << "GPhoto: Failed to set config to camera";
-                        return false;
-                    }
-
-                    waitForOperationCompleted();
-                    return true;
-                }
+            auto index = findIntegerChoice(name, option, v);
+            if (index < 0) {
+                qWarning() << "GPhoto: Can't find value matching to" << v << "for option" << name;
+                return false;
             }
 
-            qWarning() << "GPhoto: Can't find value matching to" << v << "for option" << name;
-            return false;
+            return setChoice(name, option, index);
         }
 
         qWarning() << "GPhoto: Failed to set value" << value << "to" << name << "option. Type" << value.type()
@@ -351,10 +756,20 @@ bool GPhotoCamera::setParameter(const QString &name, const QVariant &value)
         return false;
     }
 
-    if (type == GP_WIDGET_TOGGLE) {
-        auto v = 0;
-        if (value.canConvert<int>()) {
-            v = value.toInt();
+    if (type == GP_WIDGET_TEXT) {
+        ret = gp_widget_set_value(option, qPrintable(value.toString()));
+        if (ret < GP_OK) {
+            qWarning() << "GPhoto: Failed to set value" << value << "to" << name << "option:" << ret;
+            return false;
+        }
+
+        return true;
+    }
+
+    if (type == GP_WIDGET_TOGGLE) {
+        auto v = 0;
+        if (value.canConvert<int>()) {
+            v = value.toInt();
         } else {
             qWarning() << "GPhoto: Failed to set value" << value << "to" << name << "option. Type" << value.type()
                        << "is not supported";
@@ -367,13 +782,51 @@ bool GPhotoCamera::setParameter(const QString &name, const QVariant &value)
             return false;
         }
 
-        ret = gp_camera_set_config(m_camera.get(), root, m_context);
+        return true;
+    }
+
+    if (type == GP_WIDGET_RANGE) {
+        auto ok = false;
+        auto v = value.toDouble(&ok);
+        if (!ok) {
+            qWarning() << "GPhoto: Failed to set value" << value << "to" << name << "option. Type" << value.type()
+                       << "is not supported";
+            return false;
+        }
+
+        auto min = 0.0F;
+        auto max = 0.0F;
+        auto step = 0.0F;
+        ret = gp_widget_get_range(option, &min, &max, &step);
+        if (ret < GP_OK) {
+            qWarning() << "GPhoto: Unable to get widget range from gphoto";
+            return false;
+        }
+
+        // Camera accepts only the values on its steps
+        if (0 < step)
+            v = min + qRound((v - min) / step) * step;
+        auto f = float(qBound(qreal(min), v, qreal(max)));
+
+        ret = gp_widget_set_value(option, &f);
         if (ret < GP_OK) {
-            qWarning() << "GPhoto: Failed to set config to camera";
+            qWarning() << "GPhoto: Failed to set value" << f << "to" << name << "option:" << ret;
+            return false;
+        }
+
+        return true;
+    }
+
+    if (type == GP_WIDGET_DATE) {
+        // Date time or seconds since epoch
+        auto v = (value.type() == QVariant::DateTime) ? int(value.toDateTime().toMSecsSinceEpoch() / 1000) : value.toInt();
+
+        ret = gp_widget_set_value(option, &v);
+        if (ret < GP_OK) {
+            qWarning() << "GPhoto: Failed to set value" << v << "to" << name << "option:" << ret;
             return false;
         }
 
-        waitForOperationCompleted();
         return true;
     }
 
@@ -381,29 +834,36 @@ bool GPhotoCamera::setParameter(const QString &name, const QVariant &value)
     return false;
 }
 
-QVariantList GPhotoCamera::parameterValues(const QString &name, QMetaType::Type valueType)
+bool GPhotoCamera::pressButton(const QString &name, CameraWidget *option)
 {
-    CameraWidget *root = nullptr;
-    auto ret = gp_camera_get_config(m_camera.get(), &root, m_context);
+    GPhotoTraceSpan span("pressButton", m_cameraIndex);
+
+    auto ret = m_backend->pressButton(option);
+
+    // Button may change anything, e.g. reset all the settings
+    invalidateConfig();
+
     if (ret < GP_OK) {
-        qWarning() << "GPhoto: Unable to get root option from gphoto while setting parameter" << qPrintable(name);
-        return {};
+        qWarning() << "GPhoto: Failed to press" << name << "button:" << ret;
+        return false;
     }
 
+    waitForConfigAck({name});
+    return true;
+}
+
+QVariantList GPhotoCamera::parameterValues(const QString &name, QMetaType::Type valueType)
+{
     // Get widget pointer
-    CameraWidget *option = nullptr;
-    ret = gp_widget_get_child_by_name(root, qPrintable(name), &option);
-    if (ret < GP_OK) {
+    auto option = configWidget(name);
+    if (!option) {
         qWarning() << "GPhoto: Unable to get option" << qPrintable(name) << "from gphoto";
         return {};
     }
 
-    // Unique pointer will free memory on exit
-    auto optionPtr = CameraWidgetPtr(option, gp_widget_free);
-
     // Get option type
     CameraWidgetType type;
-    ret = gp_widget_get_type(option, &type);
+    auto ret = gp_widget_get_type(option, &type);
     if (ret < GP_OK) {
         qWarning() << "GPhoto: Unable to get option type from gphoto";
         return {};
@@ -428,7 +888,7 @@ QVariantList GPhotoCamera::parameterValues(const QString &name, QMetaType::Type
             values.append(min += step);
 
         values.append(max);
-    } else if (GP_WIDGET_RADIO == type) {
+    } else if (GP_WIDGET_RADIO == type || GP_WIDGET_MENU == type) {
         auto count = gp_widget_count_choices(option);
         for (auto i = 0; i < count; ++i) {
             const char *choice = nullptr;
@@ -469,22 +929,115 @@ QVariantList GPhotoCamera::parameterValues(const QString &name, QMetaType::Type
     return values;
 }
 
+QJsonObject GPhotoCamera::snapshotConfig()
+{
+    auto root = configWidget(QString());
+    if (!root)
+        return {};
+
+    QJsonObject snapshot;
+    snapshotWidget(root, &snapshot);
+    return snapshot;
+}
+
+void GPhotoCamera::snapshotWidget(CameraWidget *option, QJsonObject *snapshot)
+{
+    CameraWidgetType type;
+    if (gp_widget_get_type(option, &type) < GP_OK)
+        return;
+
+    if (GP_WIDGET_WINDOW == type || GP_WIDGET_SECTION == type) {
+        for (auto i = 0; i < gp_widget_count_children(option); ++i) {
+            CameraWidget *child = nullptr;
+            if (gp_widget_get_child(option, i, &child) >= GP_OK)
+                snapshotWidget(child, snapshot);
+        }
+        return;
+    }
+
+    auto readonly = 0;
+    const char *name = nullptr;
+    if (GP_WIDGET_DATE == type || GP_WIDGET_BUTTON == type || gp_widget_get_readonly(option, &readonly) < GP_OK
+            || readonly || gp_widget_get_name(option, &name) < GP_OK || isActionWidget(name)) {
+        return;
+    }
+
+    const auto &value = widgetValue(option);
+    if (value.isValid())
+        snapshot->insert(QString::fromLocal8Bit(name), QJsonValue::fromVariant(value));
+}
+
+bool GPhotoCamera::applyConfig(const QJsonObject &snapshot)
+{
+    auto ok = true;
+    auto changed = 0;
+
+    // Diff is made against the cached tree, so unchanged settings cost nothing
+    for (auto it = snapshot.constBegin(); snapshot.constEnd() != it; ++it) {
+        auto option = configWidget(it.key());
+        if (!option) {
+            qWarning() << "GPhoto: Unable to get option" << qPrintable(it.key()) << "from gphoto";
+            ok = false;
+            continue;
+        }
+
+        const auto &value = it.value().toVariant();
+        if (widgetValue(option) == value)
+            continue;
+
+        if (setWidgetValue(it.key(), option, value))
+            ++changed;
+        else
+            ok = false;
+    }
+
+    // All the changes go in one request
+    if (0 < changed)
+        ok = commitConfig() && ok;
+
+    return ok;
+}
+
 void GPhotoCamera::capturePreview()
 {
     if (m_status != QCamera::ActiveStatus)
         return;
 
+    // Viewfinder is resumed when capture finishes, movies are recorded with it running
+    if (CaptureState::Exposing == m_captureState)
+        return;
+
+    // Frame could be late for the timelapse shot, the shot resumes viewfinder too.
+    // Mirror goes down now, so the shot doesn't wait for it
+    if (isShotWindow()) {
+        m_previewPaused = true;
+        setMirrorPosition(MirrorPosition::Down);
+        return;
+    }
+
+    // Mirror stays down after a timelapse shot till the viewfinder needs it
+    setMirrorPosition(MirrorPosition::Up);
+
+    GPhotoTraceSpan span("capturePreview", m_cameraIndex);
+
     gp_file_clean(m_file.get());
 
-    auto ret = gp_camera_capture_preview(m_camera.get(), m_file.get(), m_context);
+    QElapsedTimer timer;
+    timer.start();
+
+    auto ret = m_backend->capturePreview(m_file.get());
     if (GP_OK == ret) {
         const char *data = nullptr;
         unsigned long int size = 0;
         ret = gp_file_get_data_and_size(m_file.get(), &data, &size);
         if (GP_OK == ret) {
+            m_lastPreviewNsecs = timer.nsecsElapsed();
+            m_metrics->record(GPhotoCameraMetrics::PreviewFetch, m_lastPreviewNsecs);
             m_capturingFailCount = 0;
             if (!QThread::currentThread()->isInterruptionRequested()) {
+                timer.restart();
                 auto image = QImage::fromData(QByteArray(data, int(size)));
+                m_metrics->record(GPhotoCameraMetrics::PreviewDecode, timer.nsecsElapsed());
                 emit previewCaptured(image);
             }
             return;
@@ -492,6 +1045,7 @@ void GPhotoCamera::capturePreview()
     }
 
     qWarning() << "GPhoto: Failed retrieving preview" << ret;
+    m_metrics->increment(GPhotoCameraMetrics::PreviewErrors);
     ++m_capturingFailCount;
 
     if (capturingFailLimit < m_capturingFailCount) {
@@ -501,63 +1055,310 @@ void GPhotoCamera::capturePreview()
     }
 }
 
-void GPhotoCamera::openCamera()
+void GPhotoCamera::prewarm()
 {
-    // Camera is already open
-    if (m_camera)
+    // Camera is already open or pre-warmed
+    if (m_backend->isOpen())
         return;
 
-    setStatus(QCamera::LoadingStatus);
-
-    // Create camera object
-    Camera *camera;
-    auto ret = gp_camera_new(&camera);
-    if (ret != GP_OK) {
-        openCameraErrorHandle(QLatin1String("Unable to open camera"));
+    QString errorText;
+    if (!createCamera(&errorText)) {
+        qWarning() << "GPhoto: Failed to pre-warm camera:" << qPrintable(errorText);
         return;
     }
 
-    auto cameraPtr = CameraPtr(camera, gp_camera_free);
-
-    ret = gp_camera_set_abilities(camera, m_abilities);
+    auto ret = m_backend->init();
     if (ret < GP_OK) {
-        openCameraErrorHandle(QLatin1String("Unable to set abilities for camera"));
+        qWarning() << "GPhoto: Failed to pre-warm camera: unable to init camera:" << ret;
+        gp_file_clean(m_file.get());
+        m_file.reset();
+        m_backend->close();
         return;
     }
 
-    ret = gp_camera_set_port_info(camera, m_portInfo);
-    if (ret < GP_OK) {
-        openCameraErrorHandle(QLatin1String("Unable to set port info for camera"));
-        return;
-    }
+    refreshConfig();
+}
+
+bool GPhotoCamera::createCamera(QString *errorText)
+{
+    if (!m_backend->open(errorText))
+        return false;
 
     CameraFile *file;
     gp_file_new(&file);
     m_file.reset(file);
-    m_camera = std::move(cameraPtr);
     m_capturingFailCount = 0;
 
+    return true;
+}
+
+void GPhotoCamera::openCamera()
+{
+    // Camera is already open
+    if (m_backend->isOpen() && QCamera::UnloadedStatus != m_status && QCamera::UnavailableStatus != m_status)
+        return;
+
+    setStatus(QCamera::LoadingStatus);
+
+    // Pre-warmed camera is connected already, so we only need to create it otherwise
+    QString errorText;
+    if (!m_backend->isOpen() && !createCamera(&errorText)) {
+        openCameraErrorHandle(errorText);
+        return;
+    }
+
+    // Watch for changes made on camera body while we're idle
+    m_eventTimer.start();
+
     setStatus(QCamera::LoadedStatus);
 }
 
 void GPhotoCamera::closeCamera()
 {
     // Camera is already closed
-    if (!m_camera)
+    if (!m_backend->isOpen())
         return;
 
+    // Pre-warmed camera was never loaded, so there is no status to report
+    auto loaded = (QCamera::UnloadedStatus != m_status && QCamera::UnavailableStatus != m_status);
+
+    m_eventTimer.stop();
+    m_timelapseTimer.stop();
+    m_timelapseCount = m_timelapseShot;
+    abortCaptures(QCameraImageCapture::NotReadyError, tr("Camera is closed"));
+
+    // Closed camera takes no settings, files of the finished bracketing frames stay on the card
+    m_capture.restore = QJsonObject();
+    m_bracketConfig.reset();
+    while (!m_pipelinedFiles.isEmpty())
+        emit imageCaptureError(m_pipelinedFiles.dequeue().first.id, QCameraImageCapture::NotReadyError, tr("Camera is closed"));
+
     if (QCamera::ActiveStatus == m_status)
         stopViewFinder();
 
-    setStatus(QCamera::UnloadingStatus);
+    if (loaded)
+        setStatus(QCamera::UnloadingStatus);
+
+    invalidateConfig();
+    m_mirrorKnown = false;
+    m_events.clear();
+    m_downloadTimer.stop();
+    m_downloadQueue.clear();
+    cancelImport();
+
+    // Card can be changed while the camera is disconnected
+    m_cardIndex->stopTracking();
 
     gp_file_clean(m_file.get());
     m_file.reset();
 
-    gp_camera_exit(m_camera.get(), m_context);
-    m_camera.reset();
+    m_backend->close();
 
-    setStatus(QCamera::UnloadedStatus);
+    if (loaded)
+        setStatus(QCamera::UnloadedStatus);
+}
+
+CameraWidget* GPhotoCamera::configWidget(const QString &name)
+{
+    // Bursts of unnamed changes are coalesced to one download per interval
+    auto stale = m_configStale && m_configAge.hasExpired(configRefreshInterval);
+    if ((!m_config || stale) && !refreshConfig())
+        return nullptr;
+
+    // Empty name stands for the whole tree
+    if (name.isEmpty())
+        return m_config.get();
+
+    CameraWidget *option = nullptr;
+    auto ret = gp_widget_get_child_by_name(m_config.get(), qPrintable(name), &option);
+    return (ret < GP_OK) ? nullptr : option;
+}
+
+const GPhotoCamera::ChoiceTable& GPhotoCamera::choiceTable(const QString &name, CameraWidget *option)
+{
+    auto it = m_choiceTables.constFind(name);
+    if (m_choiceTables.cend() != it)
+        return it.value();
+
+    // Choice strings are parsed once per config tree, not on every set
+    ChoiceTable table;
+    auto count = gp_widget_count_choices(option);
+    for (auto i = 0; i < count; ++i) {
+        const char *choice = nullptr;
+        gp_widget_get_choice(option, i, &choice);
+        const auto &str = QString::fromLocal8Bit(choice);
+
+        auto integer = false;
+        str.toInt(&integer);
+        if (!integer && table.nonInteger < 0)
+            table.nonInteger = i;
+
+        // We use a workaround for flawed russian i18n of gphoto2 strings
+        auto ok = false;
+        auto value = QString(str).replace(',', '.').toDouble(&ok);
+        if (ok)
+            table.numbers.append({value, i, integer});
+    }
+
+    // Choices of equal values stay in camera order
+    std::stable_sort(table.numbers.begin(), table.numbers.end(), [] (const ChoiceTable::Choice &a, const ChoiceTable::Choice &b) {
+        return a.value < b.value;
+    });
+
+    return m_choiceTables.insert(name, table).value();
+}
+
+int GPhotoCamera::findNearestChoice(const QString &name, CameraWidget *option, double value)
+{
+    const auto &numbers = choiceTable(name, option).numbers;
+    const auto &isLess = [] (const ChoiceTable::Choice &choice, double value) {
+        return choice.value < value;
+    };
+
+    // Nearest is the first choice not less than the value or the one before it
+    auto it = std::lower_bound(numbers.cbegin(), numbers.cend(), value, isLess);
+    if (numbers.cbegin() != it && (numbers.cend() == it || value - (it - 1)->value <= it->value - value))
+        it = std::lower_bound(numbers.cbegin(), numbers.cend(), (it - 1)->value, isLess);
+
+    if (numbers.cend() == it || 0.1 <= qAbs(it->value - value))
+        return -1;
+
+    return it->index;
+}
+
+int GPhotoCamera::findIntegerChoice(const QString &name, CameraWidget *option, int value)
+{
+    const auto &table = choiceTable(name, option);
+    if (-1 == value)
+        return table.nonInteger;
+
+    auto it = std::lower_bound(table.numbers.cbegin(), table.numbers.cend(), double(value),
+                               [] (const ChoiceTable::Choice &choice, double value) {
+        return choice.value < value;
+    });
+
+    for (; table.numbers.cend() != it && double(value) == it->value; ++it) {
+        if (it->integer)
+            return it->index;
+    }
+
+    return -1;
+}
+
+bool GPhotoCamera::setChoice(const QString &name, CameraWidget *option, int index)
+{
+    const char *choice = nullptr;
+    auto ret = gp_widget_get_choice(option, index, &choice);
+    if (ret < GP_OK) {
+        qWarning() << "GPhoto: Unable to get choice" << index << "of" << name << "option:" << ret;
+        return false;
+    }
+
+    ret = gp_widget_set_value(option, choice);
+    if (ret < GP_OK) {
+        qWarning() << "GPhoto: Failed to set value" << choice << "to" << name << "option:" << ret;
+        return false;
+    }
+
+    return true;
+}
+
+bool GPhotoCamera::refreshConfig()
+{
+    GPhotoTraceSpan span("getConfig", m_cameraIndex);
+
+    QElapsedTimer timer;
+    timer.start();
+
+    CameraWidget *root = nullptr;
+    auto ret = m_backend->getConfig(&root);
+    m_metrics->record(GPhotoCameraMetrics::ConfigGet, timer.nsecsElapsed());
+
+    if (ret < GP_OK) {
+        qWarning() << "GPhoto: Unable to get root option from gphoto:" << ret;
+        invalidateConfig();
+        return false;
+    }
+
+    m_config.reset(root);
+    m_configStale = false;
+    m_configAge.start();
+    m_choiceTables.clear();
+    return true;
+}
+
+void GPhotoCamera::invalidateConfig()
+{
+    // Tree will be downloaded again on the next access
+    m_config.reset();
+    m_configStale = false;
+    m_choiceTables.clear();
+}
+
+void GPhotoCamera::updateConfig(const GPhotoCamera::CameraEvent &event)
+{
+    if (!m_config)
+        return;
+
+    CameraWidget *option = nullptr;
+    CameraWidgetType type = GP_WIDGET_WINDOW;
+    if (!event.property.isEmpty()
+            && gp_widget_get_child_by_name(m_config.get(), qPrintable(event.property), &option) >= GP_OK
+            && gp_widget_get_type(option, &type) >= GP_OK
+            && (GP_WIDGET_RADIO == type || GP_WIDGET_MENU == type || GP_WIDGET_TEXT == type)) {
+        // Cached widget takes the reported value, it's not a change to upload
+        const auto &value = event.value.toLocal8Bit();
+        if (gp_widget_set_value(option, value.constData()) >= GP_OK) {
+            gp_widget_set_changed(option, 0);
+            return;
+        }
+    }
+
+    // Anything else is downloaded again, but not more often than once per interval
+    m_configStale = true;
+}
+
+void GPhotoCamera::changedWidgetNames(CameraWidget *widget, QStringList *names)
+{
+    // Reading the flag clears it, so it's set back for the upload
+    if (gp_widget_changed(widget)) {
+        gp_widget_set_changed(widget, 1);
+
+        const char *name = nullptr;
+        if (gp_widget_get_name(widget, &name) >= GP_OK)
+            names->append(QString::fromLocal8Bit(name));
+    }
+
+    for (auto i = 0; i < gp_widget_count_children(widget); ++i) {
+        CameraWidget *child = nullptr;
+        if (gp_widget_get_child(widget, i, &child) >= GP_OK)
+            changedWidgetNames(child, names);
+    }
+}
+
+bool GPhotoCamera::commitConfig()
+{
+    GPhotoTraceSpan span("setConfig", m_cameraIndex);
+
+    QStringList names;
+    changedWidgetNames(m_config.get(), &names);
+
+    QElapsedTimer timer;
+    timer.start();
+
+    auto ret = m_backend->setConfig(m_config.get());
+    m_metrics->record(GPhotoCameraMetrics::ConfigSet, timer.nsecsElapsed());
+
+    // Camera may adjust dependent options after any change, so we don't trust the cached tree anymore
+    invalidateConfig();
+
+    if (ret < GP_OK) {
+        qWarning() << "GPhoto: Failed to set config to camera";
+        return false;
+    }
+
+    waitForConfigAck(names);
+    return true;
 }
 
 void GPhotoCamera::startViewFinder()
@@ -586,15 +1387,44 @@ void GPhotoCamera::stopViewFinder()
 
 void GPhotoCamera::setMirrorPosition(MirrorPosition pos)
 {
+    // Flapping costs two uploads and waiting for their acks
+    if (m_mirrorKnown && m_mirrorPosition == pos)
+        return;
+
+    QElapsedTimer timer;
+    timer.start();
+
     if (parameter(QLatin1String(cancelautofocusParameter)).isValid()) {
         setParameter(QLatin1String(cancelautofocusParameter), true);
     }
 
     if (parameter(QLatin1String(viewfinderParameter)).isValid()) {
         auto up = (MirrorPosition::Up == pos);
-        if (!setParameter(QLatin1String(viewfinderParameter), up))
+        if (!setParameter(QLatin1String(viewfinderParameter), up)) {
             qWarning() << "GPhoto: Failed to flap" << (up ? "up" : "down") << "camera mirror";
+            m_mirrorKnown = false;
+            return;
+        }
+    }
+
+    m_mirrorKnown = true;
+    m_mirrorPosition = pos;
+    m_lastMirrorNsecs = timer.nsecsElapsed();
+}
+
+bool GPhotoCamera::setMovieRecording(bool recording)
+{
+    // Most bodies have a movie toggle, EOS ones without it start and stop the movie with the shutter
+    if (configWidget(QLatin1String(movieParameter)))
+        return setParameter(QLatin1String(movieParameter), recording);
+
+    if (configWidget(QLatin1String(eosRemoteReleaseParameter))) {
+        return setParameter(QLatin1String(eosRemoteReleaseParameter), QLatin1String("Press Full"))
+               && setParameter(QLatin1String(eosRemoteReleaseParameter), QLatin1String("Release Full"));
     }
+
+    qWarning() << "GPhoto: Camera has no movie recording control";
+    return false;
 }
 
 bool GPhotoCamera::isReadyForCapture() const
@@ -614,23 +1444,14 @@ void GPhotoCamera::openCameraErrorHandle(const QString &errorText)
 
 void GPhotoCamera::logOption(const char *name)
 {
-    CameraWidget *root;
-    auto ret = gp_camera_get_config(m_camera.get(), &root, m_context);
-    if (ret < GP_OK) {
-        qWarning() << "GPhoto: Unable to get root option from gphoto";
+    auto option = configWidget(QLatin1String(name));
+    if (!option) {
+        qWarning() << "GPhoto: Unable to get config widget from gphoto";
         return;
     }
 
-    CameraWidget *option;
-    ret = gp_widget_get_child_by_name(root, name, &option);
-    if (ret < GP_OK)
-        qWarning() << "GPhoto: Unable to get config widget from gphoto";
-
-    // Unique pointer will free memory on exit
-    auto optionPtr = CameraWidgetPtr(option, gp_widget_free);
-
     CameraWidgetType type;
-    ret = gp_widget_get_type(option, &type);
+    auto ret = gp_widget_get_type(option, &type);
     if (ret < GP_OK)
         qWarning() << "GPhoto: Unable to get config widget type from gphoto";
 
@@ -652,29 +1473,666 @@ void GPhotoCamera::logOption(const char *name)
     }
 }
 
-void GPhotoCamera::waitForOperationCompleted()
+void GPhotoCamera::startCapture()
 {
-    CameraEventType type;
+    Q_ASSERT(!m_captureQueue.isEmpty());
+
+    m_capture = m_captureQueue.dequeue();
+
+    // Events left from cancelled or timed out capture must not be taken as ours,
+    // timelapse shot only takes what's already there, waiting would make it late
+    flushEvents((0 <= m_capture.timelapseShot) ? 0 : waitForEventTimeout);
+
+    // Deadline is read from the cached tree, before the frame settings make it outdated.
+    // Timelapse shots have it worked out ahead, the tree could be stale and reading it would make them late
+    m_captureDeadline = (0 < m_capture.timeout) ? m_capture.timeout : captureBaseTimeout + 2 * exposureTime();
+    m_captureApplyNsecs = 0;
+
+    if (!m_capture.settings.isEmpty()) {
+        const auto &shutterSpeed = m_capture.settings.value(QLatin1String(shutterSpeedParameter));
+        if (shutterSpeed.isString())
+            m_captureDeadline = captureBaseTimeout + 2 * exposureTime(shutterSpeed.toString());
+
+        QElapsedTimer timer;
+        timer.start();
+        auto applied = applyBracketSettings(m_capture.settings);
+        m_captureApplyNsecs = timer.nsecsElapsed();
+        m_metrics->record(GPhotoCameraMetrics::CaptureApply, m_captureApplyNsecs);
+
+        if (!applied) {
+            emit imageCaptureError(m_capture.id, QCameraImageCapture::ResourceError, tr("Failed to apply capture settings"));
+            finishCapture();
+            return;
+        }
+    }
+
+    m_captureState = CaptureState::Exposing;
+    m_captureEventTimeout = minCaptureEventTimeout;
+    m_captureFileCount = 0;
+    m_captureFiles.clear();
+    m_captureElapsed.start();
+
+    // Whole capture is a single span, from trigger till the camera is done with it
+    if (GPhotoTrace::isEnabled())
+        m_captureTraceStart = GPhotoTrace::now();
+
+    // Capture the frame from camera
+    // See https://github.com/gphoto/libgphoto2/issues/156 for RAW+JPEG fix
     auto ret = GP_OK;
-    do {
-        auto dataPtr = VoidPtr(nullptr, free);
-        auto data = dataPtr.get();
-        ret = gp_camera_wait_for_event(m_camera.get(), waitForEventTimeout, &type, &data, m_context);
-    } while ((ret == GP_OK) && (type != GP_EVENT_TIMEOUT) && m_camera);
+    auto triggerNsecs = m_timelapseClock.isValid() ? m_timelapseClock.nsecsElapsed() : 0;
+    {
+        GPhotoTraceSpan span("triggerCapture", m_cameraIndex);
+        ret = m_backend->triggerCapture();
+    }
+
+    if (0 <= m_capture.timelapseShot && GP_OK <= ret) {
+        m_metrics->record(GPhotoCameraMetrics::TimelapseLateness, qMax<qint64>(0, triggerNsecs - m_capture.deadline));
+        emit timelapseShotTriggered(m_capture.id, m_capture.timelapseShot, m_capture.deadline, triggerNsecs);
+    }
+
+    if (ret < GP_OK) {
+        qWarning() << "GPhoto: Failed to capture frame:" << ret;
+        emit imageCaptureError(m_capture.id, QCameraImageCapture::ResourceError, tr("Failed to capture frame"));
+        finishCapture();
+        return;
+    }
+
+    m_captureTimer.start(0);
 }
 
+void GPhotoCamera::processCapture()
+{
+    if (CaptureState::Idle == m_captureState)
+        return;
+
+    if (m_captureDeadline < m_captureElapsed.elapsed()) {
+        qWarning() << "GPhoto: Camera didn't complete capture in" << m_captureDeadline << "msecs";
+
+        // Files we've got are still good, it's only the completion that's missing
+        if (0 == m_captureFileCount)
+            emit imageCaptureError(m_capture.id, QCameraImageCapture::ResourceError, tr("Capture timed out"));
+
+        downloadCaptureFiles();
+        finishCapture();
+        return;
+    }
+
+    // We wait for events in short slices and return to the event loop between them,
+    // so a slow exposure doesn't block viewfinder and settings of other cameras
+    const auto &event = takeEvent(m_captureEventTimeout);
+
+    if (GP_EVENT_FILE_ADDED == event.event) {
+        m_metrics->record(GPhotoCameraMetrics::CaptureFileAdded, m_captureElapsed.nsecsElapsed());
+        m_captureEventTimeout = minCaptureEventTimeout;
+        ++m_captureFileCount;
+
+        // JPEG goes first, so the preview is shown while RAW of the same shot is still on camera
+        if (!isDownloadWanted(event))
+            deferFile(m_capture.id, event);
+        else if (0 <= m_capture.bracketFrame || 0 <= m_capture.timelapseShot)
+            m_pipelinedFiles.enqueue(qMakePair(m_capture, event));
+        else if (isJpeg(event.fileName))
+            downloadFile(m_capture, event);
+        else
+            m_captureFiles.enqueue(event);
+
+        // Cameras don't report completion of movies, the movie file is the last one
+        if (m_capture.movie && isMovie(event.fileName)) {
+            downloadCaptureFiles();
+            finishCapture();
+            return;
+        }
+    } else if (GP_EVENT_CAPTURE_COMPLETE == event.event) {
+        downloadCaptureFiles();
+        finishCapture();
+        return;
+    } else if (GP_EVENT_TIMEOUT == event.event) {
+        // Nothing happens, it's probably a long exposure, so poll the camera less often
+        // or download the files of the previous bracketing frame meanwhile
+        m_captureEventTimeout = qMin(2 * m_captureEventTimeout, maxCaptureEventTimeout);
+        downloadPipelinedFiles(1);
+    } else {
+        m_captureEventTimeout = minCaptureEventTimeout;
+    }
+
+    m_captureTimer.start(0);
+}
+
+void GPhotoCamera::finishCapture()
+{
+    m_captureTimer.stop();
+
+    if (CaptureState::Idle != m_captureState) {
+        GPhotoTrace::complete("capturePhoto", m_cameraIndex, m_captureTraceStart);
+
+        if (0 <= m_capture.bracketFrame && 0 < m_captureFileCount)
+            emit bracketFrameCaptured(m_capture.id, m_capture.bracketFrame, m_captureApplyNsecs, m_captureElapsed.nsecsElapsed());
+    }
+
+    m_captureState = CaptureState::Idle;
+
+    // Camera is left as it was before the sequence
+    if (!m_capture.restore.isEmpty()) {
+        if (!applyBracketSettings(m_capture.restore))
+            qWarning() << "GPhoto: Failed to restore settings after bracketing";
+        m_capture.restore = QJsonObject();
+    }
+
+    // Mirror stays down between queued captures
+    if (!m_captureQueue.isEmpty()) {
+        startCapture();
+        return;
+    }
+
+    m_bracketConfig.reset();
+    m_previewPaused = false;
+
+    // Mirror stays down between timelapse shots, viewfinder raises it for its frames
+    if (!isTimelapseRunning())
+        setMirrorPosition(MirrorPosition::Up);
+
+    // Viewfinder was paused while capturing
+    if (QCamera::ActiveStatus == m_status)
+        QMetaObject::invokeMethod(this, "capturePreview", Qt::QueuedConnection);
+
+    // Tethered shots and files of the sequence frames were waiting for us
+    if (!m_downloadQueue.isEmpty() || !m_pipelinedFiles.isEmpty())
+        m_downloadTimer.start(0);
+}
+
+void GPhotoCamera::finishRecording(const CameraEvent &event)
+{
+    emit recordingChanged(m_capture.id, false);
+
+    // Movie file is taken like the one of a movie we've stopped ourselves
+    m_captureState = CaptureState::Exposing;
+    m_captureFileCount = 1;
+    m_captureFiles.clear();
+
+    if (GPhotoTrace::isEnabled())
+        m_captureTraceStart = GPhotoTrace::now();
+
+    if (isDownloadWanted(event))
+        m_captureFiles.enqueue(event);
+    else
+        deferFile(m_capture.id, event);
+
+    downloadCaptureFiles();
+    finishCapture();
+}
+
+void GPhotoCamera::abortCaptures(int errorCode, const QString &errorString)
+{
+    m_captureTimer.stop();
+
+    // Movie file stays on the card
+    if (CaptureState::Recording == m_captureState) {
+        setMovieRecording(false);
+        emit recordingChanged(m_capture.id, false);
+    }
+
+    if (CaptureState::Idle != m_captureState) {
+        m_captureState = CaptureState::Idle;
+        m_captureFiles.clear();
+        emit imageCaptureError(m_capture.id, errorCode, errorString);
+    }
+
+    // Starting values are restored even if the sequence is cancelled
+    while (!m_captureQueue.isEmpty()) {
+        const auto &request = m_captureQueue.dequeue();
+        if (!request.restore.isEmpty())
+            m_capture.restore = request.restore;
+        emit imageCaptureError(request.id, errorCode, errorString);
+    }
+}
+
+void GPhotoCamera::downloadFile(const CaptureRequest &request, const CameraEvent &event)
+{
+    // Movies take gigabytes, so they're read in chunks. Drivers without partial
+    // reads still have the whole file written straight to disk below
+    if (request.movie && isMovie(event.fileName) && streamFile(request, event))
+        return;
+
+    const auto &format = QFileInfo(event.fileName).suffix();
+
+    // JPEG is decoded for preview, so it's downloaded to memory.
+    // Other files, e.g. RAW, are written straight to disk and never held in RAM
+    QTemporaryFile tempFile;
+    CameraFile* file = nullptr;
+
+    if (isJpeg(event.fileName)) {
+        gp_file_new(&file);
+    } else {
+        if (!openDownloadFile(&tempFile, request, format)) {
+            qWarning() << "GPhoto: Failed to create temporary file for" << event.fileName << ":" << tempFile.errorString();
+            emit imageCaptureError(request.id, QCameraImageCapture::ResourceError, tr("Failed to create file for download"));
+            return;
+        }
+
+        // CameraFile closes the descriptor it gets
+        gp_file_new_from_fd(&file, ::dup(tempFile.handle()));
+    }
+
+    // Unique pointer will free memory on exit
+    auto filePtr = CameraFilePtr(file, gp_file_free);
+
+    GPhotoTraceSpan span("downloadFile", m_cameraIndex);
+
+    QElapsedTimer timer;
+    timer.start();
+
+    m_transfers->beginTransfer(m_cameraIndex, request.id);
+    auto ret = m_backend->fileGet(event.folderName.toLatin1(), event.fileName.toLatin1(), GP_FILE_TYPE_NORMAL, file);
+
+    if (ret < GP_OK) {
+        m_transfers->endTransfer(0);
+        tempFile.remove();
+        qWarning() << "GPhoto: Failed to get file from camera:" << ret;
+        emit imageCaptureError(request.id, QCameraImageCapture::ResourceError, tr("Failed to download file from camera"));
+        return;
+    }
+
+    if (tempFile.isOpen()) {
+        filePtr.reset();
+
+        auto size = tempFile.size();
+        tempFile.close();
+
+        m_transfers->endTransfer(size);
+        m_metrics->record(GPhotoCameraMetrics::CaptureDownload, timer.nsecsElapsed());
+        m_metrics->increment(GPhotoCameraMetrics::DownloadedBytes, size);
+
+        emit imageFileCaptured(request.id, tempFile.fileName(), format, request.fileName);
+        return;
+    }
+
+    const char* data = nullptr;
+    unsigned long int size = 0;
+
+    ret = gp_file_get_data_and_size(file, &data, &size);
+    if (ret < GP_OK) {
+        m_transfers->endTransfer(0);
+        qWarning() << "GPhoto: Failed to get file data and size from camera:" << ret;
+        emit imageCaptureError(request.id, QCameraImageCapture::ResourceError, tr("Failed to download file from camera"));
+        return;
+    }
+
+    m_transfers->endTransfer(qint64(size));
+    m_metrics->record(GPhotoCameraMetrics::CaptureDownload, timer.nsecsElapsed());
+    m_metrics->increment(GPhotoCameraMetrics::DownloadedBytes, qint64(size));
+
+    // Session picks the names, so all the files of one shot share the same base name
+    emit imageCaptured(request.id, QByteArray(data, int(size)), format, request.fileName);
+}
+
+bool GPhotoCamera::streamFile(const CaptureRequest &request, const CameraEvent &event)
+{
+    const auto &format = QFileInfo(event.fileName).suffix();
+    const auto &folder = event.folderName.toLatin1();
+    const auto &name = event.fileName.toLatin1();
+
+    // Size is for progress only, the end of file is a short read anyway
+    CameraFileInfo info;
+    auto total = qint64(0);
+    if (GP_OK <= m_backend->fileGetInfo(folder, name, &info) && (info.file.fields & GP_FILE_INFO_SIZE))
+        total = qint64(info.file.size);
+
+    QTemporaryFile tempFile;
+    if (!openDownloadFile(&tempFile, request, format)) {
+        qWarning() << "GPhoto: Failed to create temporary file for" << event.fileName << ":" << tempFile.errorString();
+        emit imageCaptureError(request.id, QCameraImageCapture::ResourceError, tr("Failed to create file for download"));
+        return true;
+    }
+
+    GPhotoTraceSpan span("streamFile", m_cameraIndex);
+
+    QElapsedTimer timer;
+    timer.start();
+
+    m_transfers->beginTransfer(m_cameraIndex, request.id);
+
+    QByteArray buffer(movieChunkSize, Qt::Uninitialized);
+    auto offset = qint64(0);
+    auto ret = GP_OK;
+
+    while (0 == total || offset < total) {
+        auto size = uint64_t(buffer.size());
+        ret = m_backend->fileRead(folder, name, GP_FILE_TYPE_NORMAL, uint64_t(offset), buffer.data(), &size);
+        if (ret < GP_OK || 0 == size)
+            break;
+
+        if (tempFile.write(buffer.constData(), qint64(size)) != qint64(size)) {
+            qWarning() << "GPhoto: Failed to write" << tempFile.fileName() << ":" << tempFile.errorString();
+            ret = GP_ERROR_IO_WRITE;
+            break;
+        }
+
+        offset += qint64(size);
+        m_transfers->reportProgress(offset, total);
+    }
+
+    if (GP_ERROR_NOT_SUPPORTED == ret && 0 == offset) {
+        m_transfers->endTransfer(0);
+        tempFile.remove();
+        return false;
+    }
+
+    if (ret < GP_OK) {
+        m_transfers->endTransfer(0);
+        tempFile.remove();
+        qWarning() << "GPhoto: Failed to read file from camera:" << ret;
+        emit imageCaptureError(request.id, QCameraImageCapture::ResourceError, tr("Failed to download file from camera"));
+        return true;
+    }
+
+    tempFile.close();
+
+    m_transfers->endTransfer(offset);
+    m_metrics->record(GPhotoCameraMetrics::CaptureDownload, timer.nsecsElapsed());
+    m_metrics->increment(GPhotoCameraMetrics::DownloadedBytes, offset);
+
+    emit imageFileCaptured(request.id, tempFile.fileName(), format, request.fileName);
+    return true;
+}
+
+bool GPhotoCamera::openDownloadFile(QTemporaryFile *tempFile, const CaptureRequest &request, const QString &format) const
+{
+    // Same directory the session picks, see GPhotoCameraSession::captureFileName(),
+    // so the file is renamed into place without copying
+    auto dir = m_formatDirectories.value(format.toUpper()).toString();
+    if (dir.isEmpty())
+        dir = request.fileName.isEmpty() ? m_saveDirectory : QFileInfo(request.fileName).absolutePath();
+
+    tempFile->setAutoRemove(false);
+    if (!dir.isEmpty()) {
+        tempFile->setFileTemplate(dir + QLatin1String("/.gphoto-XXXXXX.") + format);
+        if (tempFile->open())
+            return true;
+    }
+
+    // Directory may not exist yet, the session still copies the file over from here
+    tempFile->setFileTemplate(QDir::tempPath() + QLatin1String("/.gphoto-XXXXXX.") + format);
+    return tempFile->open();
+}
+
+void GPhotoCamera::downloadCaptureFiles()
+{
+    while (!m_captureFiles.isEmpty())
+        downloadFile(m_capture, m_captureFiles.dequeue());
+}
+
+qint64 GPhotoCamera::exposureTime()
+{
+    auto option = configWidget(QLatin1String(shutterSpeedParameter));
+    if (!option)
+        return 0;
+
+    char *value = nullptr;
+    if (gp_widget_get_value(option, &value) < GP_OK || !value)
+        return 0;
+
+    return exposureTime(QString::fromLocal8Bit(value));
+}
+
+qint64 GPhotoCamera::exposureTime(const QString &shutterSpeed)
+{
+    // Shutter speed is either a fraction like "1/200" or seconds like "2,5"
+    // (we use a workaround for flawed russian i18n of gphoto2 strings)
+    const auto &str = QString(shutterSpeed).replace(',', '.');
+    auto ok = false;
+    auto seconds = 0.0;
+
+    if (str.contains('/')) {
+        const auto &fraction = str.split('/');
+        auto denominator = fraction.last().toDouble(&ok);
+        if (ok && !qFuzzyIsNull(denominator))
+            seconds = fraction.first().toDouble(&ok) / denominator;
+    } else {
+        seconds = str.toDouble(&ok);
+    }
+
+    // Bulb and auto modes have no fixed exposure time
+    return ok ? qint64(seconds * 1000) : 0;
+}
+
+void GPhotoCamera::pollEvents()
+{
+    // Capture reads the events itself, a movie being recorded doesn't, unless the body stops it
+    if (!m_backend->isOpen() || CaptureState::Exposing == m_captureState)
+        return;
+
+    // Don't stay here for too long if camera floods us with events
+    for (auto i = 0; i < maxEventsPerPoll && GP_EVENT_TIMEOUT != pumpEvent(0).event; ++i) {
+    }
+
+    // Events are published already and no capture is waiting for them,
+    // only files shot with camera button are downloaded in tethered mode
+    while (!m_events.isEmpty()) {
+        const auto &event = m_events.dequeue();
+        if (CaptureState::Recording == m_captureState && GP_EVENT_FILE_ADDED == event.event && isMovie(event.fileName))
+            finishRecording(event);
+        else if (m_tethered && GP_EVENT_FILE_ADDED == event.event)
+            queueDownload(event);
+    }
+}
+
+void GPhotoCamera::queueDownload(const CameraEvent &event)
+{
+    // JPEG overtakes RAW of the same shot, so the app can show it sooner
+    if (isJpeg(event.fileName)) {
+        const auto &baseName = QFileInfo(event.fileName).completeBaseName();
+        auto it = std::find_if(m_downloadQueue.begin(), m_downloadQueue.end(), [&baseName] (const CameraEvent &queued) {
+            return QFileInfo(queued.fileName).completeBaseName() == baseName;
+        });
+        m_downloadQueue.insert(it, event);
+        m_downloadTimer.start(0);
+        return;
+    }
+
+    m_downloadQueue.enqueue(event);
+    m_downloadTimer.start(0);
+}
+
+void GPhotoCamera::processDownloads()
+{
+    // Host triggered capture goes first, we're restarted when it finishes.
+    // So does the next timelapse shot, if it's too close
+    if (!m_backend->isOpen() || CaptureState::Idle != m_captureState || isShotWindow())
+        return;
+
+    // Files of bracketing frames and timelapse shots were queued behind the triggers
+    if (!m_pipelinedFiles.isEmpty()) {
+        downloadPipelinedFiles(1);
+        m_downloadTimer.start(0);
+        return;
+    }
+
+    if (m_downloadQueue.isEmpty())
+        return;
+
+    // Download one file at a time and return to event loop,
+    // so new files are noticed while we're downloading previous ones
+    const auto event = m_downloadQueue.dequeue();
+
+    // RAW and JPEG of the same shot come as separate files with the same base name.
+    // Tethered shots get negative ids, so they're never mixed up with the requested ones
+    const auto &baseName = QFileInfo(event.fileName).completeBaseName();
+    if (baseName != m_tetherBaseName) {
+        m_tetherBaseName = baseName;
+        --m_tetherCaptureId;
+    }
+
+    if (isDownloadWanted(event)) {
+        CaptureRequest request;
+        request.id = m_tetherCaptureId;
+        downloadFile(request, event);
+    } else {
+        deferFile(m_tetherCaptureId, event);
+    }
+
+    if (!m_downloadQueue.isEmpty())
+        m_downloadTimer.start(0);
+}
+
+void GPhotoCamera::processImport()
+{
+    if (!m_importer->hasNext())
+        return;
+
+    // File can't be imported in parts, so it has to be done before the next timelapse shot.
+    // It takes about as long per byte as the previous one
+    auto size = m_importer->nextFileSize();
+    auto estimate = (0 < size && 0 < m_lastImportBytes) ? qint64(double(m_lastImportNsecs) / m_lastImportBytes * size)
+                                                        : m_lastImportNsecs;
+
+    // Captures and tethered downloads go first, import waits till they're done
+    // and till the writer catches up
+    if (CaptureState::Idle != m_captureState || !m_downloadQueue.isEmpty() || !m_pipelinedFiles.isEmpty()
+            || m_importer->isThrottled() || isShotWindow(estimate)) {
+        m_importTimer.start(importRetryInterval);
+        return;
+    }
+
+    // One file per pass, so viewfinder frames get their turn between the files
+    QElapsedTimer timer;
+    timer.start();
+    m_importer->importNext();
+    m_lastImportNsecs = timer.nsecsElapsed();
+    m_lastImportBytes = size;
+
+    if (m_importer->hasNext())
+        m_importTimer.start(0);
+}
+
+bool GPhotoCamera::isDownloadWanted(const CameraEvent &event) const
+{
+    switch (m_downloadPolicy) {
+    case DownloadPolicy::All:
+        return true;
+    case DownloadPolicy::ByExtension:
+        return m_downloadExtensions.contains(QFileInfo(event.fileName).suffix().toUpper());
+    case DownloadPolicy::Deferred:
+        return false;
+    }
+
+    return true;
+}
+
+void GPhotoCamera::deferFile(int id, const CameraEvent &event)
+{
+    // File stays on the card, that saves the USB time of downloading it now
+    const auto &path = event.folderName + QLatin1Char('/') + event.fileName;
+    m_deferredFiles.append(path);
+    emit fileDeferred(id, path);
+}
+
+void GPhotoCamera::waitForConfigAck(QStringList names)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    while (m_backend->isOpen() && timer.elapsed() < configAckTimeout) {
+        // Camera either reports all the changed properties or has nothing more to say, both mean it's done.
+        // Other property events, e.g. of liveview or dials, don't ack our change
+        const auto &event = pumpEvent(waitForEventTimeout);
+        if (GP_EVENT_TIMEOUT == event.event)
+            return;
+        if (GP_EVENT_UNKNOWN == event.event && 0 < names.removeAll(event.property) && names.isEmpty())
+            return;
+    }
+}
+
+void GPhotoCamera::flushEvents(int timeout)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    // Read everything camera has already queued
+    while (m_backend->isOpen() && timer.elapsed() < configAckTimeout && GP_EVENT_TIMEOUT != pumpEvent(timeout).event) {
+    }
+
+    while (!m_events.isEmpty()) {
+        const auto &event = m_events.dequeue();
+        if (GP_EVENT_FILE_ADDED != event.event)
+            continue;
+
+        if (m_tethered) {
+            queueDownload(event);
+        } else {
+            qWarning() << "GPhoto: File" << qPrintable(event.folderName + QLatin1Char('/') + event.fileName)
+                       << "doesn't belong to any capture and stays on camera";
+        }
+    }
+}
+
+GPhotoCamera::CameraEvent GPhotoCamera::pumpEvent(int timeout)
+{
+    const auto &event = waitForNextEvent(timeout);
+
+    if (GP_EVENT_TIMEOUT != event.event)
+        emit cameraEvent(event);
+
+    // Card index follows the card, so the next import doesn't need to list it
+    if (GP_EVENT_FILE_ADDED == event.event) {
+        m_cardIndex->addFile(event.folderName, event.fileName);
+    } else if (GP_EVENT_FOLDER_ADDED == event.event) {
+        auto folder = event.folderName;
+        if (!folder.endsWith(QLatin1Char('/')))
+            folder.append(QLatin1Char('/'));
+        m_cardIndex->addFolder(folder + event.fileName);
+    }
+
+    switch (event.event) {
+    case GP_EVENT_UNKNOWN:
+        // Other unknown events, e.g. of liveview, don't touch the config
+        if (event.isPropertyChange())
+            updateConfig(event);
+
+        // Timelapse shots use these without reading them back
+        if (QLatin1String(viewfinderParameter) == event.property) {
+            m_mirrorKnown = true;
+            m_mirrorPosition = QVariant(event.value).toBool() ? MirrorPosition::Up : MirrorPosition::Down;
+        } else if (QLatin1String(shutterSpeedParameter) == event.property) {
+            m_timelapseExposure = exposureTime(event.value);
+        }
+        break;
+    case GP_EVENT_TIMEOUT:
+        break;
+    default:
+        m_events.enqueue(event);
+        break;
+    }
+
+    return event;
+}
+
+GPhotoCamera::CameraEvent GPhotoCamera::takeEvent(int timeout)
+{
+    if (m_events.isEmpty()) {
+        const auto &event = pumpEvent(timeout);
+        if (m_events.isEmpty())
+            return event;
+    }
+
+    return m_events.dequeue();
+}
 
 GPhotoCamera::CameraEvent GPhotoCamera::waitForNextEvent(int timeout)
 {
     CameraEvent event;
-    auto dataPtr = VoidPtr(nullptr, free);
-    auto data = dataPtr.get();
+    void *data = nullptr;
     CameraEventType eventType = GP_EVENT_UNKNOWN;
 
-    auto ret = gp_camera_wait_for_event(m_camera.get(), timeout, &eventType, &data, m_context);
-    if (ret != GP_OK || GP_EVENT_UNKNOWN == eventType) {
+    auto ret = m_backend->waitForEvent(timeout, &eventType, &data);
+
+    // Unique pointer will free memory on exit
+    auto dataPtr = VoidPtr(data, free);
+
+    if (ret != GP_OK) {
         // according to implementation of gp_camera_wait_for_event();
         // if i dont get OK, no event type & data is updated.
+        // Nothing came from camera, so for the callers it's the same as timeout
+        event.event = GP_EVENT_TIMEOUT;
         return event;
     }
 
@@ -689,6 +2147,17 @@ GPhotoCamera::CameraEvent GPhotoCamera::waitForNextEvent(int timeout)
         } else if (GP_EVENT_FOLDER_ADDED == eventType) {
             auto folder= reinterpret_cast<CameraFilePath*>(data);
             event.folderName = QString::fromLatin1(folder->folder);
+            event.fileName = QString::fromLatin1(folder->name);
+        } else if (GP_EVENT_UNKNOWN == eventType) {
+            event.text = QString::fromLocal8Bit(reinterpret_cast<const char*>(data));
+
+            // Newer drivers name the widget, e.g. PTP Property d101 changed, "aperture" to "5.6"
+            static const QRegularExpression propertyChange(QStringLiteral("changed, \"([^\"]+)\" to \"([^\"]*)\""));
+            const auto &match = propertyChange.match(event.text);
+            if (match.hasMatch()) {
+                event.property = match.captured(1);
+                event.value = match.captured(2);
+            }
         }
     }
 
@@ -4,15 +4,26 @@
 #include <memory>
 
 #include <QCamera>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QJsonObject>
 #include <QObject>
+#include <QQueue>
+#include <QTimer>
+#include <QVector>
 
-#include <gphoto2/gphoto2-abilities-list.h>
 #include <gphoto2/gphoto2-camera.h>
 #include <gphoto2/gphoto2-file.h>
-#include <gphoto2/gphoto2-port-info-list.h>
+
+class GPhotoBackend;
+class GPhotoCameraMetrics;
+class GPhotoCardIndex;
+class GPhotoImporter;
+class GPhotoTransferMonitor;
+class QTemporaryFile;
 
 using CameraFilePtr = std::unique_ptr<CameraFile, int (*)(CameraFile*)>;
-using CameraPtr = std::unique_ptr<Camera, int (*)(Camera*)>;
+using CameraWidgetPtr = std::unique_ptr<CameraWidget, int (*)(CameraWidget*)>;
 
 class GPhotoCamera final : public QObject
 {
@@ -22,15 +33,28 @@ public:
     /** Data forming a camera event from libGPhoto
      * packed into a nicer C++ object.
      *
-     * This struct is returned from waitForNextEvent().
+     * This struct is returned from waitForNextEvent() and takeEvent().
      */
     struct CameraEvent {
         /// What happened
         CameraEventType event{GP_EVENT_UNKNOWN};
         /// For some events we get a folder / file info
         QString folderName;
-        /// For some events we get a folder / file info
+        /// For some events we get a folder / file info, name of the new folder for GP_EVENT_FOLDER_ADDED
         QString fileName;
+        /// Unknown events carry a description, e.g. of the changed property
+        QString text;
+        /// Config widget named by a property change, empty if the driver doesn't name it
+        QString property;
+        /// New value of the named property as the camera reports it
+        QString value;
+
+        /// Property changes are reported as unknown events, not all of them name the property
+        bool isPropertyChange() const
+        {
+            return GP_EVENT_UNKNOWN == event
+                   && (!property.isEmpty() || text.contains(QLatin1String("Property"), Qt::CaseInsensitive));
+        }
     };
 
     enum class MirrorPosition {
@@ -38,8 +62,46 @@ public:
         Down
     };
 
-    GPhotoCamera(GPContext *context, const CameraAbilities &abilities,
-                 const GPPortInfo &portInfo, QObject *parent = nullptr);
+    enum class CaptureState {
+        Idle,
+        Exposing,
+        /// Movie is being recorded, viewfinder keeps running
+        Recording
+    };
+
+    /// Which of the files added to the card by a shot are downloaded
+    enum class DownloadPolicy {
+        /// Every file, e.g. both RAW and JPEG
+        All,
+        /// Files with the given extensions only, the others are deferred
+        ByExtension,
+        /// None, files stay on the card to be imported later
+        Deferred
+    };
+    Q_ENUM(DownloadPolicy)
+
+    /// Photo requested by client, waiting for capture or being captured
+    struct CaptureRequest {
+        int id = 0;
+        QString fileName;
+        /// Settings uploaded right before the trigger, e.g. a bracketing step
+        QJsonObject settings;
+        /// Settings uploaded after the capture, the last bracketing frame restores the starting values
+        QJsonObject restore;
+        /// Position in the bracketing sequence, -1 for single shots
+        int bracketFrame = -1;
+        /// Number of the timelapse shot, -1 for single shots
+        int timelapseShot = -1;
+        /// When the timelapse shot is planned, nsecs since the timelapse start
+        qint64 deadline = 0;
+        /// Capture timeout in msecs worked out ahead, 0 reads it from the camera right before the trigger
+        qint64 timeout = 0;
+        /// Movie recording, its file is read from the card in chunks
+        bool movie = false;
+    };
+
+    GPhotoCamera(int cameraIndex, std::unique_ptr<GPhotoBackend> backend, GPhotoCameraMetrics *metrics,
+                 GPhotoTransferMonitor *transfers, QObject *parent = nullptr);
     ~GPhotoCamera();
 
     GPhotoCamera(GPhotoCamera&&) = delete;
@@ -49,36 +111,216 @@ public:
     void setCaptureMode(QCamera::CaptureModes captureMode);
     void capturePhoto(int id, const QString &fileName);
 
+    /** Captures a sequence of frames with some settings changed for each, e.g. for HDR or focus stacks.
+     *
+     * Every step of @p steps is a map of widget names to either an offset
+     * from the current choice (int) or the exact choice (string). Offsets are
+     * resolved before the first frame, so each frame costs a single config
+     * upload, and the starting values are restored after the last frame.
+     * Frames get ids from @p id on.
+     */
+    void captureBracket(int id, const QString &fileName, const QVariantList &steps);
+
+    /** Shoots @p count photos every @p interval msecs, the first one right away.
+     *
+     * Shots are planned on absolute deadlines, so delays never add up.
+     * Viewfinder and downloads pause shortly before every shot, so they
+     * don't hold the trigger back, and a shot the camera is too busy for is
+     * skipped rather than shifting the plan. Shots get ids from @p id on.
+     */
+    void startTimelapse(int id, const QString &fileName, int interval, int count);
+    /// Shots not taken yet are dropped silently
+    void stopTimelapse();
+
+    /** Starts movie recording with camera's movie toggle, in video capture mode only.
+     *
+     * The movie file is downloaded after stopRecording() and delivered
+     * with imageFileCaptured(), it's written to disk chunk by chunk.
+     */
+    void startRecording(int id, const QString &fileName);
+    void stopRecording();
+    void cancelCapture();
+
+    /** Enables downloading of files shot with camera's own shutter button.
+     *
+     * Such files are delivered with imageCaptured() signal like the requested ones,
+     * but with negative ids.
+     */
+    void setTethered(bool tethered);
+
+    /** Sets which files of a shot are downloaded.
+     *
+     * Files which are not downloaded are deferred: they're reported with fileDeferred()
+     * and listed by deferredFiles() as "folder/name" paths on the camera.
+     */
+    void setDownloadPolicy(DownloadPolicy policy, const QStringList &extensions);
+    QStringList deferredFiles() const;
+    void clearDeferredFiles();
+
+    /** Sets where the session saves captured files.
+     *
+     * @p directory is for shots without a file name, @p formatDirectories maps
+     * upper-case formats, e.g. "CR2", to directories taking all the files of that
+     * format. Files written straight to disk are downloaded there, so the session
+     * renames them into place instead of copying them across file systems.
+     */
+    void setSaveDirectories(const QString &directory, const QVariantMap &formatDirectories);
+
+    /** Copies files from the card to @p destination in background.
+     *
+     * Files imported before from the same camera are skipped. Downloads are
+     * interleaved with viewfinder frames and wait for captures to finish.
+     */
+    void importFiles(const QString &destination);
+    void cancelImport();
+
+    /** Value of a config widget of any type.
+     *
+     * Text, radio and menu widgets give strings, toggles give bools, ranges
+     * doubles and dates QDateTime. Sections give QVariantMap of all the widgets
+     * in them by name, empty @p name gives the whole config tree.
+     */
     QVariant parameter(const QString &name);
+    /// Buttons are pressed, the value is ignored for them
     bool setParameter(const QString &name, const QVariant &value);
     QVariantList parameterValues(const QString &name, QMetaType::Type valueType);
 
+    /** Values of all the writable settings by name, e.g. for a preset.
+     *
+     * Dates, buttons and action toggles like viewfinder or movie are left
+     * out, applying a preset should neither turn back the camera clock nor
+     * press anything.
+     */
+    QJsonObject snapshotConfig();
+    /// Uploads the settings of @p snapshot which differ from the current ones with a single request
+    bool applyConfig(const QJsonObject &snapshot);
+
+    /** Connects to the camera and downloads its config tree
+     * without changing the camera state.
+     *
+     * Called in background after the camera is detected, so that
+     * the following load and the first preview frame are fast.
+     */
+    Q_INVOKABLE void prewarm();
+
 signals:
+    void cameraEvent(const GPhotoCamera::CameraEvent &event);
     void captureModeChanged(QCamera::CaptureModes captureMode);
     void error(int errorCode, const QString &errorString);
+    void fileDeferred(int id, const QString &path);
+    void fileImported(const QString &cameraPath, const QString &fileName);
     void imageCaptured(int id, const QByteArray &imageData, const QString &format, const QString &fileName);
+    /// File too big to be passed in memory, e.g. RAW, was downloaded to a temporary file
+    void imageFileCaptured(int id, const QString &tempFileName, const QString &format, const QString &fileName);
     void imageCaptureError(int id, int errorCode, const QString &errorString);
+    void importFinished(int files, int errors);
+    void importProgress(int files, int totalFiles, qint64 bytes, qint64 bytesPerSecond);
+    /// Bracketing frame @p frame was shot, times of uploading its settings and of the capture itself
+    void bracketFrameCaptured(int id, int frame, qint64 applyNsecs, qint64 captureNsecs);
+    /// Timelapse shot was triggered at @p actualNsecs, it was planned at @p plannedNsecs since the start
+    void timelapseShotTriggered(int id, int shot, qint64 plannedNsecs, qint64 actualNsecs);
     void previewCaptured(const QImage &image);
     void readyForCaptureChanged(bool readyForCapture);
+    /// Movie @p id started or stopped recording, its file comes later
+    void recordingChanged(int id, bool recording);
     void stateChanged(QCamera::State state);
     void statusChanged(QCamera::Status status);
 
 private slots:
     void capturePreview();
+    void pollEvents();
+    void processCapture();
+    void processDownloads();
+    void processImport();
+    void processTimelapse();
 
 private:
     Q_DISABLE_COPY(GPhotoCamera)
 
+    /// Numeric values of the choices of a radio widget, sorted for nearest value lookups
+    struct ChoiceTable {
+        struct Choice {
+            double value;
+            int index;
+            bool integer;
+        };
+
+        QVector<Choice> numbers;
+        /// First choice which isn't a number, like "Auto" ISO
+        int nonInteger = -1;
+    };
+
+    bool createCamera(QString *errorText);
     void openCamera();
     void closeCamera();
+    void startCapture();
+    void finishCapture();
+    /// Movie stopped by the camera body, e.g. when the card got full, its file is the last one
+    void finishRecording(const CameraEvent &event);
+    void abortCaptures(int errorCode, const QString &errorString);
+    void downloadFile(const CaptureRequest &request, const CameraEvent &event);
+    /// Reads the file in chunks straight to disk, false if the driver can't read parts of files
+    bool streamFile(const CaptureRequest &request, const CameraEvent &event);
+    /// Creates the temporary file in the directory the download is saved to, or the temp one
+    bool openDownloadFile(QTemporaryFile *tempFile, const CaptureRequest &request, const QString &format) const;
+    void downloadCaptureFiles();
+    void queueDownload(const CameraEvent &event);
+    bool isDownloadWanted(const CameraEvent &event) const;
+    void deferFile(int id, const CameraEvent &event);
+    qint64 exposureTime();
+    static qint64 exposureTime(const QString &shutterSpeed);
+    QString resolveBracketChoice(const QString &name, const QVariant &step, QJsonObject *restore);
+    bool applyBracketSettings(const QJsonObject &settings);
+    void downloadPipelinedFiles(int count);
+    void skipTimelapseShot();
+    bool isTimelapseRunning() const;
+    void resumePreview();
+    /// Next timelapse shot is too close to start anything slow, or anything taking @p nsecs
+    bool isShotWindow(qint64 nsecs = 0) const;
+    CameraWidget* configWidget(const QString &name);
+    const ChoiceTable& choiceTable(const QString &name, CameraWidget *option);
+    int findNearestChoice(const QString &name, CameraWidget *option, double value);
+    int findIntegerChoice(const QString &name, CameraWidget *option, int value);
+    bool setChoice(const QString &name, CameraWidget *option, int index);
+    static QVariant widgetValue(CameraWidget *option);
+    static void snapshotWidget(CameraWidget *option, QJsonObject *snapshot);
+    /// Changes the widget only, the value is uploaded by commitConfig()
+    bool setWidgetValue(const QString &name, CameraWidget *option, const QVariant &value);
+    bool pressButton(const QString &name, CameraWidget *option);
+    bool refreshConfig();
+    void invalidateConfig();
+    void updateConfig(const CameraEvent &event);
+    static void changedWidgetNames(CameraWidget *widget, QStringList *names);
+    bool commitConfig();
     void startViewFinder();
     void stopViewFinder();
     void setMirrorPosition(MirrorPosition pos);
+    bool setMovieRecording(bool recording);
     bool isReadyForCapture() const;
     void logOption(const char *name);
     void openCameraErrorHandle(const QString &errorText);
     void setStatus(QCamera::Status status);
-    void waitForOperationCompleted();
+    /// Waits till camera reports a change of all the named widgets or goes quiet
+    void waitForConfigAck(QStringList names);
+    void flushEvents(int timeout);
+
+    /** Reads the next event from camera and dispatches it.
+     *
+     * Property changes update the cached config, all the other events
+     * are queued for takeEvent(), so events read while waiting for
+     * something else are not lost.
+     *
+     * @param timeout max time to wait in msecs
+     * @return the event read, GP_EVENT_TIMEOUT if there was none.
+     */
+    CameraEvent pumpEvent(int timeout);
+
+    /** Takes the oldest queued event or waits for the next one from camera.
+     *
+     * @param timeout max time to wait in msecs
+     * @return the event which occured.
+     */
+    CameraEvent takeEvent(int timeout);
 
     /** Waits for the next event to arrive and deliver event data.
      *
@@ -88,15 +330,78 @@ private:
     CameraEvent waitForNextEvent(int timeout);
 
 
-    GPContext *const m_context;
-    CameraAbilities m_abilities;
-    GPPortInfo m_portInfo;
-    CameraPtr m_camera;
+    const int m_cameraIndex;
+    std::unique_ptr<GPhotoBackend> m_backend;
+    GPhotoCameraMetrics *m_metrics;
+    GPhotoTransferMonitor *m_transfers;
     CameraFilePtr m_file;
+    CameraWidgetPtr m_config;
+    // Cached tree missed a change the camera didn't name, it's downloaded again on a later access
+    bool m_configStale = false;
+    QElapsedTimer m_configAge;
+    QHash<QString, ChoiceTable> m_choiceTables;
+    QQueue<CameraEvent> m_events;
     QCamera::State m_state = QCamera::UnloadedState;
     QCamera::Status m_status = QCamera::UnloadedStatus;
     QCamera::CaptureModes m_captureMode = QCamera::CaptureStillImage;
     int m_capturingFailCount = 0;
+
+    QQueue<CaptureRequest> m_captureQueue;
+    CaptureRequest m_capture;
+    CaptureState m_captureState = CaptureState::Idle;
+    QTimer m_captureTimer;
+    QQueue<CameraEvent> m_captureFiles;
+    int m_captureFileCount = 0;
+    qint64 m_captureApplyNsecs = 0;
+
+    // Bracketing frames change settings of their own tree, the shared one would be downloaded for every frame
+    CameraWidgetPtr m_bracketConfig;
+    // Files of bracketing frames are downloaded while the next frame is exposed
+    QQueue<QPair<CaptureRequest, CameraEvent>> m_pipelinedFiles;
+    QTimer m_eventTimer;
+
+    bool m_tethered = false;
+    QQueue<CameraEvent> m_downloadQueue;
+    QTimer m_downloadTimer;
+    QString m_tetherBaseName;
+    int m_tetherCaptureId = 0;
+
+    DownloadPolicy m_downloadPolicy = DownloadPolicy::All;
+    QStringList m_downloadExtensions;
+    QStringList m_deferredFiles;
+    QString m_saveDirectory;
+    QVariantMap m_formatDirectories;
+
+    std::unique_ptr<GPhotoCardIndex> m_cardIndex;
+    std::unique_ptr<GPhotoImporter> m_importer;
+    QTimer m_importTimer;
+
+    QElapsedTimer m_captureElapsed;
+    qint64 m_captureTraceStart = 0;
+    qint64 m_captureDeadline = 0;
+    int m_captureEventTimeout = 0;
+
+    QTimer m_timelapseTimer;
+    QElapsedTimer m_timelapseClock;
+    QString m_timelapseFileName;
+    int m_timelapseId = 0;
+    int m_timelapseInterval = 0;
+    int m_timelapseCount = 0;
+    int m_timelapseShot = 0;
+    // Followed by property events, so the shots don't read it back
+    qint64 m_timelapseExposure = 0;
+    // Slowest calls which have to finish before a shot
+    qint64 m_lastPreviewNsecs = 0;
+    qint64 m_lastDownloadNsecs = 0;
+    qint64 m_lastMirrorNsecs = 0;
+    qint64 m_lastImportNsecs = 0;
+    qint64 m_lastImportBytes = 0;
+    bool m_previewPaused = false;
+    // Mirror isn't flapped again into the position it's known to be in
+    bool m_mirrorKnown = false;
+    MirrorPosition m_mirrorPosition = MirrorPosition::Down;
 };
 
+Q_DECLARE_METATYPE(GPhotoCamera::CameraEvent)
+
 #endif // GPHOTOCAMERA_H
@@ -36,4 +36,5 @@ int GPhotoCameraImageCaptureControl::capture(const QString &fileName)
 
 void GPhotoCameraImageCaptureControl::cancelCapture()
 {
+    m_session->cancelCapture();
 }
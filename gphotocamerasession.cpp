@@ -1,5 +1,6 @@
 #include <QAbstractVideoSurface>
 #include <QDebug>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QFileInfo>
 #include <QStandardPaths>
@@ -9,30 +10,43 @@
 #include "gphotocamerafocuscontrol.h"
 #include "gphotocamerasession.h"
 #include "gphotocontroller.h"
+#include "gphotometrics.h"
+#include "gphototrace.h"
 
 namespace {
     constexpr auto maxDownscaleSteps = 8;
-    constexpr auto maxFileIndex = 9999;
     constexpr auto maxPreviewWidth = 800;
+    constexpr auto maxRememberedCaptures = 64;
 }
 
 GPhotoCameraSession::GPhotoCameraSession(std::weak_ptr<GPhotoController> controller, QObject *parent)
     : QObject(parent)
     , m_controller(std::move(controller))
     , m_cameraFocusControl(new GPhotoCameraFocusControl())
+    , m_saveService(new GPhotoSaveService())
 {
+    connect(m_saveService.get(), &GPhotoSaveService::imageSaved, this, &GPhotoCameraSession::imageSaved);
+    connect(m_saveService.get(), &GPhotoSaveService::saveError, this, &GPhotoCameraSession::imageCaptureError);
+
     if (const auto &controller = m_controller.lock()) {
         using Controller = GPhotoController;
         using Session = GPhotoCameraSession;
 
+        connect(controller.get(), &Controller::bracketFrameCaptured, this, &Session::onBracketFrameCaptured);
+        connect(controller.get(), &Controller::cameraEvent, this, &Session::onCameraEvent);
         connect(controller.get(), &Controller::captureModeChanged, this, &Session::onCaptureModeChanged);
         connect(controller.get(), &Controller::error, this, &Session::onError);
+        connect(controller.get(), &Controller::fileDeferred, this, &Session::onFileDeferred);
         connect(controller.get(), &Controller::imageCaptureError, this, &Session::onImageCaptureError);
         connect(controller.get(), &Controller::imageCaptured, this, &Session::onImageCaptured);
+        connect(controller.get(), &Controller::imageFileCaptured, this, &Session::onImageFileCaptured);
         connect(controller.get(), &Controller::previewCaptured, this, &Session::onPreviewCaptured);
         connect(controller.get(), &Controller::readyForCaptureChanged, this, &Session::onReadyForCaptureChanged);
+        connect(controller.get(), &Controller::recordingChanged, this, &Session::onRecordingChanged);
         connect(controller.get(), &Controller::stateChanged, this, &Session::onStateChanged);
         connect(controller.get(), &Controller::statusChanged, this, &Session::onStatusChanged);
+        connect(controller.get(), &Controller::timelapseShotTriggered, this, &Session::onTimelapseShotTriggered);
+        connect(controller.get(), &Controller::transferProgress, this, &Session::onTransferProgress);
     }
 }
 
@@ -72,7 +86,7 @@ QCamera::Status GPhotoCameraSession::status() const
 
 bool GPhotoCameraSession::isCaptureModeSupported(QCamera::CaptureModes mode) const
 {
-    return (QCamera::CaptureViewfinder == mode || QCamera::CaptureStillImage == mode);
+    return (QCamera::CaptureViewfinder == mode || QCamera::CaptureStillImage == mode || QCamera::CaptureVideo == mode);
 }
 
 QCamera::CaptureModes GPhotoCameraSession::captureMode() const
@@ -123,6 +137,113 @@ int GPhotoCameraSession::capture(const QString &fileName)
     return m_captureId;
 }
 
+int GPhotoCameraSession::captureBracket(const QVariantList &steps, const QString &fileName)
+{
+    // Every frame has an id of its own
+    auto id = m_captureId + 1;
+    m_captureId += steps.size();
+
+    if (const auto &controller = m_controller.lock())
+        controller->captureBracket(m_cameraIndex, id, fileName, steps);
+
+    return id;
+}
+
+int GPhotoCameraSession::startTimelapse(int interval, int count, const QString &fileName)
+{
+    // Every shot has an id of its own, skipped ones included
+    auto id = m_captureId + 1;
+    m_captureId += qMax(count, 0);
+
+    if (const auto &controller = m_controller.lock())
+        controller->startTimelapse(m_cameraIndex, id, fileName, interval, count);
+
+    return id;
+}
+
+void GPhotoCameraSession::stopTimelapse()
+{
+    if (const auto &controller = m_controller.lock())
+        controller->stopTimelapse(m_cameraIndex);
+}
+
+int GPhotoCameraSession::startRecording(const QString &fileName)
+{
+    m_recordingId = ++m_captureId;
+
+    // Movies go to their own standard location unless the app picked one
+    auto movieFileName = fileName;
+    if (movieFileName.isEmpty()) {
+        const auto &dir = QStandardPaths::writableLocation(QStandardPaths::MoviesLocation);
+        if (!dir.isEmpty())
+            movieFileName = m_saveService->nextBaseName(dir);
+    }
+
+    if (const auto &controller = m_controller.lock())
+        controller->startRecording(m_cameraIndex, m_recordingId, movieFileName);
+
+    return m_recordingId;
+}
+
+void GPhotoCameraSession::stopRecording()
+{
+    if (const auto &controller = m_controller.lock())
+        controller->stopRecording(m_cameraIndex);
+}
+
+void GPhotoCameraSession::cancelCapture()
+{
+    if (const auto &controller = m_controller.lock())
+        controller->cancelCapture(m_cameraIndex);
+}
+
+void GPhotoCameraSession::setDownloadPolicy(GPhotoCamera::DownloadPolicy policy, const QStringList &extensions)
+{
+    if (const auto &controller = m_controller.lock())
+        controller->setDownloadPolicy(m_cameraIndex, policy, extensions);
+}
+
+QStringList GPhotoCameraSession::deferredFiles() const
+{
+    if (const auto &controller = m_controller.lock())
+        return controller->deferredFiles(m_cameraIndex);
+
+    return {};
+}
+
+void GPhotoCameraSession::clearDeferredFiles()
+{
+    if (const auto &controller = m_controller.lock())
+        controller->clearDeferredFiles(m_cameraIndex);
+}
+
+QString GPhotoCameraSession::formatDirectory(const QString &format) const
+{
+    return m_formatDirectories.value(format.toUpper());
+}
+
+void GPhotoCameraSession::setFormatDirectory(const QString &format, const QString &directory)
+{
+    if (directory.isEmpty())
+        m_formatDirectories.remove(format.toUpper());
+    else
+        m_formatDirectories.insert(format.toUpper(), directory);
+
+    updateSaveDirectories();
+}
+
+void GPhotoCameraSession::setSaveDurability(GPhotoSaveService::Durability durability, int groupFiles,
+                                            int groupInterval)
+{
+    m_saveService->setDurability(durability, groupFiles, groupInterval);
+}
+
+void GPhotoCameraSession::setTethered(bool tethered)
+{
+    if (const auto &controller = m_controller.lock())
+        controller->setTethered(m_cameraIndex, tethered);
+}
+
 QAbstractVideoSurface* GPhotoCameraSession::surface() const
 {
     return m_surface;
@@ -163,18 +284,44 @@ QCameraFocusControl *GPhotoCameraSession::cameraFocusControl() const
     return m_cameraFocusControl.get();
 }
 
+GPhotoMetrics* GPhotoCameraSession::metrics() const
+{
+    if (const auto &controller = m_controller.lock())
+        return controller->metrics();
+
+    return nullptr;
+}
+
 void GPhotoCameraSession::setCamera(int cameraIndex)
 {
     if (m_cameraIndex != cameraIndex) {
         m_cameraIndex = cameraIndex;
         if (const auto &controller = m_controller.lock()) {
+            m_metrics = controller->metrics()->camera(cameraIndex);
+            m_saveService->setMetrics(m_metrics);
             onCaptureModeChanged(cameraIndex, controller->captureMode(m_cameraIndex));
             onStateChanged(cameraIndex, controller->state(m_cameraIndex));
             onStatusChanged(cameraIndex, controller->status(m_cameraIndex));
         }
+
+        updateSaveDirectories();
+        emit cameraChanged(cameraIndex);
     }
 }
 
+void GPhotoCameraSession::onBracketFrameCaptured(int cameraIndex, int id, int frame, qint64 applyNsecs,
+                                                 qint64 captureNsecs)
+{
+    if (m_cameraIndex == cameraIndex)
+        emit bracketFrameCaptured(id, frame, applyNsecs, captureNsecs);
+}
+
+void GPhotoCameraSession::onCameraEvent(int cameraIndex, const GPhotoCamera::CameraEvent &event)
+{
+    if (m_cameraIndex == cameraIndex)
+        emit cameraEvent(event);
+}
+
 void GPhotoCameraSession::onCaptureModeChanged(int cameraIndex, QCamera::CaptureModes captureMode)
 {
     if (m_cameraIndex == cameraIndex && m_captureMode != captureMode) {
@@ -189,18 +336,33 @@ void GPhotoCameraSession::onError(int cameraIndex, int errorCode, const QString
         emit error(errorCode, errorString);
 }
 
-void GPhotoCameraSession::onImageCaptureError(int cameraIndex, int id, int errorCode, const QString &errorString)
+void GPhotoCameraSession::onFileDeferred(int cameraIndex, int id, const QString &path)
 {
     if (m_cameraIndex == cameraIndex)
-        emit imageCaptureError(id, errorCode, errorString);
+        emit fileDeferred(sessionCaptureId(id), path);
+}
+
+void GPhotoCameraSession::onImageCaptureError(int cameraIndex, int id, int errorCode, const QString &errorString)
+{
+    if (m_cameraIndex != cameraIndex)
+        return;
+
+    if (m_metrics)
+        m_metrics->increment(GPhotoCameraMetrics::CaptureErrors);
+
+    emit imageCaptureError(sessionCaptureId(id), errorCode, errorString);
 }
 
-void GPhotoCameraSession::onImageCaptured(int cameraIndex, int id, const QByteArray &imageData,
+void GPhotoCameraSession::onImageCaptured(int cameraIndex, int cameraCaptureId, const QByteArray &imageData,
                                           const QString &format, const QString &fileName)
 {
     if (m_cameraIndex != cameraIndex)
         return;
 
+    GPhotoTraceSpan span("onImageCaptured", cameraIndex);
+
+    auto id = sessionCaptureId(cameraCaptureId);
+
     if (format.startsWith(QLatin1String("jp"), Qt::CaseInsensitive)) {
         auto image = QImage::fromData(imageData);
         if (!image.isNull()) {
@@ -223,59 +385,141 @@ void GPhotoCameraSession::onImageCaptured(int cameraIndex, int id, const QByteAr
     }
 
     if (m_captureDestination & QCameraImageCapture::CaptureToFile) {
-        QString actualFileName(fileName);
+        const auto &actualFileName = captureFileName(id, format, fileName);
         if (actualFileName.isEmpty()) {
-            auto dir = QStandardPaths::writableLocation(QStandardPaths::PicturesLocation);
-            if (dir.isEmpty()) {
-                emit imageCaptureError(id, QCameraImageCapture::ResourceError,
-                                       tr("Could not determine writable location for saving captured image"));
-                return;
-            }
+            emit imageCaptureError(id, QCameraImageCapture::ResourceError,
+                                   tr("Could not determine writable location for saving captured image"));
+            return;
+        }
 
-            dir += QLatin1String("/DCIM%1.") + format;
-            // Trying to find free filename
-            for (auto i = 0; i < maxFileIndex; ++i) {
-                auto tmpFileName = dir.arg(i, 4, 10, QChar('0'));
-                if (!QFile(tmpFileName).exists()) {
-                    actualFileName = std::move(tmpFileName);
-                    break;
-                }
-            }
+        // Requested file is replaced like before, the generated names never replace anything
+        m_saveService->save(id, actualFileName, imageData, fileName.isEmpty());
+    }
+}
 
-            if (actualFileName.isEmpty()) {
-                emit imageCaptureError(id, QCameraImageCapture::ResourceError,
-                                       tr("Could not determine writable location for saving captured image"));
-                return;
-            }
-        }
+void GPhotoCameraSession::onImageFileCaptured(int cameraIndex, int cameraCaptureId, const QString &tempFileName,
+                                              const QString &format, const QString &fileName)
+{
+    if (m_cameraIndex != cameraIndex)
+        return;
 
-        QFile file(actualFileName);
-        if (file.open(QFile::WriteOnly)) {
-            if (file.write(imageData)) {
-                emit imageSaved(id, actualFileName);
-            } else {
-                emit imageCaptureError(id, QCameraImageCapture::OutOfSpaceError, file.errorString());
-            }
+    GPhotoTraceSpan span("onImageFileCaptured", cameraIndex);
+
+    auto id = sessionCaptureId(cameraCaptureId);
+
+    // There's no buffer for RAW files, so they're of no use without saving.
+    // Movies are always saved, capture destination is for still images
+    if (!(m_captureDestination & QCameraImageCapture::CaptureToFile) && m_recordingId != id) {
+        QFile::remove(tempFileName);
+        return;
+    }
+
+    const auto &actualFileName = captureFileName(id, format, fileName);
+    if (actualFileName.isEmpty()) {
+        QFile::remove(tempFileName);
+        emit imageCaptureError(id, QCameraImageCapture::ResourceError,
+                               tr("Could not determine writable location for saving captured image"));
+        return;
+    }
+
+    m_saveService->move(id, tempFileName, actualFileName, fileName.isEmpty());
+}
+
+QString GPhotoCameraSession::captureFileName(int id, const QString &format, const QString &fileName)
+{
+    // Files of the same shot, e.g. RAW and JPEG, share the base name picked for the first one
+    auto baseName = m_captureBaseNames.value(id);
+
+    if (baseName.isEmpty()) {
+        if (!fileName.isEmpty()) {
+            const QFileInfo info(fileName);
+            baseName = info.absolutePath() + QLatin1Char('/') + info.completeBaseName();
         } else {
-            auto errorMessage = tr("Could not open destination file:\n%1").arg(actualFileName);
-            emit imageCaptureError(id, QCameraImageCapture::ResourceError, errorMessage);
+            auto dir = QStandardPaths::writableLocation(QStandardPaths::PicturesLocation);
+            if (dir.isEmpty())
+                return {};
+
+            baseName = m_saveService->nextBaseName(dir);
         }
+
+        m_captureBaseNames.insert(id, baseName);
+        m_captureBaseNameIds.enqueue(id);
+        while (maxRememberedCaptures < m_captureBaseNameIds.size())
+            m_captureBaseNames.remove(m_captureBaseNameIds.dequeue());
+    }
+
+    const auto &directory = m_formatDirectories.value(format.toUpper());
+    if (!directory.isEmpty())
+        baseName = directory + QLatin1Char('/') + QFileInfo(baseName).fileName();
+
+    return baseName + QLatin1Char('.') + format;
+}
+
+void GPhotoCameraSession::updateSaveDirectories()
+{
+    const auto &controller = m_controller.lock();
+    if (!controller)
+        return;
+
+    QVariantMap formatDirectories;
+    for (auto it = m_formatDirectories.cbegin(); it != m_formatDirectories.cend(); ++it)
+        formatDirectories.insert(it.key(), it.value());
+
+    controller->setSaveDirectories(m_cameraIndex, QStandardPaths::writableLocation(QStandardPaths::PicturesLocation),
+                                   formatDirectories);
+}
+
+int GPhotoCameraSession::sessionCaptureId(int id)
+{
+    // Shots made with camera button come with negative ids, we give them our own ones
+    if (0 <= id)
+        return id;
+
+    auto sessionId = m_tetheredCaptureIds.value(id);
+    if (0 == sessionId) {
+        sessionId = ++m_captureId;
+        m_tetheredCaptureIds.insert(id, sessionId);
+        m_tetheredIds.enqueue(id);
+        while (maxRememberedCaptures < m_tetheredIds.size())
+            m_tetheredCaptureIds.remove(m_tetheredIds.dequeue());
     }
+
+    return sessionId;
 }
 
 void GPhotoCameraSession::onPreviewCaptured(int cameraIndex, const QImage &image)
 {
-    if (m_cameraIndex == cameraIndex && QCamera::ActiveState == m_state && m_surface && !image.isNull()) {
-        if (m_surface->isActive() && image.size() != m_surface->surfaceFormat().frameSize())
-            m_surface->stop();
+    if (m_cameraIndex != cameraIndex || QCamera::ActiveState != m_state || image.isNull())
+        return;
+
+    GPhotoTraceSpan span("onPreviewCaptured", cameraIndex);
+
+    // Frame arrived when it was wanted, but nobody could show it
+    if (!m_surface) {
+        if (m_metrics)
+            m_metrics->increment(GPhotoCameraMetrics::DroppedFrames);
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    if (m_surface->isActive() && image.size() != m_surface->surfaceFormat().frameSize())
+        m_surface->stop();
+
+    if (!m_surface->isActive())
+        m_surface->start(QVideoSurfaceFormat(image.size(), QVideoFrame::Format_RGB32));
 
-        if (!m_surface->isActive())
-            m_surface->start(QVideoSurfaceFormat(image.size(), QVideoFrame::Format_RGB32));
+    QVideoFrame frame(image);
+    auto presented = m_surface->present(frame);
 
-        QVideoFrame frame(image);
-        m_surface->present(frame);
-        emit videoFrameProbed(frame);
+    if (m_metrics) {
+        m_metrics->record(GPhotoCameraMetrics::PreviewPresent, timer.nsecsElapsed());
+        if (!presented)
+            m_metrics->increment(GPhotoCameraMetrics::DroppedFrames);
     }
+
+    emit videoFrameProbed(frame);
 }
 
 void GPhotoCameraSession::onReadyForCaptureChanged(int cameraIndex, bool readyForCapture)
@@ -286,6 +530,12 @@ void GPhotoCameraSession::onReadyForCaptureChanged(int cameraIndex, bool readyFo
     }
 }
 
+void GPhotoCameraSession::onRecordingChanged(int cameraIndex, int id, bool recording)
+{
+    if (m_cameraIndex == cameraIndex)
+        emit recordingChanged(id, recording);
+}
+
 void GPhotoCameraSession::onStateChanged(int cameraIndex, QCamera::State state)
 {
     if (m_cameraIndex == cameraIndex && m_state != state) {
@@ -301,3 +551,16 @@ void GPhotoCameraSession::onStatusChanged(int cameraIndex, QCamera::Status statu
         emit statusChanged(status);
     }
 }
+
+void GPhotoCameraSession::onTimelapseShotTriggered(int cameraIndex, int id, int shot, qint64 plannedNsecs,
+                                                   qint64 actualNsecs)
+{
+    if (m_cameraIndex == cameraIndex)
+        emit timelapseShotTriggered(id, shot, plannedNsecs, actualNsecs);
+}
+
+void GPhotoCameraSession::onTransferProgress(int cameraIndex, int id, qint64 bytes, qint64 total)
+{
+    if (m_cameraIndex == cameraIndex)
+        emit captureProgress(sessionCaptureId(id), bytes, total);
+}
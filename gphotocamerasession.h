@@ -5,15 +5,21 @@
 
 #include <QCamera>
 #include <QCameraImageCapture>
+#include <QHash>
 #include <QObject>
 #include <QPointer>
+#include <QQueue>
+
+#include "gphotocamera.h"
+#include "gphotosaveservice.h"
 
 QT_BEGIN_NAMESPACE
 class QCameraFocusControl;
 QT_END_NAMESPACE
 
-class GPhotoCamera;
+class GPhotoCameraMetrics;
 class GPhotoController;
+class GPhotoMetrics;
 
 class GPhotoCameraSession final : public QObject
 {
@@ -45,6 +51,28 @@ public:
     // capture control
     bool isReadyForCapture() const;
     int capture(const QString &fileName);
+    /// Captures a frame per step of @p steps, see GPhotoCamera::captureBracket(). Returns id of the first frame
+    int captureBracket(const QVariantList &steps, const QString &fileName);
+    /// Shoots @p count photos every @p interval msecs, see GPhotoCamera::startTimelapse(). Returns id of the first shot
+    int startTimelapse(int interval, int count, const QString &fileName);
+    void stopTimelapse();
+    /// Records a movie in video capture mode, the file is saved with imageSaved(). Returns id of the movie
+    int startRecording(const QString &fileName);
+    void stopRecording();
+    void cancelCapture();
+    void setTethered(bool tethered);
+
+    void setDownloadPolicy(GPhotoCamera::DownloadPolicy policy, const QStringList &extensions = QStringList());
+    /// Files left on the card by download policy, as "folder/name" paths on the camera
+    QStringList deferredFiles() const;
+    void clearDeferredFiles();
+
+    /// Directory overriding the requested one for files of given format, e.g. "CR2"
+    QString formatDirectory(const QString &format) const;
+    void setFormatDirectory(const QString &format, const QString &directory);
+
+    /// How saved files are flushed to disk, see GPhotoSaveService
+    void setSaveDurability(GPhotoSaveService::Durability durability, int groupFiles = 0, int groupInterval = 0);
 
     // video renderer control
     QAbstractVideoSurface* surface() const;
@@ -57,13 +85,22 @@ public:
 
     QCameraFocusControl* cameraFocusControl() const;
 
+    // counters and latencies of all the cameras
+    GPhotoMetrics* metrics() const;
+
     void setCamera(int cameraIndex);
 
 signals:
+    // camera events: property changes, files added on camera body etc.
+    void cameraEvent(const GPhotoCamera::CameraEvent &event);
+    /// Session switched to another camera, everything read from the previous one is outdated
+    void cameraChanged(int cameraIndex);
+
     // camera control
     void statusChanged(QCamera::Status status);
     void stateChanged(QCamera::State state);
     void error(int errorCode, const QString &errorString);
+    void fileDeferred(int id, const QString &path);
     void captureModeChanged(QCamera::CaptureModes captureMode);
 
     // capture destination control
@@ -74,28 +111,51 @@ signals:
     void imageCaptured(int id, const QImage &preview);
     void imageCaptureError(int id, int errorCode, const QString &errorString);
     void imageSaved(int id, const QString &fileName);
+    /// Download of the captured file from camera, throttled
+    void captureProgress(int id, qint64 bytes, qint64 total);
+    void bracketFrameCaptured(int id, int frame, qint64 applyNsecs, qint64 captureNsecs);
+    /// Timelapse shot triggered, both times are from the start of the timelapse
+    void timelapseShotTriggered(int id, int shot, qint64 plannedNsecs, qint64 actualNsecs);
     void readyForCaptureChanged(bool readyForCapture);
 
+    // media recorder control
+    void recordingChanged(int id, bool recording);
+
     // video probe control
     void videoFrameProbed(const QVideoFrame &frame);
 
 private slots:
+    void onCameraEvent(int cameraIndex, const GPhotoCamera::CameraEvent &event);
+    void onBracketFrameCaptured(int cameraIndex, int id, int frame, qint64 applyNsecs, qint64 captureNsecs);
     void onCaptureModeChanged(int cameraIndex, QCamera::CaptureModes captureMode);
     void onError(int cameraIndex, int errorCode, const QString &errorString);
+    void onFileDeferred(int cameraIndex, int id, const QString &path);
     void onImageCaptureError(int cameraIndex, int id, int errorCode, const QString &errorString);
     void onImageCaptured(int cameraIndex, int id, const QByteArray &imageData,
                          const QString &format, const QString &fileName);
+    void onImageFileCaptured(int cameraIndex, int id, const QString &tempFileName,
+                             const QString &format, const QString &fileName);
     void onPreviewCaptured(int cameraIndex, const QImage &image);
     void onReadyForCaptureChanged(int cameraIndex, bool readyForCapture);
+    void onRecordingChanged(int cameraIndex, int id, bool recording);
     void onStateChanged(int cameraIndex, QCamera::State state);
     void onStatusChanged(int cameraIndex, QCamera::Status status);
+    void onTimelapseShotTriggered(int cameraIndex, int id, int shot, qint64 plannedNsecs, qint64 actualNsecs);
+    void onTransferProgress(int cameraIndex, int id, qint64 bytes, qint64 total);
 
 private:
     Q_DISABLE_COPY(GPhotoCameraSession)
 
+    int sessionCaptureId(int id);
+    QString captureFileName(int id, const QString &format, const QString &fileName);
+    /// Tells the camera where files are saved, so it downloads them there
+    void updateSaveDirectories();
+
     std::weak_ptr<GPhotoController> m_controller;
     std::unique_ptr<QCameraFocusControl> m_cameraFocusControl;
+    std::unique_ptr<GPhotoSaveService> m_saveService;
     QPointer<QAbstractVideoSurface> m_surface;
+    GPhotoCameraMetrics *m_metrics = nullptr;
 
     QCamera::CaptureModes m_captureMode = QCamera::CaptureStillImage;
     QCamera::State m_state = QCamera::UnloadedState;
@@ -106,6 +166,12 @@ private:
 
     int m_cameraIndex = -1;
     int m_captureId = 0;
+    int m_recordingId = 0;
+    QHash<int, int> m_tetheredCaptureIds;
+    QQueue<int> m_tetheredIds;
+    QHash<int, QString> m_captureBaseNames;
+    QQueue<int> m_captureBaseNameIds;
+    QHash<QString, QString> m_formatDirectories;
     bool m_readyForCapture = false;
 };
 
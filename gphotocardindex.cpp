@@ -0,0 +1,324 @@
+#include <algorithm>
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QPair>
+#include <QRegExp>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include "gphotobackend.h"
+#include "gphotocardindex.h"
+#include "gphototrace.h"
+
+namespace {
+    constexpr auto indexVersion = 1;
+
+    QString joinPath(const QString &folder, const QString &name)
+    {
+        return folder.endsWith(QLatin1Char('/')) ? folder + name : folder + QLatin1Char('/') + name;
+    }
+
+    /// Number of a DCF folder like DCIM/100CANON, negative for the other folders, e.g. MISC
+    int dcfFolderNumber(const QString &folder)
+    {
+        QRegExp pattern(QLatin1String(".*/DCIM/([1-9]\\d\\d)[0-9A-Z_]{5}"), Qt::CaseInsensitive);
+        return pattern.exactMatch(folder) ? pattern.cap(1).toInt() : -1;
+    }
+}
+
+GPhotoCardIndex::GPhotoCardIndex(GPhotoBackend *backend)
+    : m_backend(backend)
+{
+}
+
+void GPhotoCardIndex::load(const QString &serialNumber)
+{
+    if (m_loaded && serialNumber == m_serialNumber)
+        return;
+
+    m_loaded = true;
+    m_serialNumber = serialNumber;
+    m_fileName = dataFileName(serialNumber, QLatin1String("card.json"));
+    m_folders.clear();
+    m_seeded = false;
+    m_tracking = false;
+    m_dirty = false;
+
+    QFile file(m_fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+
+    const auto &root = QJsonDocument::fromJson(file.readAll()).object();
+    if (indexVersion != root.value(QLatin1String("version")).toInt())
+        return;
+
+    for (const auto &folder : root.value(QLatin1String("folders")).toArray())
+        m_folders[folder.toString()];
+
+    for (const auto &value : root.value(QLatin1String("files")).toArray()) {
+        const auto &object = value.toObject();
+
+        File entry;
+        entry.folder = object.value(QLatin1String("folder")).toString();
+        entry.name = object.value(QLatin1String("name")).toString();
+        entry.size = qint64(object.value(QLatin1String("size")).toDouble(-1));
+        entry.mtime = qint64(object.value(QLatin1String("mtime")).toDouble());
+        m_folders[entry.folder].insert(entry.name, entry);
+    }
+
+    m_seeded = true;
+}
+
+bool GPhotoCardIndex::save()
+{
+    if (!m_dirty || m_fileName.isEmpty())
+        return true;
+
+    QJsonArray folders;
+    QJsonArray files;
+    for (auto folder = m_folders.cbegin(); folder != m_folders.cend(); ++folder) {
+        folders.append(folder.key());
+
+        for (const auto &entry : folder.value()) {
+            QJsonObject object;
+            object.insert(QLatin1String("folder"), entry.folder);
+            object.insert(QLatin1String("name"), entry.name);
+            object.insert(QLatin1String("size"), double(entry.size));
+            object.insert(QLatin1String("mtime"), double(entry.mtime));
+            files.append(object);
+        }
+    }
+
+    QJsonObject root;
+    root.insert(QLatin1String("version"), indexVersion);
+    root.insert(QLatin1String("folders"), folders);
+    root.insert(QLatin1String("files"), files);
+
+    QSaveFile file(m_fileName);
+    if (!file.open(QIODevice::WriteOnly)
+            || file.write(QJsonDocument(root).toJson(QJsonDocument::Compact)) < 0 || !file.commit()) {
+        qWarning() << "GPhoto: Unable to save card index to" << m_fileName << ":" << file.errorString();
+        return false;
+    }
+
+    m_dirty = false;
+    return true;
+}
+
+bool GPhotoCardIndex::refresh()
+{
+    if (m_tracking)
+        return true;
+
+    GPhotoTraceSpan span("cardIndexRefresh");
+
+    // Folder tree is small, so it's always listed
+    QStringList folders;
+    if (!listFolders(QLatin1String("/"), &folders))
+        return false;
+
+    for (const auto &folder : m_folders.keys()) {
+        if (!folders.contains(folder)) {
+            m_folders.remove(folder);
+            m_dirty = true;
+        }
+    }
+
+    // Cameras write to the highest numbered DCF folder of a storage only, so the older ones are trusted
+    QStringList changed;
+    QMap<QString, QPair<int, QString>> newest;
+    QMap<QString, QStringList> others;
+    for (const auto &folder : folders) {
+        if (!m_seeded || !m_folders.contains(folder)) {
+            changed.append(folder);
+            continue;
+        }
+
+        const auto &storage = folder.section(QLatin1Char('/'), 1, 1);
+        if (storage.isEmpty())
+            continue;
+
+        auto number = dcfFolderNumber(folder);
+        if (number < 0) {
+            others[storage].append(folder);
+            continue;
+        }
+
+        const auto &current = newest.value(storage, qMakePair(-1, QString()));
+        if (current.first < number || (current.first == number && current.second < folder))
+            newest.insert(storage, qMakePair(number, folder));
+    }
+
+    for (const auto &candidate : newest)
+        changed.append(candidate.second);
+
+    // Without DCF folders there's no telling where the camera writes, so all its folders are listed
+    for (auto it = others.cbegin(); others.cend() != it; ++it) {
+        if (!newest.contains(it.key()))
+            changed.append(it.value());
+    }
+
+    for (const auto &folder : changed) {
+        if (!listFiles(folder))
+            return false;
+    }
+
+    m_seeded = true;
+    m_tracking = true;
+    save();
+    return true;
+}
+
+bool GPhotoCardIndex::isTracking() const
+{
+    return m_tracking;
+}
+
+void GPhotoCardIndex::stopTracking()
+{
+    save();
+    m_tracking = false;
+}
+
+QList<GPhotoCardIndex::File> GPhotoCardIndex::files() const
+{
+    QList<File> result;
+    for (const auto &folder : m_folders)
+        result.append(folder.values());
+
+    return result;
+}
+
+void GPhotoCardIndex::addFolder(const QString &folder)
+{
+    if (!m_tracking || m_folders.contains(folder))
+        return;
+
+    m_folders[folder];
+    m_dirty = true;
+}
+
+void GPhotoCardIndex::addFile(const QString &folder, const QString &name)
+{
+    if (!m_tracking || m_folders.value(folder).contains(name))
+        return;
+
+    File entry;
+    entry.folder = folder;
+    entry.name = name;
+    m_folders[folder].insert(name, entry);
+    m_dirty = true;
+}
+
+void GPhotoCardIndex::updateFile(const File &file)
+{
+    auto folder = m_folders.find(file.folder);
+    if (m_folders.end() == folder || !folder->contains(file.name))
+        return;
+
+    folder->insert(file.name, file);
+    m_dirty = true;
+}
+
+void GPhotoCardIndex::removeFile(const QString &folder, const QString &name)
+{
+    auto it = m_folders.find(folder);
+    if (m_folders.end() != it && it->remove(name))
+        m_dirty = true;
+}
+
+QString GPhotoCardIndex::dataFileName(const QString &serialNumber, const QString &suffix)
+{
+    // Without a serial number there's no telling one camera from another
+    if (serialNumber.isEmpty())
+        return QString();
+
+    auto safeSerial = serialNumber;
+    safeSerial.replace(QRegExp(QLatin1String("[^A-Za-z0-9_-]")), QLatin1String("_"));
+
+    const auto &dir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    QDir().mkpath(dir);
+    return dir + QLatin1String("/gphoto-") + safeSerial + QLatin1Char('-') + suffix;
+}
+
+bool GPhotoCardIndex::listFolders(const QString &folder, QStringList *folders)
+{
+    folders->append(folder);
+
+    CameraList *list = nullptr;
+    gp_list_new(&list);
+    auto listPtr = CameraListPtr(list, gp_list_free);
+
+    auto ret = m_backend->folderListFolders(folder.toLatin1(), list);
+    if (ret < GP_OK) {
+        qWarning() << "GPhoto: Unable to list folders in" << folder << ":" << ret;
+        return false;
+    }
+
+    for (auto i = 0; i < gp_list_count(list); ++i) {
+        const char *name = nullptr;
+        gp_list_get_name(list, i, &name);
+        if (!listFolders(joinPath(folder, QString::fromLatin1(name)), folders))
+            return false;
+    }
+
+    return true;
+}
+
+bool GPhotoCardIndex::listFiles(const QString &folder)
+{
+    CameraList *list = nullptr;
+    gp_list_new(&list);
+    auto listPtr = CameraListPtr(list, gp_list_free);
+
+    auto ret = m_backend->folderListFiles(folder.toLatin1(), list);
+    if (ret < GP_OK) {
+        qWarning() << "GPhoto: Unable to list files in" << folder << ":" << ret;
+        return false;
+    }
+
+    QStringList names;
+    for (auto i = 0; i < gp_list_count(list); ++i) {
+        const char *name = nullptr;
+        gp_list_get_name(list, i, &name);
+        names.append(QString::fromLatin1(name));
+    }
+
+    // Files only added since the last listing keep their info, otherwise the folder
+    // was rewritten, e.g. the card was formatted, and the names may belong to other files
+    const auto &known = m_folders.value(folder);
+    auto appended = std::all_of(known.keyBegin(), known.keyEnd(), [&names] (const QString &name) {
+        return names.contains(name);
+    });
+
+    Folder entries;
+    for (const auto &name : names) {
+        if (appended && 0 <= known.value(name).size) {
+            entries.insert(name, known.value(name));
+            continue;
+        }
+
+        File entry;
+        entry.folder = folder;
+        entry.name = name;
+
+        CameraFileInfo info;
+        if (GP_OK <= m_backend->fileGetInfo(folder.toLatin1(), name.toLatin1(), &info)) {
+            if (info.file.fields & GP_FILE_INFO_SIZE)
+                entry.size = qint64(info.file.size);
+            if (info.file.fields & GP_FILE_INFO_MTIME)
+                entry.mtime = qint64(info.file.mtime);
+        }
+
+        entries.insert(name, entry);
+    }
+
+    m_folders.insert(folder, entries);
+    m_dirty = true;
+    return true;
+}
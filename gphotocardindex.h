@@ -0,0 +1,79 @@
+#ifndef GPHOTOCARDINDEX_H
+#define GPHOTOCARDINDEX_H
+
+#include <QList>
+#include <QMap>
+#include <QString>
+#include <QStringList>
+
+class GPhotoBackend;
+
+/** Files on the camera card, saved per camera serial number.
+ *
+ * Listing a card with thousands of files over PTP takes minutes, so the
+ * whole card is listed only once. While the camera stays connected the
+ * index follows file and folder added events. After reconnecting, only
+ * the folders the camera could have written to since are listed again:
+ * the new ones and the highest numbered DCF folder, e.g. DCIM/100CANON,
+ * of every storage.
+ */
+class GPhotoCardIndex final
+{
+public:
+    struct File {
+        QString folder;
+        QString name;
+        /// Unknown size is negative, e.g. for files reported by events
+        qint64 size = -1;
+        qint64 mtime = 0;
+    };
+
+    explicit GPhotoCardIndex(GPhotoBackend *backend);
+    ~GPhotoCardIndex() = default;
+
+    GPhotoCardIndex(GPhotoCardIndex&&) = delete;
+    GPhotoCardIndex& operator=(GPhotoCardIndex&&) = delete;
+
+    /// Loads the index saved for the camera, does nothing if it's loaded already
+    void load(const QString &serialNumber);
+    bool save();
+
+    /// Lists the parts of the card which could have changed, false if the card can't be read
+    bool refresh();
+
+    /// Index is up to date without listing the card
+    bool isTracking() const;
+    /// Card could be changed behind our back, e.g. when camera is disconnected
+    void stopTracking();
+
+    QList<File> files() const;
+
+    /// Changes seen in camera events, ignored unless the index is tracking
+    void addFolder(const QString &folder);
+    void addFile(const QString &folder, const QString &name);
+
+    void updateFile(const File &file);
+    void removeFile(const QString &folder, const QString &name);
+
+    /// Name of a per camera file in app data directory
+    static QString dataFileName(const QString &serialNumber, const QString &suffix);
+
+private:
+    Q_DISABLE_COPY(GPhotoCardIndex)
+
+    using Folder = QMap<QString, File>;
+
+    bool listFolders(const QString &folder, QStringList *folders);
+    bool listFiles(const QString &folder);
+
+    GPhotoBackend *m_backend;
+    QString m_serialNumber;
+    QString m_fileName;
+    QMap<QString, Folder> m_folders;
+    bool m_loaded = false;
+    bool m_seeded = false;
+    bool m_tracking = false;
+    bool m_dirty = false;
+};
+
+#endif // GPHOTOCARDINDEX_H
@@ -8,6 +8,8 @@
 
 #include "gphotocamera.h"
 #include "gphotocontroller.h"
+#include "gphotometrics.h"
+#include "gphototrace.h"
 #include "gphotoworker.h"
 
 namespace {
@@ -16,19 +18,35 @@ namespace {
 
 GPhotoController::GPhotoController(QObject *parent)
     : QObject(parent)
+    , m_metrics(new GPhotoMetrics)
     , m_workerThread(new QThread(this))
-    , m_worker(new GPhotoWorker)
+    , m_worker(new GPhotoWorker(m_metrics.get()))
 {
+    m_workerThread->setObjectName(QStringLiteral("GPhotoWorker"));
     m_worker->moveToThread(m_workerThread.get());
 
+    qRegisterMetaType<GPhotoCamera::CameraEvent>();
+    qRegisterMetaType<GPhotoCamera::DownloadPolicy>();
+
+    connect(m_worker.get(), &GPhotoWorker::bracketFrameCaptured, this, &GPhotoController::bracketFrameCaptured);
+    connect(m_worker.get(), &GPhotoWorker::cameraEvent, this, &GPhotoController::cameraEvent);
     connect(m_worker.get(), &GPhotoWorker::captureModeChanged, this, &GPhotoController::onCaptureModeChanged);
     connect(m_worker.get(), &GPhotoWorker::error, this, &GPhotoController::error);
+    connect(m_worker.get(), &GPhotoWorker::fileDeferred, this, &GPhotoController::fileDeferred);
+    connect(m_worker.get(), &GPhotoWorker::fileImported, this, &GPhotoController::fileImported);
     connect(m_worker.get(), &GPhotoWorker::imageCaptureError, this, &GPhotoController::imageCaptureError);
     connect(m_worker.get(), &GPhotoWorker::imageCaptured, this, &GPhotoController::imageCaptured);
+    connect(m_worker.get(), &GPhotoWorker::imageFileCaptured, this, &GPhotoController::imageFileCaptured);
+    connect(m_worker.get(), &GPhotoWorker::importFinished, this, &GPhotoController::importFinished);
+    connect(m_worker.get(), &GPhotoWorker::importProgress, this, &GPhotoController::importProgress);
     connect(m_worker.get(), &GPhotoWorker::previewCaptured, this, &GPhotoController::previewCaptured);
     connect(m_worker.get(), &GPhotoWorker::readyForCaptureChanged, this, &GPhotoController::readyForCaptureChanged);
+    connect(m_worker.get(), &GPhotoWorker::recordingChanged, this, &GPhotoController::recordingChanged);
     connect(m_worker.get(), &GPhotoWorker::stateChanged, this, &GPhotoController::onStateChanged);
     connect(m_worker.get(), &GPhotoWorker::statusChanged, this, &GPhotoController::onStatusChanged);
+    connect(m_worker.get(), &GPhotoWorker::timelapseShotTriggered, this, &GPhotoController::timelapseShotTriggered);
+    connect(m_worker.get(), &GPhotoWorker::transferFinished, this, &GPhotoController::transferFinished);
+    connect(m_worker.get(), &GPhotoWorker::transferProgress, this, &GPhotoController::transferProgress);
 
     m_workerThread->start();
 }
@@ -41,39 +59,126 @@ GPhotoController::~GPhotoController()
         m_workerThread->terminate();
 }
 
+template <typename... Args>
+void GPhotoController::invokeWorker(const char *method, int cameraIndex, Qt::ConnectionType type, Args... args) const
+{
+    // Blocking calls show up as GUI thread stalls on the timeline
+    GPhotoTraceSpan span(method, cameraIndex);
+
+    m_metrics->workerRequestQueued();
+    QMetaObject::invokeMethod(m_worker.get(), method, type, args...);
+}
+
 bool GPhotoController::init()
 {
     auto result = false;
-    QMetaObject::invokeMethod(m_worker.get(), "init", Qt::BlockingQueuedConnection,
-                              Q_RETURN_ARG(bool, result));
+    invokeWorker("init", -1, Qt::BlockingQueuedConnection,
+                 Q_RETURN_ARG(bool, result));
     return result;
 }
 
 QList<QByteArray> GPhotoController::cameraNames() const
 {
     QList<QByteArray> result;
-    QMetaObject::invokeMethod(m_worker.get(), "cameraNames", Qt::BlockingQueuedConnection,
-                              Q_RETURN_ARG(QList<QByteArray>, result));
+    invokeWorker("cameraNames", -1, Qt::BlockingQueuedConnection,
+                 Q_RETURN_ARG(QList<QByteArray>, result));
     return result;
 }
 
 QByteArray GPhotoController::defaultCameraName() const
 {
     QByteArray result;
-    QMetaObject::invokeMethod(m_worker.get(), "defaultCameraName", Qt::BlockingQueuedConnection,
-                              Q_RETURN_ARG(QByteArray, result));
+    invokeWorker("defaultCameraName", -1, Qt::BlockingQueuedConnection,
+                 Q_RETURN_ARG(QByteArray, result));
     return result;
 }
 
 void GPhotoController::initCamera(int cameraIndex) const
 {
-    QMetaObject::invokeMethod(m_worker.get(), "initCamera", Qt::QueuedConnection, Q_ARG(int, cameraIndex));
+    invokeWorker("initCamera", cameraIndex, Qt::QueuedConnection, Q_ARG(int, cameraIndex));
 }
 
 void GPhotoController::capturePhoto(int cameraIndex, int id, const QString &fileName) const
 {
-    QMetaObject::invokeMethod(m_worker.get(), "capturePhoto", Qt::QueuedConnection,
-                              Q_ARG(int, cameraIndex), Q_ARG(int, id), Q_ARG(QString, fileName));
+    invokeWorker("capturePhoto", cameraIndex, Qt::QueuedConnection,
+                 Q_ARG(int, cameraIndex), Q_ARG(int, id), Q_ARG(QString, fileName));
+}
+
+void GPhotoController::captureBracket(int cameraIndex, int id, const QString &fileName, const QVariantList &steps) const
+{
+    invokeWorker("captureBracket", cameraIndex, Qt::QueuedConnection,
+                 Q_ARG(int, cameraIndex), Q_ARG(int, id), Q_ARG(QString, fileName), Q_ARG(QVariantList, steps));
+}
+
+void GPhotoController::startTimelapse(int cameraIndex, int id, const QString &fileName, int interval, int count) const
+{
+    invokeWorker("startTimelapse", cameraIndex, Qt::QueuedConnection, Q_ARG(int, cameraIndex), Q_ARG(int, id),
+                 Q_ARG(QString, fileName), Q_ARG(int, interval), Q_ARG(int, count));
+}
+
+void GPhotoController::stopTimelapse(int cameraIndex) const
+{
+    invokeWorker("stopTimelapse", cameraIndex, Qt::QueuedConnection, Q_ARG(int, cameraIndex));
+}
+
+void GPhotoController::startRecording(int cameraIndex, int id, const QString &fileName) const
+{
+    invokeWorker("startRecording", cameraIndex, Qt::QueuedConnection,
+                 Q_ARG(int, cameraIndex), Q_ARG(int, id), Q_ARG(QString, fileName));
+}
+
+void GPhotoController::stopRecording(int cameraIndex) const
+{
+    invokeWorker("stopRecording", cameraIndex, Qt::QueuedConnection, Q_ARG(int, cameraIndex));
+}
+
+void GPhotoController::cancelCapture(int cameraIndex) const
+{
+    invokeWorker("cancelCapture", cameraIndex, Qt::QueuedConnection, Q_ARG(int, cameraIndex));
+}
+
+void GPhotoController::setTethered(int cameraIndex, bool tethered) const
+{
+    invokeWorker("setTethered", cameraIndex, Qt::QueuedConnection,
+                 Q_ARG(int, cameraIndex), Q_ARG(bool, tethered));
+}
+
+void GPhotoController::setDownloadPolicy(int cameraIndex, GPhotoCamera::DownloadPolicy policy,
+                                         const QStringList &extensions) const
+{
+    invokeWorker("setDownloadPolicy", cameraIndex, Qt::QueuedConnection, Q_ARG(int, cameraIndex),
+                 Q_ARG(GPhotoCamera::DownloadPolicy, policy), Q_ARG(QStringList, extensions));
+}
+
+void GPhotoController::setSaveDirectories(int cameraIndex, const QString &directory,
+                                          const QVariantMap &formatDirectories) const
+{
+    invokeWorker("setSaveDirectories", cameraIndex, Qt::QueuedConnection, Q_ARG(int, cameraIndex),
+                 Q_ARG(QString, directory), Q_ARG(QVariantMap, formatDirectories));
+}
+
+QStringList GPhotoController::deferredFiles(int cameraIndex) const
+{
+    QStringList result;
+    invokeWorker("deferredFiles", cameraIndex, Qt::BlockingQueuedConnection,
+                 Q_RETURN_ARG(QStringList, result), Q_ARG(int, cameraIndex));
+    return result;
+}
+
+void GPhotoController::clearDeferredFiles(int cameraIndex) const
+{
+    invokeWorker("clearDeferredFiles", cameraIndex, Qt::QueuedConnection, Q_ARG(int, cameraIndex));
+}
+
+void GPhotoController::importFiles(int cameraIndex, const QString &destination) const
+{
+    invokeWorker("importFiles", cameraIndex, Qt::QueuedConnection, Q_ARG(int, cameraIndex),
+                 Q_ARG(QString, destination));
+}
+
+void GPhotoController::cancelImport(int cameraIndex) const
+{
+    invokeWorker("cancelImport", cameraIndex, Qt::QueuedConnection, Q_ARG(int, cameraIndex));
 }
 
 QCamera::CaptureModes GPhotoController::captureMode(int cameraIndex) const
@@ -83,8 +188,8 @@ QCamera::CaptureModes GPhotoController::captureMode(int cameraIndex) const
 
 void GPhotoController::setCaptureMode(int cameraIndex, QCamera::CaptureModes captureMode)
 {
-    QMetaObject::invokeMethod(m_worker.get(), "setCaptureMode", Qt::QueuedConnection,
-                              Q_ARG(int, cameraIndex), Q_ARG(QCamera::CaptureModes, captureMode));
+    invokeWorker("setCaptureMode", cameraIndex, Qt::QueuedConnection,
+                 Q_ARG(int, cameraIndex), Q_ARG(QCamera::CaptureModes, captureMode));
 }
 
 QCamera::State GPhotoController::state(int cameraIndex) const
@@ -94,8 +199,8 @@ QCamera::State GPhotoController::state(int cameraIndex) const
 
 void GPhotoController::setState(int cameraIndex, QCamera::State state) const
 {
-    QMetaObject::invokeMethod(m_worker.get(), "setState", Qt::QueuedConnection,
-                              Q_ARG(int, cameraIndex), Q_ARG(QCamera::State, state));
+    invokeWorker("setState", cameraIndex, Qt::QueuedConnection,
+                 Q_ARG(int, cameraIndex), Q_ARG(QCamera::State, state));
 }
 
 QCamera::Status GPhotoController::status(int cameraIndex) const
@@ -106,29 +211,50 @@ QCamera::Status GPhotoController::status(int cameraIndex) const
 QVariant GPhotoController::parameter(int cameraIndex, const QString &name) const
 {
     QVariant result;
-    QMetaObject::invokeMethod(m_worker.get(), "parameter", Qt::BlockingQueuedConnection,
-                              Q_RETURN_ARG(QVariant, result), Q_ARG(int, cameraIndex), Q_ARG(QString, name));
+    invokeWorker("parameter", cameraIndex, Qt::BlockingQueuedConnection,
+                 Q_RETURN_ARG(QVariant, result), Q_ARG(int, cameraIndex), Q_ARG(QString, name));
     return result;
 }
 
 bool GPhotoController::setParameter(int cameraIndex, const QString &name, const QVariant &value)
 {
     auto result = false;
-    QMetaObject::invokeMethod(m_worker.get(), "setParameter", Qt::BlockingQueuedConnection,
-                              Q_RETURN_ARG(bool, result), Q_ARG(int, cameraIndex),
-                              Q_ARG(QString, name), Q_ARG(QVariant, value));
+    invokeWorker("setParameter", cameraIndex, Qt::BlockingQueuedConnection,
+                 Q_RETURN_ARG(bool, result), Q_ARG(int, cameraIndex),
+                 Q_ARG(QString, name), Q_ARG(QVariant, value));
     return result;
 }
 
 QVariantList GPhotoController::parameterValues(int cameraIndex, const QString &name, QMetaType::Type valueType) const
 {
     auto result = QVariantList();
-    QMetaObject::invokeMethod(m_worker.get(), "parameterValues", Qt::BlockingQueuedConnection,
-                              Q_RETURN_ARG(QVariantList, result), Q_ARG(int, cameraIndex),
-                              Q_ARG(QString, name), Q_ARG(QMetaType::Type, valueType));
+    invokeWorker("parameterValues", cameraIndex, Qt::BlockingQueuedConnection,
+                 Q_RETURN_ARG(QVariantList, result), Q_ARG(int, cameraIndex),
+                 Q_ARG(QString, name), Q_ARG(QMetaType::Type, valueType));
+    return result;
+}
+
+QJsonObject GPhotoController::snapshotConfig(int cameraIndex) const
+{
+    QJsonObject result;
+    invokeWorker("snapshotConfig", cameraIndex, Qt::BlockingQueuedConnection,
+                 Q_RETURN_ARG(QJsonObject, result), Q_ARG(int, cameraIndex));
+    return result;
+}
+
+bool GPhotoController::applyConfig(int cameraIndex, const QJsonObject &snapshot)
+{
+    auto result = false;
+    invokeWorker("applyConfig", cameraIndex, Qt::BlockingQueuedConnection,
+                 Q_RETURN_ARG(bool, result), Q_ARG(int, cameraIndex), Q_ARG(QJsonObject, snapshot));
     return result;
 }
 
+GPhotoMetrics* GPhotoController::metrics() const
+{
+    return m_metrics.get();
+}
+
 void GPhotoController::onCaptureModeChanged(int cameraIndex, QCamera::CaptureModes captureMode)
 {
     if (m_captureModes.value(cameraIndex, QCamera::CaptureStillImage) != captureMode) {
@@ -6,11 +6,13 @@
 #include <QCamera>
 #include <QObject>
 
+#include "gphotocamera.h"
+
 QT_BEGIN_NAMESPACE
 class QThread;
 QT_END_NAMESPACE
 
-class GPhotoCamera;
+class GPhotoMetrics;
 class GPhotoWorker;
 
 class GPhotoController final : public QObject
@@ -30,6 +32,24 @@ public:
 
     void initCamera(int cameraIndex) const;
     void capturePhoto(int cameraIndex, int id, const QString &fileName) const;
+    /// Captures a frame per step, see GPhotoCamera::captureBracket()
+    void captureBracket(int cameraIndex, int id, const QString &fileName, const QVariantList &steps) const;
+    /// Shoots on a fixed schedule, see GPhotoCamera::startTimelapse()
+    void startTimelapse(int cameraIndex, int id, const QString &fileName, int interval, int count) const;
+    void stopTimelapse(int cameraIndex) const;
+    /// Records a movie in video capture mode, see GPhotoCamera::startRecording()
+    void startRecording(int cameraIndex, int id, const QString &fileName) const;
+    void stopRecording(int cameraIndex) const;
+    void cancelCapture(int cameraIndex) const;
+    void setTethered(int cameraIndex, bool tethered) const;
+    void setDownloadPolicy(int cameraIndex, GPhotoCamera::DownloadPolicy policy, const QStringList &extensions) const;
+    void setSaveDirectories(int cameraIndex, const QString &directory, const QVariantMap &formatDirectories) const;
+    QStringList deferredFiles(int cameraIndex) const;
+    void clearDeferredFiles(int cameraIndex) const;
+
+    /// Copies the files on the card which were not imported before to @p destination
+    void importFiles(int cameraIndex, const QString &destination) const;
+    void cancelImport(int cameraIndex) const;
 
     QCamera::CaptureModes captureMode(int cameraIndex) const;
     void setCaptureMode(int cameraIndex, QCamera::CaptureModes captureMode);
@@ -43,16 +63,35 @@ public:
     bool setParameter(int cameraIndex, const QString &name, const QVariant &value);
     QVariantList parameterValues(int cameraIndex, const QString &name, QMetaType::Type valueType) const;
 
+    /// All the writable settings of the camera as JSON, e.g. to save them as a preset
+    QJsonObject snapshotConfig(int cameraIndex) const;
+    /// Changes the settings which differ from @p snapshot with a single round trip
+    bool applyConfig(int cameraIndex, const QJsonObject &snapshot);
+
+    GPhotoMetrics* metrics() const;
+
 signals:
+    void bracketFrameCaptured(int cameraIndex, int id, int frame, qint64 applyNsecs, qint64 captureNsecs);
+    void cameraEvent(int cameraIndex, const GPhotoCamera::CameraEvent &event);
     void captureModeChanged(int cameraIndex, QCamera::CaptureModes);
     void error(int cameraIndex, int errorCode, const QString &errorString);
+    void fileDeferred(int cameraIndex, int id, const QString &path);
+    void fileImported(int cameraIndex, const QString &cameraPath, const QString &fileName);
     void imageCaptured(int cameraIndex, int id, const QByteArray &imageData,
                        const QString &format, const QString &fileName);
+    void imageFileCaptured(int cameraIndex, int id, const QString &tempFileName,
+                           const QString &format, const QString &fileName);
     void imageCaptureError(int cameraIndex, int id, int errorCode, const QString &errorString);
+    void importFinished(int cameraIndex, int files, int errors);
+    void importProgress(int cameraIndex, int files, int totalFiles, qint64 bytes, qint64 bytesPerSecond);
     void previewCaptured(int cameraIndex, const QImage &image);
     void readyForCaptureChanged(int cameraIndex, bool);
+    void recordingChanged(int cameraIndex, int id, bool recording);
     void stateChanged(int cameraIndex, QCamera::State);
     void statusChanged(int cameraIndex, QCamera::Status);
+    void timelapseShotTriggered(int cameraIndex, int id, int shot, qint64 plannedNsecs, qint64 actualNsecs);
+    void transferFinished(int cameraIndex, int id, qint64 bytes, qint64 bytesPerSecond);
+    void transferProgress(int cameraIndex, int id, qint64 bytes, qint64 total);
 
 private slots:
     void onCaptureModeChanged(int cameraIndex, QCamera::CaptureModes captureMode);
@@ -62,6 +101,12 @@ private slots:
 private:
     Q_DISABLE_COPY(GPhotoController)
 
+    /// Posts the call to worker thread, accounting it in the worker queue depth
+    template <typename... Args>
+    void invokeWorker(const char *method, int cameraIndex, Qt::ConnectionType type, Args... args) const;
+
+    // Outlives the worker, which updates it till the very end
+    std::unique_ptr<GPhotoMetrics> m_metrics;
     std::unique_ptr<QThread> m_workerThread;
     std::unique_ptr<GPhotoWorker> m_worker;
 
@@ -0,0 +1,125 @@
+#include "gphotodevicebackend.h"
+
+GPhotoDeviceBackend::GPhotoDeviceBackend(GPContext *context, const CameraAbilities &abilities,
+                                         const GPPortInfo &portInfo)
+    : m_context(context)
+    , m_abilities(abilities)
+    , m_portInfo(portInfo)
+    , m_camera(nullptr, gp_camera_free)
+{
+}
+
+GPhotoDeviceBackend::~GPhotoDeviceBackend()
+{
+    close();
+}
+
+bool GPhotoDeviceBackend::open(QString *errorText)
+{
+    // Create camera object
+    Camera *camera;
+    auto ret = gp_camera_new(&camera);
+    if (ret != GP_OK) {
+        *errorText = QLatin1String("Unable to open camera");
+        return false;
+    }
+
+    auto cameraPtr = CameraPtr(camera, gp_camera_free);
+
+    ret = gp_camera_set_abilities(camera, m_abilities);
+    if (ret < GP_OK) {
+        *errorText = QLatin1String("Unable to set abilities for camera");
+        return false;
+    }
+
+    ret = gp_camera_set_port_info(camera, m_portInfo);
+    if (ret < GP_OK) {
+        *errorText = QLatin1String("Unable to set port info for camera");
+        return false;
+    }
+
+    m_camera = std::move(cameraPtr);
+    return true;
+}
+
+void GPhotoDeviceBackend::close()
+{
+    // Camera is already closed
+    if (!m_camera)
+        return;
+
+    gp_camera_exit(m_camera.get(), m_context);
+    m_camera.reset();
+}
+
+bool GPhotoDeviceBackend::isOpen() const
+{
+    return bool(m_camera);
+}
+
+int GPhotoDeviceBackend::init()
+{
+    return gp_camera_init(m_camera.get(), m_context);
+}
+
+int GPhotoDeviceBackend::getConfig(CameraWidget **root)
+{
+    return gp_camera_get_config(m_camera.get(), root, m_context);
+}
+
+int GPhotoDeviceBackend::setConfig(CameraWidget *root)
+{
+    return gp_camera_set_config(m_camera.get(), root, m_context);
+}
+
+int GPhotoDeviceBackend::pressButton(CameraWidget *button)
+{
+    // Value of a button is the callback doing its action
+    CameraWidgetCallback callback = nullptr;
+    auto ret = gp_widget_get_value(button, &callback);
+    if (ret < GP_OK)
+        return ret;
+
+    return callback ? callback(m_camera.get(), button, m_context) : GP_ERROR_NOT_SUPPORTED;
+}
+
+int GPhotoDeviceBackend::capturePreview(CameraFile *file)
+{
+    return gp_camera_capture_preview(m_camera.get(), file, m_context);
+}
+
+int GPhotoDeviceBackend::triggerCapture()
+{
+    return gp_camera_trigger_capture(m_camera.get(), m_context);
+}
+
+int GPhotoDeviceBackend::waitForEvent(int timeout, CameraEventType *type, void **data)
+{
+    return gp_camera_wait_for_event(m_camera.get(), timeout, type, data, m_context);
+}
+
+int GPhotoDeviceBackend::fileGet(const char *folder, const char *name, CameraFileType type, CameraFile *file)
+{
+    return gp_camera_file_get(m_camera.get(), folder, name, type, file, m_context);
+}
+
+int GPhotoDeviceBackend::fileRead(const char *folder, const char *name, CameraFileType type, uint64_t offset,
+                                  char *buffer, uint64_t *size)
+{
+    return gp_camera_file_read(m_camera.get(), folder, name, type, offset, buffer, size, m_context);
+}
+
+int GPhotoDeviceBackend::fileGetInfo(const char *folder, const char *name, CameraFileInfo *info)
+{
+    return gp_camera_file_get_info(m_camera.get(), folder, name, info, m_context);
+}
+
+int GPhotoDeviceBackend::folderListFiles(const char *folder, CameraList *list)
+{
+    return gp_camera_folder_list_files(m_camera.get(), folder, list, m_context);
+}
+
+int GPhotoDeviceBackend::folderListFolders(const char *folder, CameraList *list)
+{
+    return gp_camera_folder_list_folders(m_camera.get(), folder, list, m_context);
+}
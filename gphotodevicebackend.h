@@ -0,0 +1,52 @@
+#ifndef GPHOTODEVICEBACKEND_H
+#define GPHOTODEVICEBACKEND_H
+
+#include <memory>
+
+#include <gphoto2/gphoto2-abilities-list.h>
+#include <gphoto2/gphoto2-port-info-list.h>
+
+#include "gphotobackend.h"
+
+using CameraPtr = std::unique_ptr<Camera, int (*)(Camera*)>;
+
+/// Backend talking to a real camera through libgphoto2
+class GPhotoDeviceBackend final : public GPhotoBackend
+{
+public:
+    GPhotoDeviceBackend(GPContext *context, const CameraAbilities &abilities, const GPPortInfo &portInfo);
+    ~GPhotoDeviceBackend();
+
+    GPhotoDeviceBackend(GPhotoDeviceBackend&&) = delete;
+    GPhotoDeviceBackend& operator=(GPhotoDeviceBackend&&) = delete;
+
+    bool open(QString *errorText) final;
+    void close() final;
+    bool isOpen() const final;
+
+    int init() final;
+
+    int getConfig(CameraWidget **root) final;
+    int setConfig(CameraWidget *root) final;
+    int pressButton(CameraWidget *button) final;
+
+    int capturePreview(CameraFile *file) final;
+    int triggerCapture() final;
+    int waitForEvent(int timeout, CameraEventType *type, void **data) final;
+    int fileGet(const char *folder, const char *name, CameraFileType type, CameraFile *file) final;
+    int fileRead(const char *folder, const char *name, CameraFileType type, uint64_t offset,
+                 char *buffer, uint64_t *size) final;
+    int fileGetInfo(const char *folder, const char *name, CameraFileInfo *info) final;
+    int folderListFiles(const char *folder, CameraList *list) final;
+    int folderListFolders(const char *folder, CameraList *list) final;
+
+private:
+    Q_DISABLE_COPY(GPhotoDeviceBackend)
+
+    GPContext *const m_context;
+    CameraAbilities m_abilities;
+    GPPortInfo m_portInfo;
+    CameraPtr m_camera;
+};
+
+#endif // GPHOTODEVICEBACKEND_H
@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <iterator>
+
 #include "gphotocamerasession.h"
 #include "gphotoexposurecontrol.h"
 
@@ -6,6 +9,38 @@ namespace {
     constexpr auto exposureCompensationParameter = "exposurecompensation";
     constexpr auto isoParameter = "iso";
     constexpr auto shutterSpeedParameter = "shutterspeed";
+
+    // Camera reports a change of several properties with a burst of events
+    constexpr auto refreshDelay = 50;
+
+    using ExposureParameters = QList<QCameraExposureControl::ExposureParameter>;
+
+    const ExposureParameters& basicParameters()
+    {
+        static const ExposureParameters parameters{QCameraExposureControl::Aperture,
+                                                   QCameraExposureControl::ExposureCompensation,
+                                                   QCameraExposureControl::ISO,
+                                                   QCameraExposureControl::ShutterSpeed};
+        return parameters;
+    }
+
+    /// Parameters changed by a property change event, all the basic ones when it doesn't name the property
+    ExposureParameters changedParameters(const GPhotoCamera::CameraEvent &event)
+    {
+        if (event.property.isEmpty())
+            return basicParameters();
+
+        if (QLatin1String(apertureParameter) == event.property)
+            return {QCameraExposureControl::Aperture};
+        if (QLatin1String(exposureCompensationParameter) == event.property)
+            return {QCameraExposureControl::ExposureCompensation};
+        if (QLatin1String(isoParameter) == event.property)
+            return {QCameraExposureControl::ISO};
+        if (QLatin1String(shutterSpeedParameter) == event.property)
+            return {QCameraExposureControl::ShutterSpeed};
+
+        return {};
+    }
 }
 
 GPhotoExposureControl::GPhotoExposureControl(GPhotoCameraSession *session, QObject *parent)
@@ -17,7 +52,13 @@ GPhotoExposureControl::GPhotoExposureControl(GPhotoCameraSession *session, QObje
     using Session = GPhotoCameraSession;
     using Control = GPhotoExposureControl;
 
+    m_refreshTimer.setSingleShot(true);
+    m_refreshTimer.setInterval(refreshDelay);
+
     connect(m_session, &Session::stateChanged, this, &Control::stateChanged);
+    connect(m_session, &Session::cameraEvent, this, &Control::cameraEvent);
+    connect(m_session, &Session::cameraChanged, this, &Control::cameraChanged);
+    connect(&m_refreshTimer, &QTimer::timeout, this, &Control::refresh);
 }
 
 QVariant GPhotoExposureControl::actualValue(QCameraExposureControl::ExposureParameter parameter) const
@@ -25,6 +66,15 @@ QVariant GPhotoExposureControl::actualValue(QCameraExposureControl::ExposurePara
     if (QCamera::UnloadedState == m_state)
         return QVariant();
 
+    auto it = m_actualValues.constFind(parameter);
+    if (m_actualValues.cend() == it)
+        it = m_actualValues.insert(parameter, readActualValue(parameter));
+
+    return it.value();
+}
+
+QVariant GPhotoExposureControl::readActualValue(QCameraExposureControl::ExposureParameter parameter) const
+{
     if (Aperture == parameter) {
         const auto &value = m_session->parameter(QLatin1String(apertureParameter));
         auto ok = false;
@@ -51,6 +101,10 @@ QVariant GPhotoExposureControl::actualValue(QCameraExposureControl::ExposurePara
     if (ShutterSpeed == parameter)
         return convertShutterSpeed(m_session->parameter(QLatin1String(shutterSpeedParameter)).toString());
 
+    // All the camera settings by name
+    if (ExtendedExposureParameter == parameter)
+        return m_session->parameter(QString());
+
     return QVariant();
 }
 
@@ -78,7 +132,7 @@ bool GPhotoExposureControl::isParameterSupported(QCameraExposureControl::Exposur
     case QCameraExposureControl::MeteringMode:
         return false;
     case QCameraExposureControl::ExtendedExposureParameter:
-        return false;
+        return true;
     }
 
     return false;
@@ -92,7 +146,16 @@ QVariant GPhotoExposureControl::requestedValue(QCameraExposureControl::ExposureP
 
 bool GPhotoExposureControl::setValue(QCameraExposureControl::ExposureParameter parameter, const QVariant &value)
 {
-    m_requestedValues[parameter] = value;
+    if (ExtendedExposureParameter == parameter) {
+        // Extended settings are requested a few at a time, they add up
+        auto requested = m_requestedValues.value(parameter).toMap();
+        const auto &values = value.toMap();
+        for (auto it = values.cbegin(); values.cend() != it; ++it)
+            requested.insert(it.key(), it.value());
+        m_requestedValues[parameter] = requested;
+    } else {
+        m_requestedValues[parameter] = value;
+    }
     emit requestedValueChanged(parameter);
 
     // Try to set parameters only on loaded camera
@@ -100,46 +163,44 @@ bool GPhotoExposureControl::setValue(QCameraExposureControl::ExposureParameter p
         return false;
 
     if (Aperture == parameter) {
-        if (m_session->setParameter(QLatin1String(apertureParameter), value)) {
-            emit actualValueChanged(parameter);
-            return true;
-        }
+        if (m_session->setParameter(QLatin1String(apertureParameter), value))
+            return updateActualValue(parameter);
     } else if (ExposureCompensation == parameter) {
-        if (m_session->setParameter(QLatin1String(exposureCompensationParameter), value)) {
-            emit actualValueChanged(parameter);
-            return true;
-        }
+        if (m_session->setParameter(QLatin1String(exposureCompensationParameter), value))
+            return updateActualValue(parameter);
     } else if (ISO == parameter) {
         QVariant v = value;
         if (!v.isValid())
             v = -1;
-        if (m_session->setParameter(QLatin1String(isoParameter), v)) {
-            emit actualValueChanged(parameter);
-            return true;
-        }
+        if (m_session->setParameter(QLatin1String(isoParameter), v))
+            return updateActualValue(parameter);
     } else if (ShutterSpeed == parameter) {
         if (QVariant::Double == value.type())  {
-            const auto &values = m_session->parameterValues(QLatin1String(shutterSpeedParameter), QMetaType::QString);
-            const auto &speeds = convertShutterSpeeds(values, false);
-            if (values.size() == speeds.size()) {
-                auto speed = value.toDouble();
-                const auto &found = std::find_if(speeds.cbegin(), speeds.cend(), [speed] (const QVariant &val)
-                {
-                    return qFuzzyCompare(speed, val.toDouble());
-                });
-
-                if (speeds.cend() != found) {
-                    auto index = int(std::distance(speeds.cbegin(), found));
-                    if (0 <= index) {
-                        const auto &value = values.value(index);
-                        if (m_session->setParameter(QLatin1String(shutterSpeedParameter), value)) {
-                            emit actualValueChanged(parameter);
-                            return true;
-                        }
-                    }
-                }
+            // Loads the camera strings of the speeds too
+            supportedParameterRange(parameter, nullptr);
+
+            auto speed = value.toDouble();
+            const auto &found = std::find_if(m_shutterSpeeds.cbegin(), m_shutterSpeeds.cend(), [speed] (const QVariant &val)
+            {
+                return qFuzzyCompare(speed, val.toDouble());
+            });
+
+            if (m_shutterSpeeds.cend() != found) {
+                auto index = int(std::distance(m_shutterSpeeds.cbegin(), found));
+                const auto &choice = m_shutterSpeedChoices.value(index);
+                if (m_session->setParameter(QLatin1String(shutterSpeedParameter), choice))
+                    return updateActualValue(parameter);
             }
         }
+    } else if (ExtendedExposureParameter == parameter) {
+        // Any camera setting by its gphoto name, e.g. {"capturetarget": "Memory card"}
+        const auto &values = value.toMap();
+        auto ok = !values.isEmpty();
+        for (auto it = values.cbegin(); values.cend() != it; ++it)
+            ok = m_session->setParameter(it.key(), it.value()) && ok;
+
+        updateActualValue(parameter);
+        return ok;
     } else {
         qWarning() << "GPhoto: Currently unsupported parameter" << parameter << "change requested";
     }
@@ -152,6 +213,18 @@ QVariantList GPhotoExposureControl::supportedParameterRange(QCameraExposureContr
     if (nullptr != continuous)
         *continuous = false;
 
+    if (QCamera::UnloadedState == m_state)
+        return {};
+
+    auto it = m_ranges.constFind(parameter);
+    if (m_ranges.cend() == it)
+        it = m_ranges.insert(parameter, readParameterRange(parameter));
+
+    return it.value();
+}
+
+QVariantList GPhotoExposureControl::readParameterRange(QCameraExposureControl::ExposureParameter parameter) const
+{
     switch (parameter) {
     case Aperture:
         return m_session->parameterValues(QLatin1String(apertureParameter), QMetaType::Double);
@@ -159,13 +232,65 @@ QVariantList GPhotoExposureControl::supportedParameterRange(QCameraExposureContr
         return m_session->parameterValues(QLatin1String(exposureCompensationParameter), QMetaType::Double);
     case ISO:
         return m_session->parameterValues(QLatin1String(isoParameter), QMetaType::Int);
-    case ShutterSpeed:
-        return convertShutterSpeeds(m_session->parameterValues(QLatin1String(shutterSpeedParameter), QMetaType::QString));
+    case ShutterSpeed: {
+        // Strings are parsed once, setValue() maps the speeds back to them
+        m_shutterSpeedChoices = m_session->parameterValues(QLatin1String(shutterSpeedParameter), QMetaType::QString);
+        m_shutterSpeeds = convertShutterSpeeds(m_shutterSpeedChoices, false);
+
+        QVariantList speeds;
+        std::copy_if(m_shutterSpeeds.cbegin(), m_shutterSpeeds.cend(), std::back_inserter(speeds), [] (const QVariant &speed) {
+            return speed.isValid();
+        });
+        return speeds;
+    }
     default:
         return {};
     }
 }
 
+bool GPhotoExposureControl::updateActualValue(QCameraExposureControl::ExposureParameter parameter)
+{
+    const auto &previous = m_actualValues.take(parameter);
+    if (actualValue(parameter) != previous)
+        emit actualValueChanged(parameter);
+
+    // Camera may adjust the other parameters too, e.g. available shutter speeds depend on the mode
+    markStale(basicParameters());
+    if (!m_staleParameters.isEmpty())
+        m_refreshTimer.start();
+    return true;
+}
+
+void GPhotoExposureControl::updateExtendedValue(const QString &name, const QString &value)
+{
+    auto it = m_actualValues.find(ExtendedExposureParameter);
+    if (m_actualValues.end() == it)
+        return;
+
+    auto values = it.value().toMap();
+    auto found = values.find(name);
+    if (values.end() == found)
+        return;
+
+    // Camera reports a string, the settings keep the type of their widgets
+    QVariant converted(value);
+    if (!converted.convert(found.value().userType()) || converted == found.value())
+        return;
+
+    found.value() = converted;
+    it.value() = values;
+    emit actualValueChanged(ExtendedExposureParameter);
+}
+
+void GPhotoExposureControl::markStale(const QList<QCameraExposureControl::ExposureParameter> &parameters)
+{
+    // Only the cached values are compared, the rest wasn't read by anybody yet
+    for (auto parameter : parameters) {
+        if ((m_actualValues.contains(parameter) || m_ranges.contains(parameter)) && !m_staleParameters.contains(parameter))
+            m_staleParameters.append(parameter);
+    }
+}
+
 void GPhotoExposureControl::stateChanged(QCamera::State state)
 {
     if (m_state != state) {
@@ -188,6 +313,60 @@ void GPhotoExposureControl::stateChanged(QCamera::State state)
         } else {
             m_state = state;
         }
+
+        // Camera could be reconfigured while it was unloaded
+        if (QCamera::UnloadedState == m_state) {
+            m_refreshTimer.stop();
+            m_staleParameters.clear();
+            m_actualValues.clear();
+            m_ranges.clear();
+        }
+    }
+}
+
+void GPhotoExposureControl::cameraEvent(const GPhotoCamera::CameraEvent &event)
+{
+    if (!event.isPropertyChange() || QCamera::UnloadedState == m_state)
+        return;
+
+    if (!event.property.isEmpty())
+        updateExtendedValue(event.property, event.value);
+
+    markStale(changedParameters(event));
+    if (!m_staleParameters.isEmpty() && !m_refreshTimer.isActive())
+        m_refreshTimer.start();
+}
+
+void GPhotoExposureControl::cameraChanged()
+{
+    // Values of another camera are compared like the changed ones, only the differences are reported
+    markStale(m_actualValues.keys());
+    markStale(m_ranges.keys());
+    refresh();
+}
+
+void GPhotoExposureControl::refresh()
+{
+    m_refreshTimer.stop();
+
+    const auto parameters = m_staleParameters;
+    m_staleParameters.clear();
+
+    if (QCamera::UnloadedState == m_state)
+        return;
+
+    for (auto parameter : parameters) {
+        if (m_ranges.contains(parameter)) {
+            const auto &range = m_ranges.take(parameter);
+            if (supportedParameterRange(parameter, nullptr) != range)
+                emit parameterRangeChanged(parameter);
+        }
+
+        if (m_actualValues.contains(parameter)) {
+            const auto &value = m_actualValues.take(parameter);
+            if (actualValue(parameter) != value)
+                emit actualValueChanged(parameter);
+        }
     }
 }
 
@@ -2,9 +2,21 @@
 #define GPHOTOEXPOSURECONTROL_H
 
 #include <QCameraExposureControl>
+#include <QTimer>
+
+#include "gphotocamera.h"
 
 class GPhotoCameraSession;
 
+/** Exposure parameters of the session camera.
+ *
+ * Values and ranges are read from the camera once and cached, so bindings
+ * reading them over and over cause no USB traffic. A property change event
+ * refreshes only the cached parameter it names, or all the basic ones when
+ * the driver doesn't name it, and the change signals are emitted only for
+ * the values and ranges which really changed. Extended settings take the
+ * values reported by the events, they're never read again in full.
+ */
 class GPhotoExposureControl final : public QCameraExposureControl
 {
     Q_OBJECT
@@ -23,15 +35,32 @@ public:
 
 private slots:
     void stateChanged(QCamera::State);
+    void cameraEvent(const GPhotoCamera::CameraEvent &event);
+    void cameraChanged();
+    void refresh();
 
 private:
     Q_DISABLE_COPY(GPhotoExposureControl)
 
+    QVariant readActualValue(ExposureParameter parameter) const;
+    QVariantList readParameterRange(ExposureParameter parameter) const;
+    bool updateActualValue(ExposureParameter parameter);
+    void updateExtendedValue(const QString &name, const QString &value);
+    /// Cached values and ranges of @p parameters are read again by the next refresh()
+    void markStale(const QList<ExposureParameter> &parameters);
+
     static QVariant convertShutterSpeed(const QVariant &value);
     static QVariantList convertShutterSpeeds(const QVariantList &values, bool removeInvalids = true);
 
     GPhotoCameraSession *const m_session;
     QMap<QCameraExposureControl::ExposureParameter, QVariant> m_requestedValues;
+    mutable QMap<QCameraExposureControl::ExposureParameter, QVariant> m_actualValues;
+    mutable QMap<QCameraExposureControl::ExposureParameter, QVariantList> m_ranges;
+    // Camera strings of shutter speeds and their values, in the same order
+    mutable QVariantList m_shutterSpeedChoices;
+    mutable QVariantList m_shutterSpeeds;
+    QList<QCameraExposureControl::ExposureParameter> m_staleParameters;
+    QTimer m_refreshTimer;
 
     QCamera::State m_state;
 };
@@ -0,0 +1,166 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <QDebug>
+#include <QThread>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "gphotofilewriter.h"
+#ifdef HAVE_LIBURING
+#include "gphotouringwriter.h"
+#endif
+
+namespace {
+    constexpr auto writerEnvironmentVariable = "GPHOTO_WRITER";
+    constexpr auto maxPwriteThreads = 4;
+
+    /// Writes files the way QFile does, kept for comparison and odd file systems
+    class BufferedWriter final : public GPhotoFileWriter
+    {
+    public:
+        bool write(int fd, const QByteArray &data) final
+        {
+            qint64 written = 0;
+            while (written < data.size()) {
+                auto ret = ::pwrite(fd, data.constData() + written, size_t(data.size() - written), off_t(written));
+                if (ret < 0 && EINTR == errno)
+                    continue;
+                if (ret <= 0)
+                    return false;
+                written += ret;
+            }
+
+            return true;
+        }
+
+        int concurrency() const final
+        {
+            return 1;
+        }
+
+        QString name() const final
+        {
+            return QStringLiteral("buffered");
+        }
+    };
+}
+
+constexpr qint64 GPhotoPwriteWriter::alignment;
+constexpr qint64 GPhotoPwriteWriter::chunkSize;
+
+std::unique_ptr<GPhotoFileWriter> GPhotoFileWriter::create()
+{
+    const auto &requested = QString::fromLocal8Bit(qgetenv(writerEnvironmentVariable));
+
+    if (QLatin1String("buffered") == requested)
+        return std::unique_ptr<GPhotoFileWriter>(new BufferedWriter());
+
+#ifdef HAVE_LIBURING
+    if (requested.isEmpty() || QLatin1String("uring") == requested) {
+        // Kernel may be too old or have io_uring disabled
+        if (auto writer = GPhotoUringWriter::create())
+            return std::move(writer);
+    }
+#else
+    if (QLatin1String("uring") == requested)
+        qWarning() << "GPhoto: Built without io_uring support, using pwrite";
+#endif
+
+    if (!requested.isEmpty() && QLatin1String("uring") != requested && QLatin1String("pwrite") != requested)
+        qWarning() << "GPhoto: Unknown writer" << requested;
+
+    return std::unique_ptr<GPhotoFileWriter>(new GPhotoPwriteWriter());
+}
+
+GPhotoPwriteWriter::GPhotoPwriteWriter(bool direct)
+    : m_direct(direct)
+{
+}
+
+bool GPhotoPwriteWriter::write(int fd, const QByteArray &data)
+{
+    qint64 written = 0;
+    auto aligned = alignedSize(data.size());
+
+    if (m_direct && 0 < aligned && setDirect(fd, true)) {
+        // O_DIRECT needs aligned memory, so the data goes through a bounce buffer
+        void *buffer = nullptr;
+        if (0 == ::posix_memalign(&buffer, size_t(alignment), size_t(chunkSize))) {
+            while (written < aligned) {
+                auto chunk = qMin(chunkSize, aligned - written);
+                memcpy(buffer, data.constData() + written, size_t(chunk));
+
+                auto ret = ::pwrite(fd, buffer, size_t(chunk), off_t(written));
+                if (ret < 0 && EINTR == errno)
+                    continue;
+                if (ret != chunk)
+                    break;
+
+                written += chunk;
+            }
+
+            free(buffer);
+        }
+
+        setDirect(fd, false);
+    }
+
+    // Unaligned tail or everything, if direct writes are not possible
+    return writeBuffered(fd, data.constData() + written, data.size() - written, written);
+}
+
+int GPhotoPwriteWriter::concurrency() const
+{
+    return qBound(1, QThread::idealThreadCount(), maxPwriteThreads);
+}
+
+QString GPhotoPwriteWriter::name() const
+{
+    return m_direct ? QStringLiteral("pwrite+direct") : QStringLiteral("pwrite");
+}
+
+bool GPhotoPwriteWriter::writeBuffered(int fd, const char *data, qint64 size, qint64 offset)
+{
+    qint64 written = 0;
+    while (written < size) {
+        auto ret = ::pwrite(fd, data + written, size_t(size - written), off_t(offset + written));
+        if (ret < 0 && EINTR == errno)
+            continue;
+        if (ret <= 0)
+            return false;
+        written += ret;
+    }
+
+#ifdef Q_OS_LINUX
+    // Dirty pages can't be dropped, so writeback is started first
+    if (0 < size) {
+        ::sync_file_range(fd, off_t(offset), off_t(size), SYNC_FILE_RANGE_WRITE);
+        ::posix_fadvise(fd, off_t(offset), off_t(size), POSIX_FADV_DONTNEED);
+    }
+#endif
+
+    return true;
+}
+
+bool GPhotoPwriteWriter::setDirect(int fd, bool direct)
+{
+#ifdef O_DIRECT
+    auto flags = ::fcntl(fd, F_GETFL);
+    if (flags < 0)
+        return false;
+
+    flags = direct ? (flags | O_DIRECT) : (flags & ~O_DIRECT);
+    return 0 == ::fcntl(fd, F_SETFL, flags);
+#else
+    Q_UNUSED(fd)
+    return !direct;
+#endif
+}
+
+qint64 GPhotoPwriteWriter::alignedSize(qint64 size)
+{
+    return size - size % alignment;
+}
@@ -0,0 +1,81 @@
+#ifndef GPHOTOFILEWRITER_H
+#define GPHOTOFILEWRITER_H
+
+#include <memory>
+
+#include <QByteArray>
+#include <QString>
+
+/** Writes captured files to disk.
+ *
+ * Captured files are written once and not read again by us, so writers keep
+ * them out of the page cache where they can: the block aligned bulk of a file
+ * is written with O_DIRECT from aligned buffers and the cached rest is dropped
+ * after writeback, so bursts from several cameras don't evict the working set.
+ *
+ * Set GPHOTO_WRITER environment variable to "uring", "pwrite" or "buffered"
+ * to force a writer, by default io_uring is used where it's available.
+ */
+class GPhotoFileWriter
+{
+public:
+    virtual ~GPhotoFileWriter() = default;
+
+    /** Writes the whole @p data at the beginning of the open file.
+     *
+     * Called from several threads at once when concurrency() is above one.
+     * Sets errno on failure.
+     */
+    virtual bool write(int fd, const QByteArray &data) = 0;
+
+    /// Number of files worth writing at once
+    virtual int concurrency() const = 0;
+
+    virtual QString name() const = 0;
+
+    /// The best writer for this system and environment
+    static std::unique_ptr<GPhotoFileWriter> create();
+
+protected:
+    GPhotoFileWriter() = default;
+
+private:
+    Q_DISABLE_COPY(GPhotoFileWriter)
+};
+
+/// Positional writes from several threads, the fallback where io_uring is missing
+class GPhotoPwriteWriter final : public GPhotoFileWriter
+{
+public:
+    /// @p direct bypasses page cache for the aligned part of every file
+    explicit GPhotoPwriteWriter(bool direct = true);
+    ~GPhotoPwriteWriter() = default;
+
+    GPhotoPwriteWriter(GPhotoPwriteWriter&&) = delete;
+    GPhotoPwriteWriter& operator=(GPhotoPwriteWriter&&) = delete;
+
+    bool write(int fd, const QByteArray &data) final;
+    int concurrency() const final;
+    QString name() const final;
+
+    /** Writes @p size bytes from @p offset on with plain pwrite() calls,
+     * then drops the written pages from the page cache.
+     */
+    static bool writeBuffered(int fd, const char *data, qint64 size, qint64 offset);
+
+    /// Turns O_DIRECT on or off for an open file, false if file system doesn't support it
+    static bool setDirect(int fd, bool direct);
+
+    /// Largest part of @p size which can be written with O_DIRECT
+    static qint64 alignedSize(qint64 size);
+
+    static constexpr qint64 alignment = 4096;
+    static constexpr qint64 chunkSize = 1024 * 1024;
+
+private:
+    Q_DISABLE_COPY(GPhotoPwriteWriter)
+
+    const bool m_direct;
+};
+
+#endif // GPHOTOFILEWRITER_H
@@ -0,0 +1,335 @@
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QTemporaryFile>
+
+#include <unistd.h>
+
+#include "gphotobackend.h"
+#include "gphotocamera.h"
+#include "gphotoimporter.h"
+#include "gphototrace.h"
+
+namespace {
+    constexpr auto writerThreadCount = 2;
+    constexpr auto maxPendingFiles = 8;
+    constexpr qint64 maxPendingBytes = 256 * 1024 * 1024;
+    constexpr qint64 maxBufferedFileSize = 32 * 1024 * 1024;
+
+    /// Writes a downloaded file to disk and reports back to the importer thread
+    class ImportWriter final : public QRunnable
+    {
+    public:
+        ImportWriter(QObject *importer, int index, const QByteArray &data, const QString &fileName)
+            : m_importer(importer)
+            , m_index(index)
+            , m_data(data)
+            , m_fileName(fileName)
+        {
+        }
+
+        void run() final
+        {
+            GPhotoTraceSpan span("importWrite");
+
+            // Interrupted import leaves no truncated files behind
+            QSaveFile file(m_fileName);
+            auto ok = file.open(QIODevice::WriteOnly) && file.write(m_data) == m_data.size() && file.commit();
+            if (!ok)
+                qWarning() << "GPhoto: Failed to write imported file" << m_fileName << ":" << file.errorString();
+
+            QMetaObject::invokeMethod(m_importer, "onFileWritten", Qt::QueuedConnection,
+                                      Q_ARG(int, m_index), Q_ARG(bool, ok));
+        }
+
+    private:
+        QObject *m_importer;
+        int m_index;
+        QByteArray m_data;
+        QString m_fileName;
+    };
+}
+
+GPhotoImporter::GPhotoImporter(GPhotoBackend *backend, GPhotoCardIndex *index, QObject *parent)
+    : QObject(parent)
+    , m_backend(backend)
+    , m_index(index)
+{
+    m_writers.setMaxThreadCount(writerThreadCount);
+}
+
+GPhotoImporter::~GPhotoImporter()
+{
+    // Writers report to us, so they must be done before we're gone
+    m_writers.waitForDone();
+}
+
+bool GPhotoImporter::start(const QString &serialNumber, const QString &destination)
+{
+    if (m_running)
+        return false;
+
+    if (!QDir().mkpath(destination)) {
+        qWarning() << "GPhoto: Unable to create import directory" << destination;
+        return false;
+    }
+
+    m_destination = destination;
+    m_files.clear();
+    m_targets.clear();
+    m_next = 0;
+    m_doneFiles = 0;
+    m_errors = 0;
+    m_bytes = 0;
+
+    // Without a serial number there's no telling one card from another, so everything is imported
+    m_importedFileName = GPhotoCardIndex::dataFileName(serialNumber, QLatin1String("imported.txt"));
+    loadImported();
+
+    m_index->load(serialNumber);
+    if (!m_index->refresh())
+        return false;
+
+    for (const auto &entry : m_index->files()) {
+        CardFile file;
+        static_cast<GPhotoCardIndex::File&>(file) = entry;
+
+        if (!m_imported.contains(key(file)))
+            m_files.append(file);
+    }
+
+    m_running = true;
+    m_timer.start();
+    emit progress(0, m_files.size(), 0, 0);
+
+    finishIfDone();
+    return true;
+}
+
+void GPhotoImporter::cancel()
+{
+    if (!m_running)
+        return;
+
+    // Files being written are finished, the rest is left for the next import
+    m_files.erase(m_files.begin() + m_next, m_files.end());
+    finishIfDone();
+}
+
+bool GPhotoImporter::isRunning() const
+{
+    return m_running;
+}
+
+bool GPhotoImporter::hasNext() const
+{
+    return m_running && m_next < m_files.size();
+}
+
+qint64 GPhotoImporter::nextFileSize() const
+{
+    return hasNext() ? m_files.at(m_next).size : 0;
+}
+
+bool GPhotoImporter::isThrottled() const
+{
+    return maxPendingFiles <= m_pendingFiles || maxPendingBytes <= m_pendingBytes;
+}
+
+void GPhotoImporter::importNext()
+{
+    if (!hasNext() || isThrottled())
+        return;
+
+    auto index = m_next++;
+    auto &cardFile = m_files[index];
+
+    GPhotoTraceSpan span("importFile");
+
+    CameraFile *file = nullptr;
+    gp_file_new(&file);
+    auto filePtr = CameraFilePtr(file, gp_file_free);
+
+    const char *data = nullptr;
+    unsigned long int size = 0;
+
+    // Files seen in events only are listed without size and time, which make the imported key
+    if (cardFile.size < 0 && updateInfo(&cardFile) && m_imported.contains(key(cardFile))) {
+        ++m_doneFiles;
+        emit progress(m_doneFiles, m_files.size(), m_bytes, 0);
+        finishIfDone();
+        return;
+    }
+
+    // Movies take gigabytes, so big files and the ones of unknown size go straight to disk
+    if (cardFile.size < 0 || maxBufferedFileSize < cardFile.size) {
+        streamFile(index);
+        return;
+    }
+
+    auto ret = m_backend->fileGet(cardFile.folder.toLatin1(), cardFile.name.toLatin1(), GP_FILE_TYPE_NORMAL, file);
+    if (GP_OK <= ret)
+        ret = gp_file_get_data_and_size(file, &data, &size);
+
+    if (GP_ERROR_FILE_NOT_FOUND == ret)
+        m_index->removeFile(cardFile.folder, cardFile.name);
+
+    if (ret < GP_OK) {
+        qWarning() << "GPhoto: Failed to import file" << cardFile.name << "from camera:" << ret;
+        ++m_errors;
+        ++m_doneFiles;
+        emit progress(m_doneFiles, m_files.size(), m_bytes, 0);
+        finishIfDone();
+        return;
+    }
+
+    cardFile.target = targetFileName(cardFile);
+    cardFile.bytes = qint64(size);
+
+    // Data is copied out of the CameraFile, so the next download can start right away
+    ++m_pendingFiles;
+    m_pendingBytes += cardFile.bytes;
+    m_writers.start(new ImportWriter(this, index, QByteArray(data, int(size)), cardFile.target));
+}
+
+void GPhotoImporter::streamFile(int index)
+{
+    auto &cardFile = m_files[index];
+    cardFile.target = targetFileName(cardFile);
+
+    // Written under a temporary name next to the target, so an interrupted import leaves no truncated files
+    const QFileInfo info(cardFile.target);
+    QTemporaryFile tempFile(info.path() + QLatin1String("/.gphoto-XXXXXX.") + info.suffix());
+    tempFile.setAutoRemove(false);
+
+    auto ok = tempFile.open();
+    if (ok) {
+        CameraFile *file = nullptr;
+        // CameraFile closes the descriptor it gets
+        gp_file_new_from_fd(&file, ::dup(tempFile.handle()));
+        auto filePtr = CameraFilePtr(file, gp_file_free);
+
+        auto ret = m_backend->fileGet(cardFile.folder.toLatin1(), cardFile.name.toLatin1(), GP_FILE_TYPE_NORMAL, file);
+        if (GP_ERROR_FILE_NOT_FOUND == ret)
+            m_index->removeFile(cardFile.folder, cardFile.name);
+
+        ok = (GP_OK <= ret);
+        if (!ok)
+            qWarning() << "GPhoto: Failed to import file" << cardFile.name << "from camera:" << ret;
+    } else {
+        qWarning() << "GPhoto: Unable to create temporary file for" << cardFile.target << ":" << tempFile.errorString();
+    }
+
+    cardFile.bytes = ok ? tempFile.size() : 0;
+    tempFile.close();
+
+    ok = ok && QFile::rename(tempFile.fileName(), cardFile.target);
+    if (!ok)
+        tempFile.remove();
+
+    // Reported like the files written by the writers
+    ++m_pendingFiles;
+    m_pendingBytes += cardFile.bytes;
+    onFileWritten(index, ok);
+}
+
+void GPhotoImporter::onFileWritten(int index, bool ok)
+{
+    const auto &cardFile = m_files.at(index);
+
+    --m_pendingFiles;
+    m_pendingBytes -= cardFile.bytes;
+    ++m_doneFiles;
+
+    if (ok) {
+        m_bytes += cardFile.bytes;
+        saveImported(key(cardFile));
+        emit fileImported(cardFile.folder + QLatin1Char('/') + cardFile.name, cardFile.target);
+    } else {
+        ++m_errors;
+    }
+
+    auto msecs = m_timer.elapsed();
+    emit progress(m_doneFiles, m_files.size(), m_bytes, (0 < msecs) ? m_bytes * 1000 / msecs : 0);
+
+    finishIfDone();
+}
+
+bool GPhotoImporter::updateInfo(CardFile *file)
+{
+    CameraFileInfo info;
+    if (m_backend->fileGetInfo(file->folder.toLatin1(), file->name.toLatin1(), &info) < GP_OK)
+        return false;
+
+    if (info.file.fields & GP_FILE_INFO_SIZE)
+        file->size = qint64(info.file.size);
+    if (info.file.fields & GP_FILE_INFO_MTIME)
+        file->mtime = qint64(info.file.mtime);
+
+    m_index->updateFile(*file);
+    return true;
+}
+
+void GPhotoImporter::loadImported()
+{
+    m_imported.clear();
+
+    QFile file(m_importedFileName);
+    if (m_importedFileName.isEmpty() || !file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return;
+
+    while (!file.atEnd()) {
+        const auto &line = QString::fromUtf8(file.readLine()).trimmed();
+        if (!line.isEmpty())
+            m_imported.insert(line);
+    }
+}
+
+void GPhotoImporter::saveImported(const QString &key)
+{
+    m_imported.insert(key);
+
+    // Appended file by file, so an interrupted import is continued where it stopped
+    QFile file(m_importedFileName);
+    if (m_importedFileName.isEmpty())
+        return;
+
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+        qWarning() << "GPhoto: Unable to save imported files list to" << m_importedFileName << ":" << file.errorString();
+        return;
+    }
+
+    file.write(key.toUtf8() + '\n');
+}
+
+QString GPhotoImporter::targetFileName(const CardFile &file)
+{
+    // Cameras number files per folder, so the same name from another folder gets the folder prefix
+    auto fileName = m_destination + QLatin1Char('/') + file.name;
+    if (m_targets.contains(fileName) || QFileInfo::exists(fileName)) {
+        fileName = m_destination + QLatin1Char('/') + file.folder.section(QLatin1Char('/'), -1)
+                   + QLatin1Char('_') + file.name;
+    }
+
+    m_targets.insert(fileName);
+    return fileName;
+}
+
+void GPhotoImporter::finishIfDone()
+{
+    if (!m_running || m_next < m_files.size() || 0 < m_pendingFiles)
+        return;
+
+    m_running = false;
+    m_index->save();
+    emit finished(m_doneFiles - m_errors, m_errors);
+}
+
+QString GPhotoImporter::key(const CardFile &file)
+{
+    return file.folder + QLatin1Char('/') + file.name + QLatin1Char('\t') + QString::number(file.size)
+           + QLatin1Char('\t') + QString::number(file.mtime);
+}
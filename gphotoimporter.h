@@ -0,0 +1,97 @@
+#ifndef GPHOTOIMPORTER_H
+#define GPHOTOIMPORTER_H
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QObject>
+#include <QSet>
+#include <QThreadPool>
+
+#include "gphotocardindex.h"
+
+class GPhotoBackend;
+
+/** Copies the files already on the camera card to a local directory.
+ *
+ * Lives in the worker thread next to its camera, which calls importNext()
+ * whenever it's idle, so viewfinder and captures keep running during
+ * the import. Downloading from the camera and writing to disk overlap:
+ * downloaded files are written by a separate thread pool while the next
+ * file is being downloaded, with the amount of data in flight bounded.
+ * Files too big to hold in memory, e.g. movies, are downloaded straight
+ * to disk instead.
+ *
+ * Files to import are taken from the card index. Imported files are remembered
+ * per camera serial number, so importing the same card again only copies
+ * the new files.
+ */
+class GPhotoImporter final : public QObject
+{
+    Q_OBJECT
+public:
+    GPhotoImporter(GPhotoBackend *backend, GPhotoCardIndex *index, QObject *parent = nullptr);
+    ~GPhotoImporter();
+
+    GPhotoImporter(GPhotoImporter&&) = delete;
+    GPhotoImporter& operator=(GPhotoImporter&&) = delete;
+
+    /// Brings the card index up to date and starts the import, false if the card can't be read
+    bool start(const QString &serialNumber, const QString &destination);
+    void cancel();
+
+    bool isRunning() const;
+    /// There are files left to download
+    bool hasNext() const;
+    /// Size of the next file as the card index knows it, 0 when it's unknown
+    qint64 nextFileSize() const;
+    /// Writer is behind, nothing should be downloaded till it catches up
+    bool isThrottled() const;
+
+    /// Downloads the next file from the card and hands it over to the writer
+    void importNext();
+
+signals:
+    void fileImported(const QString &cameraPath, const QString &fileName);
+    void progress(int files, int totalFiles, qint64 bytes, qint64 bytesPerSecond);
+    void finished(int files, int errors);
+
+private slots:
+    void onFileWritten(int index, bool ok);
+
+private:
+    Q_DISABLE_COPY(GPhotoImporter)
+
+    struct CardFile : GPhotoCardIndex::File {
+        /// Local file and amount of data downloaded, known once downloaded
+        QString target;
+        qint64 bytes = 0;
+    };
+
+    void streamFile(int index);
+    bool updateInfo(CardFile *file);
+    void loadImported();
+    void saveImported(const QString &key);
+    QString targetFileName(const CardFile &file);
+    void finishIfDone();
+    static QString key(const CardFile &file);
+
+    GPhotoBackend *m_backend;
+    GPhotoCardIndex *m_index;
+    QThreadPool m_writers;
+
+    bool m_running = false;
+    QString m_destination;
+    QString m_importedFileName;
+    QSet<QString> m_imported;
+    QSet<QString> m_targets;
+    QList<CardFile> m_files;
+    int m_next = 0;
+    int m_pendingFiles = 0;
+    qint64 m_pendingBytes = 0;
+    int m_doneFiles = 0;
+    int m_errors = 0;
+    qint64 m_bytes = 0;
+    QElapsedTimer m_timer;
+};
+
+#endif // GPHOTOIMPORTER_H
@@ -0,0 +1,179 @@
+#include "gphotocamerasession.h"
+#include "gphotomediarecordercontrol.h"
+
+namespace {
+    constexpr auto durationInterval = 1000;
+}
+
+GPhotoMediaRecorderControl::GPhotoMediaRecorderControl(GPhotoCameraSession *session, QObject *parent)
+    : QMediaRecorderControl(parent)
+    , m_session(session)
+{
+    using Session = GPhotoCameraSession;
+    using Control = GPhotoMediaRecorderControl;
+
+    connect(m_session, &Session::imageCaptureError, this, &Control::onImageCaptureError);
+    connect(m_session, &Session::imageSaved, this, &Control::onImageSaved);
+    connect(m_session, &Session::recordingChanged, this, &Control::onRecordingChanged);
+
+    m_durationTimer.setInterval(durationInterval);
+    connect(&m_durationTimer, &QTimer::timeout, this, [this] { emit durationChanged(duration()); });
+}
+
+QUrl GPhotoMediaRecorderControl::outputLocation() const
+{
+    return m_outputLocation;
+}
+
+bool GPhotoMediaRecorderControl::setOutputLocation(const QUrl &location)
+{
+    m_outputLocation = location;
+    return true;
+}
+
+QMediaRecorder::State GPhotoMediaRecorderControl::state() const
+{
+    return m_state;
+}
+
+QMediaRecorder::Status GPhotoMediaRecorderControl::status() const
+{
+    return m_status;
+}
+
+qint64 GPhotoMediaRecorderControl::duration() const
+{
+    if (QMediaRecorder::RecordingStatus == m_status && m_recordingTimer.isValid())
+        return m_recordingTimer.elapsed();
+
+    return m_duration;
+}
+
+bool GPhotoMediaRecorderControl::isMuted() const
+{
+    return false;
+}
+
+qreal GPhotoMediaRecorderControl::volume() const
+{
+    return 1.0;
+}
+
+void GPhotoMediaRecorderControl::applySettings()
+{
+}
+
+void GPhotoMediaRecorderControl::setState(QMediaRecorder::State state)
+{
+    if (m_state == state)
+        return;
+
+    switch (state) {
+    case QMediaRecorder::RecordingState: {
+        // Camera is busy with the previous movie till it's downloaded
+        if (QMediaRecorder::FinalizingStatus == m_status) {
+            emit error(QMediaRecorder::ResourceError, tr("Previous movie is still being saved"));
+            return;
+        }
+
+        const auto &fileName = m_outputLocation.isLocalFile() ? m_outputLocation.toLocalFile()
+                                                              : m_outputLocation.toString();
+
+        m_state = QMediaRecorder::RecordingState;
+        m_duration = 0;
+        m_recordingTimer.invalidate();
+        emit stateChanged(m_state);
+        setStatus(QMediaRecorder::StartingStatus);
+
+        m_id = m_session->startRecording(fileName);
+        break;
+    }
+    case QMediaRecorder::PausedState:
+        emit error(QMediaRecorder::ResourceError, tr("Camera can't pause movie recording"));
+        break;
+    case QMediaRecorder::StoppedState:
+        m_state = QMediaRecorder::StoppedState;
+        emit stateChanged(m_state);
+        setStatus(QMediaRecorder::FinalizingStatus);
+
+        m_session->stopRecording();
+        break;
+    }
+}
+
+void GPhotoMediaRecorderControl::setMuted(bool muted)
+{
+    // Audio is recorded by the camera, there's no way to change it from here
+    Q_UNUSED(muted)
+}
+
+void GPhotoMediaRecorderControl::setVolume(qreal volume)
+{
+    Q_UNUSED(volume)
+}
+
+void GPhotoMediaRecorderControl::onRecordingChanged(int id, bool recording)
+{
+    if (m_id != id)
+        return;
+
+    if (recording) {
+        m_recordingTimer.start();
+        m_durationTimer.start();
+        setStatus(QMediaRecorder::RecordingStatus);
+        return;
+    }
+
+    m_duration = duration();
+    m_durationTimer.stop();
+    emit durationChanged(m_duration);
+
+    // Camera stops the movie by itself too, e.g. when it's closed
+    if (QMediaRecorder::StoppedState != m_state) {
+        m_state = QMediaRecorder::StoppedState;
+        emit stateChanged(m_state);
+    }
+
+    setStatus(QMediaRecorder::FinalizingStatus);
+}
+
+void GPhotoMediaRecorderControl::onImageSaved(int id, const QString &fileName)
+{
+    if (m_id != id)
+        return;
+
+    emit actualLocationChanged(QUrl::fromLocalFile(fileName));
+    finish();
+}
+
+void GPhotoMediaRecorderControl::onImageCaptureError(int id, int errorCode, const QString &errorString)
+{
+    Q_UNUSED(errorCode)
+
+    if (m_id != id)
+        return;
+
+    emit error(QMediaRecorder::ResourceError, errorString);
+    finish();
+}
+
+void GPhotoMediaRecorderControl::setStatus(QMediaRecorder::Status status)
+{
+    if (m_status != status) {
+        m_status = status;
+        emit statusChanged(status);
+    }
+}
+
+void GPhotoMediaRecorderControl::finish()
+{
+    m_id = 0;
+    m_durationTimer.stop();
+
+    if (QMediaRecorder::StoppedState != m_state) {
+        m_state = QMediaRecorder::StoppedState;
+        emit stateChanged(m_state);
+    }
+
+    setStatus(QMediaRecorder::LoadedStatus);
+}
@@ -0,0 +1,66 @@
+#ifndef GPHOTOMEDIARECORDERCONTROL_H
+#define GPHOTOMEDIARECORDERCONTROL_H
+
+#include <QElapsedTimer>
+#include <QMediaRecorderControl>
+#include <QTimer>
+#include <QUrl>
+
+class GPhotoCameraSession;
+
+/** Records movies with camera's own movie mode.
+ *
+ * Camera encodes the movie itself, so there are no encoder settings
+ * and audio can't be muted. The movie file is downloaded from the card
+ * after the recording stops, the recorder is finalizing till then.
+ */
+class GPhotoMediaRecorderControl final : public QMediaRecorderControl
+{
+    Q_OBJECT
+public:
+    explicit GPhotoMediaRecorderControl(GPhotoCameraSession *session, QObject *parent = nullptr);
+    ~GPhotoMediaRecorderControl() = default;
+
+    GPhotoMediaRecorderControl(GPhotoMediaRecorderControl&&) = delete;
+    GPhotoMediaRecorderControl& operator=(GPhotoMediaRecorderControl&&) = delete;
+
+    QUrl outputLocation() const final;
+    bool setOutputLocation(const QUrl &location) final;
+
+    QMediaRecorder::State state() const final;
+    QMediaRecorder::Status status() const final;
+
+    qint64 duration() const final;
+
+    bool isMuted() const final;
+    qreal volume() const final;
+
+    void applySettings() final;
+
+public slots:
+    void setState(QMediaRecorder::State state) final;
+    void setMuted(bool muted) final;
+    void setVolume(qreal volume) final;
+
+private slots:
+    void onRecordingChanged(int id, bool recording);
+    void onImageSaved(int id, const QString &fileName);
+    void onImageCaptureError(int id, int errorCode, const QString &errorString);
+
+private:
+    Q_DISABLE_COPY(GPhotoMediaRecorderControl)
+
+    void setStatus(QMediaRecorder::Status status);
+    void finish();
+
+    GPhotoCameraSession *const m_session;
+    QUrl m_outputLocation;
+    QMediaRecorder::State m_state = QMediaRecorder::StoppedState;
+    QMediaRecorder::Status m_status = QMediaRecorder::LoadedStatus;
+    int m_id = 0;
+    qint64 m_duration = 0;
+    QElapsedTimer m_recordingTimer;
+    QTimer m_durationTimer;
+};
+
+#endif // GPHOTOMEDIARECORDERCONTROL_H
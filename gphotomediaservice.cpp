@@ -5,6 +5,7 @@
 #include "gphotocameralockcontrol.h"
 #include "gphotocamerasession.h"
 #include "gphotoexposurecontrol.h"
+#include "gphotomediarecordercontrol.h"
 #include "gphotomediaservice.h"
 #include "gphotovideoinputdevicecontrol.h"
 #include "gphotovideoprobecontrol.h"
@@ -40,6 +41,9 @@ QMediaControl *GPhotoMediaService::requestControl(const char *name)
     if (qstrcmp(name, QCameraLocksControl_iid) == 0)
         return new GPhotoCameraLockControl(m_session.get(), this);
 
+    if (qstrcmp(name, QMediaRecorderControl_iid) == 0)
+        return new GPhotoMediaRecorderControl(m_session.get(), this);
+
     if (qstrcmp(name, QMediaVideoProbeControl_iid) == 0)
         return new GPhotoVideoProbeControl(m_session.get(), this);
 
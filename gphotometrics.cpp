@@ -0,0 +1,215 @@
+#include <QDateTime>
+#include <QDebug>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QSaveFile>
+
+#include "gphotometrics.h"
+
+namespace {
+    constexpr auto dumpFileEnvironmentVariable = "GPHOTO_METRICS";
+    constexpr auto dumpIntervalEnvironmentVariable = "GPHOTO_METRICS_INTERVAL";
+    constexpr auto defaultDumpInterval = 10000;
+
+    constexpr const char *counterNames[] = {
+        "droppedFrames",
+        "previewErrors",
+        "captureErrors",
+        "downloadedBytes"
+    };
+
+    constexpr const char *timingNames[] = {
+        "previewFetch",
+        "previewDecode",
+        "previewPresent",
+        "captureFileAdded",
+        "captureDownload",
+        "captureSave",
+        "captureSync",
+        "captureApply",
+        "timelapseLateness",
+        "configGet",
+        "configSet"
+    };
+
+    static_assert(sizeof(counterNames) / sizeof(*counterNames) == GPhotoCameraMetrics::CounterCount,
+                  "Every counter needs a name");
+    static_assert(sizeof(timingNames) / sizeof(*timingNames) == GPhotoCameraMetrics::TimingCount,
+                  "Every timing needs a name");
+
+    void storeMax(QAtomicInteger<qint64> &max, qint64 value)
+    {
+        auto current = max.load();
+        while (current < value && !max.testAndSetRelaxed(current, value))
+            current = max.load();
+    }
+}
+
+void GPhotoCameraMetrics::increment(Counter counter, qint64 amount)
+{
+    m_counters[counter].fetchAndAddRelaxed(amount);
+}
+
+void GPhotoCameraMetrics::record(Timing timing, qint64 nsecs)
+{
+    auto &histogram = m_timings[timing];
+    auto usecs = qMax(nsecs / 1000, qint64(0));
+
+    auto bucket = 0;
+    while (bucket < bucketCount - 1 && (qint64(1) << bucket) <= usecs)
+        ++bucket;
+
+    histogram.count.fetchAndAddRelaxed(1);
+    histogram.sum.fetchAndAddRelaxed(usecs);
+    histogram.buckets[bucket].fetchAndAddRelaxed(1);
+    storeMax(histogram.max, usecs);
+}
+
+void GPhotoCameraMetrics::reset()
+{
+    for (auto &counter : m_counters)
+        counter.store(0);
+
+    for (auto &histogram : m_timings) {
+        histogram.count.store(0);
+        histogram.sum.store(0);
+        histogram.max.store(0);
+        for (auto &bucket : histogram.buckets)
+            bucket.store(0);
+    }
+}
+
+QJsonObject GPhotoCameraMetrics::toJson() const
+{
+    QJsonObject counters;
+    for (auto i = 0; i < CounterCount; ++i)
+        counters.insert(QLatin1String(counterNames[i]), double(m_counters[i].load()));
+
+    QJsonObject timings;
+    for (auto i = 0; i < TimingCount; ++i) {
+        const auto &histogram = m_timings[i];
+        auto count = histogram.count.load();
+        auto max = histogram.max.load();
+
+        // Percentiles are bucket upper bounds, that's precise enough to spot a slow USB link
+        auto percentile = [&](int percent) {
+            auto threshold = (count * percent + 99) / 100;
+            auto seen = qint64(0);
+            for (auto bucket = 0; bucket < bucketCount; ++bucket) {
+                seen += histogram.buckets[bucket].load();
+                if (0 < seen && threshold <= seen)
+                    return double(qMin(qint64(1) << bucket, max));
+            }
+            return double(max);
+        };
+
+        QJsonObject timing;
+        timing.insert(QLatin1String("count"), double(count));
+        timing.insert(QLatin1String("meanUs"), count ? double(histogram.sum.load()) / count : 0.0);
+        timing.insert(QLatin1String("maxUs"), double(max));
+        timing.insert(QLatin1String("p50Us"), percentile(50));
+        timing.insert(QLatin1String("p90Us"), percentile(90));
+        timing.insert(QLatin1String("p99Us"), percentile(99));
+        timings.insert(QLatin1String(timingNames[i]), timing);
+    }
+
+    // Average speed of the bus and the camera together
+    auto downloadUsecs = m_timings[CaptureDownload].sum.load();
+    auto downloadSpeed = (0 < downloadUsecs) ? double(m_counters[DownloadedBytes].load()) * 1000000 / downloadUsecs : 0.0;
+
+    QJsonObject result;
+    result.insert(QLatin1String("counters"), counters);
+    result.insert(QLatin1String("timings"), timings);
+    result.insert(QLatin1String("downloadBytesPerSecond"), downloadSpeed);
+    return result;
+}
+
+GPhotoMetrics::GPhotoMetrics(QObject *parent)
+    : QObject(parent)
+    , m_dumpFileName(QString::fromLocal8Bit(qgetenv(dumpFileEnvironmentVariable)))
+{
+    if (m_dumpFileName.isEmpty())
+        return;
+
+    auto ok = false;
+    auto interval = qEnvironmentVariableIntValue(dumpIntervalEnvironmentVariable, &ok);
+
+    connect(&m_dumpTimer, &QTimer::timeout, this, [this] { dump(m_dumpFileName); });
+    m_dumpTimer.start((ok && 0 < interval) ? interval : defaultDumpInterval);
+}
+
+GPhotoMetrics::~GPhotoMetrics()
+{
+    // Don't lose what happened since the last periodic dump
+    if (!m_dumpFileName.isEmpty())
+        dump(m_dumpFileName);
+}
+
+GPhotoCameraMetrics* GPhotoMetrics::camera(int cameraIndex)
+{
+    if (cameraIndex < 0)
+        return nullptr;
+
+    QMutexLocker locker(&m_mutex);
+
+    auto &metrics = m_cameras[cameraIndex];
+    if (!metrics)
+        metrics.reset(new GPhotoCameraMetrics);
+
+    return metrics.get();
+}
+
+void GPhotoMetrics::workerRequestQueued()
+{
+    auto depth = m_workerQueueDepth.fetchAndAddRelaxed(1) + 1;
+
+    auto max = m_workerQueueDepthMax.load();
+    while (max < depth && !m_workerQueueDepthMax.testAndSetRelaxed(max, depth))
+        max = m_workerQueueDepthMax.load();
+}
+
+void GPhotoMetrics::workerRequestDequeued()
+{
+    m_workerQueueDepth.fetchAndSubRelaxed(1);
+}
+
+QJsonObject GPhotoMetrics::snapshot() const
+{
+    QJsonArray cameras;
+    {
+        QMutexLocker locker(&m_mutex);
+        for (const auto &camera : m_cameras) {
+            auto json = camera.second->toJson();
+            json.insert(QLatin1String("index"), camera.first);
+            cameras.append(json);
+        }
+    }
+
+    QJsonObject result;
+    result.insert(QLatin1String("timestamp"), QDateTime::currentDateTimeUtc().toString(Qt::ISODate));
+    result.insert(QLatin1String("workerQueueDepth"), m_workerQueueDepth.load());
+    result.insert(QLatin1String("workerQueueDepthMax"), m_workerQueueDepthMax.load());
+    result.insert(QLatin1String("cameras"), cameras);
+    return result;
+}
+
+void GPhotoMetrics::reset()
+{
+    m_workerQueueDepthMax.store(m_workerQueueDepth.load());
+
+    QMutexLocker locker(&m_mutex);
+    for (const auto &camera : m_cameras)
+        camera.second->reset();
+}
+
+bool GPhotoMetrics::dump(const QString &fileName) const
+{
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "GPhoto: Unable to write metrics to" << fileName << ":" << file.errorString();
+        return false;
+    }
+
+    file.write(QJsonDocument(snapshot()).toJson());
+    return file.commit();
+}
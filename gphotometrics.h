@@ -0,0 +1,121 @@
+#ifndef GPHOTOMETRICS_H
+#define GPHOTOMETRICS_H
+
+#include <array>
+#include <map>
+#include <memory>
+
+#include <QAtomicInteger>
+#include <QJsonObject>
+#include <QMutex>
+#include <QObject>
+#include <QTimer>
+
+/** Counters and latency histograms of a single camera.
+ *
+ * Updated from worker and GUI threads with relaxed atomics only,
+ * so it's cheap enough for every viewfinder frame.
+ */
+class GPhotoCameraMetrics final
+{
+public:
+    enum Counter {
+        DroppedFrames,
+        PreviewErrors,
+        CaptureErrors,
+        DownloadedBytes,
+        CounterCount
+    };
+
+    enum Timing {
+        /// Getting viewfinder frame from camera
+        PreviewFetch,
+        /// Decoding viewfinder frame
+        PreviewDecode,
+        /// Showing viewfinder frame on the surface
+        PreviewPresent,
+        /// Capture trigger to the file appearing on camera
+        CaptureFileAdded,
+        /// Downloading captured file from camera
+        CaptureDownload,
+        /// Saving downloaded file to disk
+        CaptureSave,
+        /// Flushing saved files to disk, per file or per group commit
+        CaptureSync,
+        /// Uploading per-frame settings before the trigger, e.g. of bracketing
+        CaptureApply,
+        /// Timelapse shot trigger behind its planned time
+        TimelapseLateness,
+        ConfigGet,
+        ConfigSet,
+        TimingCount
+    };
+
+    GPhotoCameraMetrics() = default;
+
+    void increment(Counter counter, qint64 amount = 1);
+    void record(Timing timing, qint64 nsecs);
+    void reset();
+
+    QJsonObject toJson() const;
+
+private:
+    Q_DISABLE_COPY(GPhotoCameraMetrics)
+
+    /// Bucket N holds durations shorter than 2^N usecs
+    static constexpr auto bucketCount = 32;
+
+    struct Histogram {
+        QAtomicInteger<qint64> count;
+        QAtomicInteger<qint64> sum;
+        QAtomicInteger<qint64> max;
+        std::array<QAtomicInteger<qint64>, bucketCount> buckets;
+    };
+
+    std::array<QAtomicInteger<qint64>, CounterCount> m_counters;
+    std::array<Histogram, TimingCount> m_timings;
+};
+
+/** Metrics of all the cameras and the worker thread serving them.
+ *
+ * Set GPHOTO_METRICS environment variable to a file name to get the
+ * snapshot dumped there periodically, every GPHOTO_METRICS_INTERVAL msecs.
+ */
+class GPhotoMetrics final : public QObject
+{
+    Q_OBJECT
+public:
+    explicit GPhotoMetrics(QObject *parent = nullptr);
+    ~GPhotoMetrics();
+
+    GPhotoMetrics(GPhotoMetrics&&) = delete;
+    GPhotoMetrics& operator=(GPhotoMetrics&&) = delete;
+
+    /// Metrics of the camera with given index, created on the first request
+    GPhotoCameraMetrics* camera(int cameraIndex);
+
+    /// Request was posted to the worker thread
+    void workerRequestQueued();
+    /// Worker thread started processing the request
+    void workerRequestDequeued();
+
+    Q_INVOKABLE QJsonObject snapshot() const;
+    Q_INVOKABLE void reset();
+
+    /// Writes snapshot to the file, replacing it atomically
+    Q_INVOKABLE bool dump(const QString &fileName) const;
+
+private:
+    Q_DISABLE_COPY(GPhotoMetrics)
+
+    mutable QMutex m_mutex;
+    std::map<int, std::unique_ptr<GPhotoCameraMetrics>> m_cameras;
+
+    QAtomicInteger<int> m_workerQueueDepth;
+    QAtomicInteger<int> m_workerQueueDepthMax;
+
+    QTimer m_dumpTimer;
+    QString m_dumpFileName;
+};
+
+#endif // GPHOTOMETRICS_H
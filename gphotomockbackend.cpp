@@ -0,0 +1,627 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include <QAtomicInt>
+#include <QBuffer>
+#include <QColor>
+#include <QDateTime>
+#include <QDebug>
+#include <QImage>
+#include <QMutex>
+#include <QPainter>
+#include <QQueue>
+#include <QThread>
+
+#include <gphoto2/gphoto2-port-result.h>
+
+#include "gphotomockbackend.h"
+
+namespace {
+    constexpr auto mockEnvironmentVariable = "GPHOTO_MOCK";
+    constexpr auto mockFolder = "/store_00010001/DCIM/100MOCK";
+    // Never written to, it sorts after DCIM like MISC folders of real cards
+    constexpr auto mockMiscFolder = "/store_00010001/MISC";
+    constexpr auto previewFrameCount = 8;
+    constexpr auto captureWidth = 1600;
+    constexpr auto captureHeight = 1064;
+    constexpr auto jpegQuality = 85;
+    constexpr auto transferChunkSize = 1024 * 1024;
+    constexpr auto cardEpoch = 1500000000;
+    constexpr auto colorTemperatureMin = 2500.0F;
+    constexpr auto colorTemperatureMax = 10000.0F;
+    constexpr auto colorTemperatureStep = 100.0F;
+    // Times of frames nobody takes are dropped, so they don't pile up between benchmarks
+    constexpr auto maxPreviewTimestamps = 1000;
+
+    QAtomicInt configRequests;
+    QMutex previewTimestampsMutex;
+    QQueue<qint64> previewTimestamps;
+
+    QByteArray renderJpeg(const QSize &size, int index)
+    {
+        QImage image(size, QImage::Format_RGB32);
+        image.fill(QColor::fromHsv((index * 45) % 360, 128, 160));
+
+        // Moving box makes frames distinguishable
+        QPainter painter(&image);
+        auto boxSize = size.height() / 4;
+        auto x = (index * boxSize / 2) % qMax(1, size.width() - boxSize);
+        painter.fillRect(x, (size.height() - boxSize) / 2, boxSize, boxSize, Qt::white);
+        painter.end();
+
+        QByteArray data;
+        QBuffer buffer(&data);
+        buffer.open(QIODevice::WriteOnly);
+        image.save(&buffer, "JPG", jpegQuality);
+        return data;
+    }
+}
+
+GPhotoMockBackend::Settings GPhotoMockBackend::Settings::fromString(const QString &str)
+{
+    Settings settings;
+
+    for (const auto &item : str.split(QLatin1Char(';'), QString::SkipEmptyParts)) {
+        const auto &key = item.section(QLatin1Char('='), 0, 0).trimmed();
+        const auto &value = item.section(QLatin1Char('='), 1).trimmed();
+
+        if (QLatin1String("cameras") == key) {
+            settings.cameras = value.toInt();
+        } else if (QLatin1String("preview") == key) {
+            const auto &size = value.split(QLatin1Char('x'));
+            if (2 == size.size())
+                settings.preview = QSize(size.first().toInt(), size.last().toInt());
+        } else if (QLatin1String("openLatency") == key) {
+            settings.openLatency = value.toInt();
+        } else if (QLatin1String("previewLatency") == key) {
+            settings.previewLatency = value.toInt();
+        } else if (QLatin1String("configLatency") == key) {
+            settings.configLatency = value.toInt();
+        } else if (QLatin1String("exposureLatency") == key) {
+            settings.exposureLatency = value.toInt();
+        } else if (QLatin1String("transferRate") == key) {
+            settings.transferRate = value.toLongLong();
+        } else if (QLatin1String("files") == key) {
+            settings.files.clear();
+            for (const auto &file : value.split(QLatin1Char(','), QString::SkipEmptyParts)) {
+                settings.files.append(qMakePair(file.section(QLatin1Char(':'), 0, 0).toUpper().toLatin1(),
+                                                file.section(QLatin1Char(':'), 1).toLongLong()));
+            }
+        } else if (QLatin1String("captureComplete") == key) {
+            settings.captureComplete = (0 != value.toInt());
+        } else if (QLatin1String("propertyEvents") == key) {
+            settings.propertyEvents = value.toInt();
+        } else if (QLatin1String("shutterButtonInterval") == key) {
+            settings.shutterButtonInterval = value.toInt();
+        } else if (QLatin1String("cardShots") == key) {
+            settings.cardShots = value.toInt();
+        } else if (QLatin1String("movieRate") == key) {
+            settings.movieRate = value.toLongLong();
+        } else if (QLatin1String("movieLength") == key) {
+            settings.movieLength = value.toInt();
+        } else {
+            qWarning() << "GPhoto: Unknown mock camera setting" << key;
+        }
+    }
+
+    return settings;
+}
+
+GPhotoMockBackend::GPhotoMockBackend(const Settings &settings, GPContext *context)
+    : m_settings(settings)
+    , m_context(context)
+    , m_shotIndex(qMax(settings.cardShots, 0))
+{
+    auto radio = [this] (const char *name, const char *label, QList<QByteArray> choices, const char *value) {
+        m_options.append({name, label, GP_WIDGET_RADIO, std::move(choices), QByteArray(value)});
+    };
+    auto toggle = [this] (const char *name, const char *label) {
+        m_options.append({name, label, GP_WIDGET_TOGGLE, {}, 0});
+    };
+
+    radio("shutterspeed", "Shutter Speed", {"bulb", "30", "15", "8", "4", "2", "1", "0.5", "1/4", "1/8", "1/15",
+                                            "1/30", "1/60", "1/125", "1/250", "1/500", "1/1000", "1/2000", "1/4000"},
+          "1/125");
+    radio("aperture", "Aperture", {"2.8", "3.5", "4", "4.5", "5.6", "6.3", "8", "11", "16", "22"}, "5.6");
+    radio("iso", "ISO Speed", {"Auto", "100", "200", "400", "800", "1600", "3200", "6400"}, "Auto");
+    radio("exposurecompensation", "Exposure Compensation", {"-2", "-1.7", "-1.3", "-1", "-0.7", "-0.3", "0",
+                                                            "0.3", "0.7", "1", "1.3", "1.7", "2"}, "0");
+    toggle("viewfinder", "Viewfinder");
+    toggle("autofocusdrive", "Drive Canon DSLR Autofocus");
+    toggle("cancelautofocus", "Cancel Canon DSLR Autofocus");
+    toggle("movie", "Movie Capture");
+    m_options.append({"serialnumber", "Serial Number", GP_WIDGET_TEXT, {}, QByteArray("MOCK0001")});
+    m_options.append({"capturetarget", "Capture Target", GP_WIDGET_MENU, {"Internal RAM", "Memory card"},
+                      QByteArray("Memory card")});
+    m_options.append({"colortemperature", "Color Temperature", GP_WIDGET_RANGE, {}, 5500.0});
+    m_options.append({"datetime", "Camera Date and Time", GP_WIDGET_DATE, {}, cardEpoch});
+    m_options.append({"syncdatetime", "Synchronize camera date and time with PC", GP_WIDGET_BUTTON, {}, {}});
+}
+
+bool GPhotoMockBackend::isEnabled()
+{
+    return qEnvironmentVariableIsSet(mockEnvironmentVariable);
+}
+
+GPhotoMockBackend::Settings GPhotoMockBackend::environmentSettings()
+{
+    return Settings::fromString(QString::fromLocal8Bit(qgetenv(mockEnvironmentVariable)));
+}
+
+int GPhotoMockBackend::configRequestCount()
+{
+    return configRequests.load();
+}
+
+qint64 GPhotoMockBackend::clockNsecs()
+{
+    static const auto clock = [] {
+        QElapsedTimer timer;
+        timer.start();
+        return timer;
+    }();
+
+    return clock.nsecsElapsed();
+}
+
+qint64 GPhotoMockBackend::takePreviewTimestamp()
+{
+    QMutexLocker locker(&previewTimestampsMutex);
+    return previewTimestamps.isEmpty() ? -1 : previewTimestamps.dequeue();
+}
+
+bool GPhotoMockBackend::open(QString *errorText)
+{
+    Q_UNUSED(errorText)
+
+    // Frames are prepared beforehand, so the mock is never a bottleneck itself
+    if (m_previewFrames.isEmpty()) {
+        for (auto i = 0; i < previewFrameCount; ++i)
+            m_previewFrames.append(renderJpeg(m_settings.preview, i));
+
+        m_captureJpeg = renderJpeg(QSize(captureWidth, captureHeight), 0);
+    }
+
+    m_clock.start();
+    m_lastButtonShot = 0;
+    m_open = true;
+
+    // Frames of a camera opened before can't be shown anymore
+    QMutexLocker locker(&previewTimestampsMutex);
+    previewTimestamps.clear();
+    return true;
+}
+
+void GPhotoMockBackend::close()
+{
+    m_events.clear();
+    m_movieStart = -1;
+    m_initialized = false;
+    m_open = false;
+}
+
+bool GPhotoMockBackend::isOpen() const
+{
+    return m_open;
+}
+
+int GPhotoMockBackend::init()
+{
+    if (!m_open)
+        return GP_ERROR_BAD_PARAMETERS;
+
+    if (!m_initialized) {
+        delay(m_settings.openLatency);
+        m_initialized = true;
+    }
+
+    return GP_OK;
+}
+
+int GPhotoMockBackend::getConfig(CameraWidget **root)
+{
+    // Camera is connected on the first request like libgphoto2 does
+    auto ret = init();
+    if (ret < GP_OK)
+        return ret;
+
+    configRequests.ref();
+    delay(m_settings.configLatency);
+
+    CameraWidget *window = nullptr;
+    gp_widget_new(GP_WIDGET_WINDOW, "Camera and Driver Configuration", &window);
+
+    CameraWidget *section = nullptr;
+    gp_widget_new(GP_WIDGET_SECTION, "Camera Settings", &section);
+    gp_widget_set_name(section, "settings");
+    gp_widget_append(window, section);
+
+    for (const auto &option : m_options) {
+        CameraWidget *widget = nullptr;
+        gp_widget_new(option.type, option.label.constData(), &widget);
+        gp_widget_set_name(widget, option.name.constData());
+
+        for (const auto &choice : option.choices)
+            gp_widget_add_choice(widget, choice.constData());
+
+        if (GP_WIDGET_TOGGLE == option.type || GP_WIDGET_DATE == option.type) {
+            auto value = option.value.toInt();
+            gp_widget_set_value(widget, &value);
+        } else if (GP_WIDGET_RANGE == option.type) {
+            // Color temperature is the only mock range
+            auto value = option.value.toFloat();
+            gp_widget_set_range(widget, colorTemperatureMin, colorTemperatureMax, colorTemperatureStep);
+            gp_widget_set_value(widget, &value);
+        } else if (GP_WIDGET_BUTTON != option.type) {
+            gp_widget_set_value(widget, option.value.toByteArray().constData());
+        }
+
+        gp_widget_set_changed(widget, 0);
+        gp_widget_append(section, widget);
+    }
+
+    *root = window;
+    return GP_OK;
+}
+
+int GPhotoMockBackend::setConfig(CameraWidget *root)
+{
+    auto ret = init();
+    if (ret < GP_OK)
+        return ret;
+
+    configRequests.ref();
+    delay(m_settings.configLatency);
+
+    for (auto &option : m_options) {
+        CameraWidget *widget = nullptr;
+        if (gp_widget_get_child_by_name(root, option.name.constData(), &widget) < GP_OK || !gp_widget_changed(widget))
+            continue;
+
+        if (GP_WIDGET_TOGGLE == option.type || GP_WIDGET_DATE == option.type) {
+            auto value = 0;
+            gp_widget_get_value(widget, &value);
+            if ("movie" == option.name && option.value.toInt() != value)
+                setMovieRecording(0 != value);
+            option.value = value;
+        } else if (GP_WIDGET_RANGE == option.type) {
+            auto value = 0.0F;
+            gp_widget_get_value(widget, &value);
+            option.value = value;
+        } else {
+            const char *value = nullptr;
+            gp_widget_get_value(widget, &value);
+            option.value = QByteArray(value);
+        }
+
+        // Named like newer libgphoto2 drivers do it
+        const auto &text = "PTP Property d101 changed, \"" + option.name + "\" to \"" + option.value.toByteArray() + '"';
+        for (auto i = 0; i < m_settings.propertyEvents; ++i)
+            addEvent({m_clock.elapsed(), GP_EVENT_UNKNOWN, {}, {}, text});
+    }
+
+    return GP_OK;
+}
+
+int GPhotoMockBackend::pressButton(CameraWidget *button)
+{
+    auto ret = init();
+    if (ret < GP_OK)
+        return ret;
+
+    configRequests.ref();
+    delay(m_settings.configLatency);
+
+    // The only mock button sets camera clock to the host time
+    const char *name = nullptr;
+    gp_widget_get_name(button, &name);
+    auto it = std::find_if(m_options.begin(), m_options.end(), [] (const Option &option) {
+        return "datetime" == option.name;
+    });
+    if (0 != qstrcmp(name, "syncdatetime") || m_options.end() == it)
+        return GP_ERROR_NOT_SUPPORTED;
+
+    it->value = int(QDateTime::currentMSecsSinceEpoch() / 1000);
+
+    for (auto i = 0; i < m_settings.propertyEvents; ++i)
+        addEvent({m_clock.elapsed(), GP_EVENT_UNKNOWN, {}, {}, "PTP Property d102 changed"});
+
+    return GP_OK;
+}
+
+int GPhotoMockBackend::capturePreview(CameraFile *file)
+{
+    auto ret = init();
+    if (ret < GP_OK)
+        return ret;
+
+    delay(m_settings.previewLatency);
+
+    {
+        QMutexLocker locker(&previewTimestampsMutex);
+        previewTimestamps.enqueue(clockNsecs());
+        while (maxPreviewTimestamps < previewTimestamps.size())
+            previewTimestamps.dequeue();
+    }
+
+    const auto &frame = m_previewFrames.at(m_previewIndex++ % m_previewFrames.size());
+    gp_file_set_mime_type(file, GP_MIME_JPEG);
+    return gp_file_append(file, frame.constData(), static_cast<unsigned long>(frame.size()));
+}
+
+int GPhotoMockBackend::triggerCapture()
+{
+    auto ret = init();
+    if (ret < GP_OK)
+        return ret;
+
+    addShot(m_clock.elapsed() + m_settings.exposureLatency);
+
+    if (m_settings.captureComplete)
+        addEvent({m_clock.elapsed() + m_settings.exposureLatency, GP_EVENT_CAPTURE_COMPLETE, {}, {}, {}});
+
+    return GP_OK;
+}
+
+int GPhotoMockBackend::waitForEvent(int timeout, CameraEventType *type, void **data)
+{
+    auto ret = init();
+    if (ret < GP_OK)
+        return ret;
+
+    if (0 < m_settings.shutterButtonInterval
+            && m_lastButtonShot + m_settings.shutterButtonInterval <= m_clock.elapsed()) {
+        m_lastButtonShot = m_clock.elapsed();
+        addShot(m_lastButtonShot);
+    }
+
+    if (0 < m_settings.movieLength && 0 <= m_movieStart && m_movieStart + m_settings.movieLength <= m_clock.elapsed()) {
+        auto movie = std::find_if(m_options.begin(), m_options.end(), [] (const Option &option) {
+            return "movie" == option.name;
+        });
+        if (m_options.end() != movie)
+            movie->value = 0;
+
+        setMovieRecording(false);
+    }
+
+    auto waitTime = m_events.isEmpty() ? qint64(timeout) : m_events.first().due - m_clock.elapsed();
+    if (timeout < waitTime || m_events.isEmpty()) {
+        delay(timeout);
+        *type = GP_EVENT_TIMEOUT;
+        *data = nullptr;
+        return GP_OK;
+    }
+
+    delay(waitTime);
+
+    const auto event = m_events.takeFirst();
+    *type = event.type;
+    *data = nullptr;
+
+    // Caller frees event data with free() like for libgphoto2 events
+    if (GP_EVENT_FILE_ADDED == event.type) {
+        auto path = static_cast<CameraFilePath*>(calloc(1, sizeof(CameraFilePath)));
+        qstrncpy(path->folder, event.folder.constData(), sizeof(path->folder));
+        qstrncpy(path->name, event.name.constData(), sizeof(path->name));
+        *data = path;
+    } else if (GP_EVENT_UNKNOWN == event.type) {
+        *data = strdup(event.text.constData());
+    }
+
+    return GP_OK;
+}
+
+int GPhotoMockBackend::fileGet(const char *folder, const char *name, CameraFileType type, CameraFile *file)
+{
+    Q_UNUSED(folder)
+    Q_UNUSED(type)
+
+    auto ret = init();
+    if (ret < GP_OK)
+        return ret;
+
+    auto size = fileSize(name);
+    if (size < 0)
+        return GP_ERROR_FILE_NOT_FOUND;
+
+    const auto &extension = QByteArray(name).section('.', -1).toUpper();
+
+    // JPEG files are real images padded to the requested size, decoders ignore the padding
+    auto header = extension.startsWith("JP") ? m_captureJpeg.left(int(qMin(size, qint64(m_captureJpeg.size()))))
+                                             : QByteArray();
+
+    ret = gp_file_append(file, header.constData(), static_cast<unsigned long>(header.size()));
+    if (ret < GP_OK)
+        return ret;
+
+    // File arrives in chunks like from a real camera, so files streamed to disk are never held in memory
+    // and progress is reported after every chunk
+    auto progressId = m_context ? gp_context_progress_start(m_context, float(size), "%s", name) : 0u;
+    const QByteArray padding(transferChunkSize, '\0');
+
+    QElapsedTimer timer;
+    timer.start();
+
+    for (auto written = qint64(header.size()); written < size;) {
+        auto chunk = qMin(size - written, qint64(transferChunkSize));
+        ret = gp_file_append(file, padding.constData(), static_cast<unsigned long>(chunk));
+        if (ret < GP_OK)
+            break;
+
+        written += chunk;
+
+        if (0 < m_settings.transferRate)
+            delay(written * 1000 / m_settings.transferRate - timer.elapsed());
+
+        if (m_context)
+            gp_context_progress_update(m_context, progressId, float(written));
+    }
+
+    if (m_context)
+        gp_context_progress_stop(m_context, progressId);
+
+    return ret;
+}
+
+int GPhotoMockBackend::fileRead(const char *folder, const char *name, CameraFileType type, uint64_t offset,
+                                char *buffer, uint64_t *size)
+{
+    Q_UNUSED(folder)
+    Q_UNUSED(type)
+
+    auto ret = init();
+    if (ret < GP_OK)
+        return ret;
+
+    auto total = fileSize(name);
+    if (total < 0)
+        return GP_ERROR_FILE_NOT_FOUND;
+
+    // Reading past the end gives nothing, like the drivers do
+    auto chunk = (qint64(offset) < total) ? qMin(qint64(*size), total - qint64(offset)) : qint64(0);
+    memset(buffer, 0, static_cast<size_t>(chunk));
+    *size = static_cast<uint64_t>(chunk);
+
+    if (0 < m_settings.transferRate)
+        delay(chunk * 1000 / m_settings.transferRate);
+
+    return GP_OK;
+}
+
+int GPhotoMockBackend::fileGetInfo(const char *folder, const char *name, CameraFileInfo *info)
+{
+    auto ret = init();
+    if (ret < GP_OK)
+        return ret;
+
+    auto size = fileSize(name);
+    if (qstrcmp(folder, mockFolder) || size < 0)
+        return GP_ERROR_FILE_NOT_FOUND;
+
+    // Shots are a second apart, so the time stays the same over camera restarts
+    memset(info, 0, sizeof(CameraFileInfo));
+    info->file.fields = GP_FILE_INFO_SIZE | GP_FILE_INFO_MTIME;
+    info->file.size = static_cast<uint64_t>(size);
+    info->file.mtime = cardEpoch + QByteArray(name).mid(4, 4).toInt();
+    return GP_OK;
+}
+
+int GPhotoMockBackend::folderListFiles(const char *folder, CameraList *list)
+{
+    auto ret = init();
+    if (ret < GP_OK)
+        return ret;
+
+    delay(m_settings.configLatency);
+
+    if (qstrcmp(folder, mockFolder))
+        return GP_OK;
+
+    for (auto i = 1; i <= m_shotIndex; ++i) {
+        for (const auto &file : m_settings.files) {
+            const auto &name = QByteArray("IMG_") + QByteArray::number(i).rightJustified(4, '0') + '.' + file.first;
+            gp_list_append(list, name.constData(), nullptr);
+        }
+    }
+
+    for (const auto &movie : m_movies)
+        gp_list_append(list, movie.first.constData(), nullptr);
+
+    return GP_OK;
+}
+
+int GPhotoMockBackend::folderListFolders(const char *folder, CameraList *list)
+{
+    auto ret = init();
+    if (ret < GP_OK)
+        return ret;
+
+    delay(m_settings.configLatency);
+
+    // Subfolders are the next components of the mock folder paths
+    auto parent = QByteArray(folder);
+    if (!parent.endsWith('/'))
+        parent.append('/');
+
+    QList<QByteArray> names;
+    for (const auto &path : {QByteArray(mockFolder), QByteArray(mockMiscFolder)}) {
+        const auto &name = path.mid(parent.size()).section('/', 0, 0);
+        if (path.startsWith(parent) && !name.isEmpty() && !names.contains(name)) {
+            names.append(name);
+            gp_list_append(list, name.constData(), nullptr);
+        }
+    }
+
+    return GP_OK;
+}
+
+void GPhotoMockBackend::addEvent(const Event &event)
+{
+    // Events are kept sorted by time they're due to
+    auto it = std::upper_bound(m_events.begin(), m_events.end(), event, [] (const Event &a, const Event &b)
+    {
+        return a.due < b.due;
+    });
+    m_events.insert(it, event);
+}
+
+void GPhotoMockBackend::addShot(qint64 due)
+{
+    ++m_shotIndex;
+
+    for (const auto &file : m_settings.files) {
+        const auto &name = QByteArray("IMG_") + QByteArray::number(m_shotIndex).rightJustified(4, '0')
+                           + '.' + file.first;
+        addEvent({due, GP_EVENT_FILE_ADDED, mockFolder, name, {}});
+    }
+}
+
+qint64 GPhotoMockBackend::fileSize(const QByteArray &name) const
+{
+    const auto &movie = std::find_if(m_movies.cbegin(), m_movies.cend(), [&name] (const QPair<QByteArray, qint64> &file)
+    {
+        return file.first == name;
+    });
+    if (m_movies.cend() != movie)
+        return movie->second;
+
+    const auto &extension = name.section('.', -1).toUpper();
+    const auto &found = std::find_if(m_settings.files.cbegin(), m_settings.files.cend(),
+                                     [&extension] (const QPair<QByteArray, qint64> &file)
+    {
+        return file.first == extension;
+    });
+
+    return (m_settings.files.cend() == found) ? -1 : qMax(found->second, qint64(0));
+}
+
+void GPhotoMockBackend::setMovieRecording(bool recording)
+{
+    if (recording) {
+        m_movieStart = m_clock.elapsed();
+        return;
+    }
+
+    if (m_movieStart < 0)
+        return;
+
+    // Movie size grows with its length, the file shows up once the camera has written it
+    auto length = m_clock.elapsed() - m_movieStart;
+    if (0 < m_settings.movieLength)
+        length = qMin(length, qint64(m_settings.movieLength));
+
+    auto size = length * qMax(m_settings.movieRate, qint64(0)) / 1000;
+    const auto &name = QByteArray("MVI_") + QByteArray::number(m_movies.size() + 1).rightJustified(4, '0') + ".MOV";
+    m_movies.append(qMakePair(name, size));
+    m_movieStart = -1;
+
+    addEvent({m_clock.elapsed() + m_settings.exposureLatency, GP_EVENT_FILE_ADDED, mockFolder, name, {}});
+}
+
+void GPhotoMockBackend::delay(qint64 msecs) const
+{
+    if (0 < msecs)
+        QThread::msleep(static_cast<unsigned long>(msecs));
+}
@@ -0,0 +1,138 @@
+#ifndef GPHOTOMOCKBACKEND_H
+#define GPHOTOMOCKBACKEND_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QList>
+#include <QPair>
+#include <QSize>
+#include <QVariant>
+
+#include "gphotobackend.h"
+
+/** Synthetic camera for testing and benchmarking without hardware.
+ *
+ * Enabled with GPHOTO_MOCK environment variable, which is a list of
+ * key=value settings separated with semicolons, e.g.
+ * "cameras=2;preview=1280x720;files=JPG:8000000,CR2:25000000;transferRate=40000000".
+ * See Settings for the supported keys.
+ */
+class GPhotoMockBackend final : public GPhotoBackend
+{
+public:
+    struct Settings {
+        /// Number of mock cameras reported on detection
+        int cameras = 1;
+        /// Size of generated viewfinder frames
+        QSize preview{960, 640};
+        /// Delays in msecs for connecting, every viewfinder frame, config get/set and exposure
+        int openLatency = 0;
+        int previewLatency = 0;
+        int configLatency = 0;
+        int exposureLatency = 0;
+        /// Download speed in bytes per second, zero means instant
+        qint64 transferRate = 0;
+        /// Extensions and sizes of files produced by every shot
+        QList<QPair<QByteArray, qint64>> files{{"JPG", 6 * 1024 * 1024}};
+        /// Set to zero to simulate camera never reporting capture completion
+        bool captureComplete = true;
+        /// Number of property changed events reported after every config change
+        int propertyEvents = 1;
+        /// Interval in msecs for shots made with camera button, zero means never
+        int shutterButtonInterval = 0;
+        /// Number of shots on the card before the first capture
+        int cardShots = 0;
+        /// Bytes per second of recorded movies, movie file is added when recording stops
+        qint64 movieRate = 12 * 1024 * 1024;
+        /// Msecs after which the camera body stops recording by itself, like on a full card, zero means never
+        int movieLength = 0;
+
+        static Settings fromString(const QString &str);
+    };
+
+    /// Downloads report progress through @p context like the real cameras do
+    explicit GPhotoMockBackend(const Settings &settings, GPContext *context = nullptr);
+    ~GPhotoMockBackend() = default;
+
+    GPhotoMockBackend(GPhotoMockBackend&&) = delete;
+    GPhotoMockBackend& operator=(GPhotoMockBackend&&) = delete;
+
+    static bool isEnabled();
+    static Settings environmentSettings();
+
+    /// Number of config downloads and uploads made by all the mock cameras
+    static int configRequestCount();
+
+    /// Monotonic clock shared by all the threads, nsecs
+    static qint64 clockNsecs();
+
+    /** Time by clockNsecs() the oldest viewfinder frame not taken yet was produced at, -1 if there's none.
+     *
+     * Times of all the mock cameras are queued in the order the frames are produced,
+     * so a consumer showing every frame pairs each one with its own time.
+     */
+    static qint64 takePreviewTimestamp();
+
+    bool open(QString *errorText) final;
+    void close() final;
+    bool isOpen() const final;
+
+    int init() final;
+
+    int getConfig(CameraWidget **root) final;
+    int setConfig(CameraWidget *root) final;
+    int pressButton(CameraWidget *button) final;
+
+    int capturePreview(CameraFile *file) final;
+    int triggerCapture() final;
+    int waitForEvent(int timeout, CameraEventType *type, void **data) final;
+    int fileGet(const char *folder, const char *name, CameraFileType type, CameraFile *file) final;
+    int fileRead(const char *folder, const char *name, CameraFileType type, uint64_t offset,
+                 char *buffer, uint64_t *size) final;
+    int fileGetInfo(const char *folder, const char *name, CameraFileInfo *info) final;
+    int folderListFiles(const char *folder, CameraList *list) final;
+    int folderListFolders(const char *folder, CameraList *list) final;
+
+private:
+    Q_DISABLE_COPY(GPhotoMockBackend)
+
+    struct Option {
+        QByteArray name;
+        QByteArray label;
+        CameraWidgetType type;
+        QList<QByteArray> choices;
+        QVariant value;
+    };
+
+    struct Event {
+        qint64 due;
+        CameraEventType type;
+        QByteArray folder;
+        QByteArray name;
+        QByteArray text;
+    };
+
+    void addEvent(const Event &event);
+    void addShot(qint64 due);
+    void delay(qint64 msecs) const;
+    qint64 fileSize(const QByteArray &name) const;
+    void setMovieRecording(bool recording);
+
+    const Settings m_settings;
+    GPContext *m_context;
+    QList<Option> m_options;
+    QList<QByteArray> m_previewFrames;
+    QByteArray m_captureJpeg;
+    QList<Event> m_events;
+    /// Names and sizes of the recorded movies
+    QList<QPair<QByteArray, qint64>> m_movies;
+    qint64 m_movieStart = -1;
+    QElapsedTimer m_clock;
+    qint64 m_lastButtonShot = 0;
+    int m_previewIndex = 0;
+    int m_shotIndex = 0;
+    bool m_open = false;
+    bool m_initialized = false;
+};
+
+#endif // GPHOTOMOCKBACKEND_H
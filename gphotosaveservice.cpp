@@ -0,0 +1,516 @@
+#include <cerrno>
+
+#include <QCameraImageCapture>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QRegExp>
+#include <QRunnable>
+#include <QSet>
+#include <QTemporaryFile>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gphotofilewriter.h"
+#include "gphotometrics.h"
+#include "gphotosaveservice.h"
+#include "gphototrace.h"
+
+namespace {
+    constexpr auto durabilityEnvironmentVariable = "GPHOTO_DURABILITY";
+    constexpr auto defaultGroupFiles = 16;
+    constexpr auto defaultGroupInterval = 500;
+    constexpr auto baseNamePrefix = "DCIM";
+    constexpr auto baseNameDigits = 4;
+    constexpr auto maxNameAttempts = 100;
+    constexpr auto copyChunkSize = 1024 * 1024;
+
+    /// Name with a numeric suffix for exclusive saves which found the name taken
+    QString alternativeName(const QString &fileName, int attempt)
+    {
+        if (0 == attempt)
+            return fileName;
+
+        const QFileInfo info(fileName);
+        return info.path() + QLatin1Char('/') + info.completeBaseName() + QLatin1Char('_')
+               + QString::number(attempt) + QLatin1Char('.') + info.suffix();
+    }
+
+    /// Flushes file data, metadata like mtime isn't worth waiting for
+    bool flushFile(int fd)
+    {
+#ifdef Q_OS_LINUX
+        return 0 == ::fdatasync(fd);
+#else
+        return 0 == ::fsync(fd);
+#endif
+    }
+
+    bool flushFile(const QString &fileName)
+    {
+        auto fd = ::open(QFile::encodeName(fileName).constData(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+
+        auto ok = flushFile(fd);
+        ::close(fd);
+        return ok;
+    }
+
+    /// Renames are on disk only after their directory is flushed
+    void flushDirectory(const QString &directory)
+    {
+        auto fd = ::open(QFile::encodeName(directory).constData(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return;
+
+        ::fsync(fd);
+        ::close(fd);
+    }
+
+    /// Flushes everything written to the file system holding @p fileName with one call
+    bool flushFileSystem(const QString &fileName)
+    {
+#ifdef Q_OS_LINUX
+        auto fd = ::open(QFile::encodeName(fileName).constData(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+
+        auto ok = (0 == ::syncfs(fd));
+        ::close(fd);
+        return ok;
+#else
+        Q_UNUSED(fileName)
+        ::sync();
+        return true;
+#endif
+    }
+
+    /// Flushes every file system holding one of @p fileNames, each of them once
+    bool flushFileSystems(const QStringList &fileNames)
+    {
+        auto ok = true;
+        QSet<quint64> devices;
+        for (const auto &fileName : fileNames) {
+            struct stat file;
+            if (0 != ::stat(QFile::encodeName(fileName).constData(), &file)) {
+                ok = false;
+                continue;
+            }
+
+            if (devices.contains(quint64(file.st_dev)))
+                continue;
+
+            devices.insert(quint64(file.st_dev));
+            ok = flushFileSystem(fileName) && ok;
+        }
+
+        return ok;
+    }
+
+    bool isSameFileSystem(const QString &fileName, const QString &directory)
+    {
+        struct stat file;
+        struct stat dir;
+        if (0 != ::stat(QFile::encodeName(fileName).constData(), &file)
+                || 0 != ::stat(QFile::encodeName(directory).constData(), &dir)) {
+            // Rename reports the real problem
+            return true;
+        }
+
+        return file.st_dev == dir.st_dev;
+    }
+
+    /** Copies a temporary file next to @p fileName, flushes the copy and removes the original.
+     *
+     * @return name of the copy, empty on failure when the original is kept
+     */
+    QString copyNextTo(const QString &tempFileName, const QString &fileName)
+    {
+        const QFileInfo info(fileName);
+        QTemporaryFile copy(info.path() + QLatin1String("/.gphoto-XXXXXX.") + info.suffix());
+        copy.setAutoRemove(false);
+
+        QFile source(tempFileName);
+        if (!source.open(QIODevice::ReadOnly) || !copy.open()) {
+            qWarning() << "GPhoto: Unable to copy" << tempFileName << "to" << info.path();
+            return QString();
+        }
+
+        auto ok = true;
+        while (ok && !source.atEnd()) {
+            const auto &chunk = source.read(copyChunkSize);
+            ok = !chunk.isEmpty() && copy.write(chunk) == chunk.size();
+        }
+
+        ok = ok && copy.flush() && flushFile(copy.handle());
+        copy.close();
+
+        if (!ok) {
+            qWarning() << "GPhoto: Failed to copy" << tempFileName << "to" << info.path() << ":" << copy.errorString();
+            copy.remove();
+            return QString();
+        }
+
+        source.remove();
+        return copy.fileName();
+    }
+
+    /// Gives the written file its final name, updating @p fileName if it had to be changed
+    bool placeFile(QString *tempFileName, QString *fileName, bool exclusive)
+    {
+        // Rename doesn't cross file systems, e.g. to a format directory on another disk,
+        // so the file is copied next to its final name first and renamed there
+        const auto &directory = QFileInfo(*fileName).path();
+        if (!isSameFileSystem(*tempFileName, directory)) {
+            const auto &copy = copyNextTo(*tempFileName, *fileName);
+            if (copy.isEmpty())
+                return false;
+
+            *tempFileName = copy;
+        }
+
+        // Rename replaces the file atomically, readers see either the old or the new one
+        if (!exclusive)
+            return 0 == ::rename(QFile::encodeName(*tempFileName).constData(), QFile::encodeName(*fileName).constData());
+
+        // QFile never replaces an existing file, so the taken names are skipped
+        for (auto i = 0; i < maxNameAttempts; ++i) {
+            const auto &candidate = alternativeName(*fileName, i);
+            if (!QFile::exists(candidate) && QFile::rename(*tempFileName, candidate)) {
+                *fileName = candidate;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    QString placeError(const QString &fileName)
+    {
+        return QCoreApplication::translate("GPhotoSaveService", "Could not move captured file to:\n%1").arg(fileName);
+    }
+
+    /// Saves a single file and reports back to the service thread
+    class SaveTask final : public QRunnable
+    {
+    public:
+        SaveTask(QObject *service, int sequence, int id, const QString &fileName, bool exclusive,
+                 GPhotoSaveService::Durability durability, GPhotoFileWriter *writer)
+            : m_service(service)
+            , m_sequence(sequence)
+            , m_id(id)
+            , m_fileName(fileName)
+            , m_exclusive(exclusive)
+            , m_durability(durability)
+            , m_writer(writer)
+        {
+        }
+
+        void setData(const QByteArray &data)
+        {
+            m_data = data;
+        }
+
+        void setTempFileName(const QString &tempFileName)
+        {
+            m_tempFileName = tempFileName;
+        }
+
+        void run() final
+        {
+            GPhotoTraceSpan span("saveFile");
+
+            QElapsedTimer timer;
+            timer.start();
+
+            if (m_tempFileName.isEmpty() && !write()) {
+                report(QString(), timer.nsecsElapsed());
+                return;
+            }
+
+            // Group commit flushes and renames the files later, all at once
+            if (GPhotoSaveService::Durability::Group == m_durability) {
+                report(m_tempFileName, timer.nsecsElapsed());
+                return;
+            }
+
+            // File downloaded by the camera wasn't flushed yet
+            if (GPhotoSaveService::Durability::PerFile == m_durability && m_syncNsecs < 0) {
+                QElapsedTimer syncTimer;
+                syncTimer.start();
+                flushFile(m_tempFileName);
+                m_syncNsecs = syncTimer.nsecsElapsed();
+            }
+
+            if (!placeFile(&m_tempFileName, &m_fileName, m_exclusive)) {
+                QFile::remove(m_tempFileName);
+                fail(QCameraImageCapture::ResourceError, placeError(m_fileName));
+            } else if (GPhotoSaveService::Durability::PerFile == m_durability) {
+                flushDirectory(QFileInfo(m_fileName).path());
+            }
+
+            report(QString(), timer.nsecsElapsed());
+        }
+
+    private:
+        bool write()
+        {
+            // Temporary file is created exclusively next to the destination, so it's renamed there in place
+            const QFileInfo info(m_fileName);
+            QTemporaryFile file(info.path() + QLatin1String("/.gphoto-XXXXXX.") + info.suffix());
+            file.setAutoRemove(false);
+
+            if (!file.open()) {
+                fail(QCameraImageCapture::ResourceError,
+                     QCoreApplication::translate("GPhotoSaveService", "Could not open destination file:\n%1")
+                     .arg(m_fileName));
+                return false;
+            }
+
+            if (!m_writer->write(file.handle(), m_data)) {
+                fail(QCameraImageCapture::OutOfSpaceError, qt_error_string(errno));
+                file.remove();
+                return false;
+            }
+
+            if (GPhotoSaveService::Durability::PerFile == m_durability) {
+                QElapsedTimer syncTimer;
+                syncTimer.start();
+                flushFile(file.handle());
+                m_syncNsecs = syncTimer.nsecsElapsed();
+            }
+
+            m_tempFileName = file.fileName();
+            return true;
+        }
+
+        void fail(int errorCode, const QString &errorString)
+        {
+            m_errorCode = errorCode;
+            m_errorString = errorString;
+        }
+
+        void report(const QString &pendingFileName, qint64 nsecs)
+        {
+            QMetaObject::invokeMethod(m_service, "onTaskFinished", Qt::QueuedConnection,
+                                      Q_ARG(int, m_sequence), Q_ARG(int, m_id), Q_ARG(QString, m_fileName),
+                                      Q_ARG(QString, pendingFileName),
+                                      Q_ARG(bool, m_exclusive), Q_ARG(int, m_errorCode), Q_ARG(QString, m_errorString),
+                                      Q_ARG(qint64, nsecs), Q_ARG(qint64, m_syncNsecs));
+        }
+
+        QObject *m_service;
+        int m_sequence;
+        int m_id;
+        QString m_fileName;
+        bool m_exclusive;
+        GPhotoSaveService::Durability m_durability;
+        GPhotoFileWriter *m_writer;
+        QByteArray m_data;
+        QString m_tempFileName;
+        int m_errorCode = QCameraImageCapture::NoError;
+        QString m_errorString;
+        qint64 m_syncNsecs = -1;
+    };
+
+    /// Flushes a group of written files with a single call and renames them into place
+    class CommitTask final : public QRunnable
+    {
+    public:
+        CommitTask(QObject *service, const QList<GPhotoSaveService::PendingFile> &files)
+            : m_service(service)
+            , m_files(files)
+        {
+        }
+
+        void run() final
+        {
+            GPhotoTraceSpan span("commitFiles");
+
+            QElapsedTimer timer;
+            timer.start();
+
+            // Data goes to disk before the names, so no final name ever points to a truncated file.
+            // Group may span several disks through the format directories
+            QStringList tempFileNames;
+            for (const auto &file : m_files)
+                tempFileNames.append(file.tempFileName);
+
+            if (!flushFileSystems(tempFileNames))
+                qWarning() << "GPhoto: Failed to flush saved files to disk";
+
+            QSet<QString> directories;
+            QList<bool> placed;
+            for (auto &file : m_files) {
+                placed.append(placeFile(&file.tempFileName, &file.fileName, file.exclusive));
+                if (placed.last())
+                    directories.insert(QFileInfo(file.fileName).path());
+                else
+                    QFile::remove(file.tempFileName);
+            }
+
+            for (const auto &directory : directories)
+                flushDirectory(directory);
+
+            // Commit is a single flush, so it's recorded once
+            auto syncNsecs = timer.nsecsElapsed();
+
+            for (auto i = 0; i < m_files.size(); ++i) {
+                const auto &file = m_files.at(i);
+                auto errorCode = placed.at(i) ? int(QCameraImageCapture::NoError) : int(QCameraImageCapture::ResourceError);
+                auto errorString = placed.at(i) ? QString() : placeError(file.fileName);
+
+                QMetaObject::invokeMethod(m_service, "onCommitFinished", Qt::QueuedConnection,
+                                          Q_ARG(int, file.id), Q_ARG(QString, file.fileName), Q_ARG(int, errorCode),
+                                          Q_ARG(QString, errorString), Q_ARG(qint64, (0 == i) ? syncNsecs : -1));
+            }
+        }
+
+    private:
+        QObject *m_service;
+        QList<GPhotoSaveService::PendingFile> m_files;
+    };
+}
+
+GPhotoSaveService::GPhotoSaveService(QObject *parent)
+    : QObject(parent)
+    , m_writer(GPhotoFileWriter::create())
+{
+    // Writers keeping several writes in flight themselves are best served by a single thread
+    m_thread.setMaxThreadCount(m_writer->concurrency());
+    m_thread.setExpiryTimeout(-1);
+
+    m_commitTimer.setSingleShot(true);
+    connect(&m_commitTimer, &QTimer::timeout, this, &GPhotoSaveService::commit);
+
+    const auto &durability = QString::fromLocal8Bit(qgetenv(durabilityEnvironmentVariable)).split(QLatin1Char(':'));
+    const auto &mode = durability.first();
+
+    if (QLatin1String("file") == mode)
+        setDurability(Durability::PerFile);
+    else if (QLatin1String("group") == mode)
+        setDurability(Durability::Group, durability.value(1).toInt(), durability.value(2).toInt());
+    else if (!mode.isEmpty() && QLatin1String("none") != mode)
+        qWarning() << "GPhoto: Unknown durability mode" << mode;
+}
+
+GPhotoSaveService::~GPhotoSaveService()
+{
+    // Captured files are never dropped: the files being written join the last group,
+    // which is committed before we're gone
+    m_thread.waitForDone();
+    QCoreApplication::sendPostedEvents(this, QEvent::MetaCall);
+    commit();
+    m_thread.waitForDone();
+}
+
+void GPhotoSaveService::setMetrics(GPhotoCameraMetrics *metrics)
+{
+    m_metrics = metrics;
+}
+
+void GPhotoSaveService::setDurability(Durability durability, int groupFiles, int groupInterval)
+{
+    m_durability = durability;
+    m_groupFiles = (0 < groupFiles) ? groupFiles : defaultGroupFiles;
+    m_commitTimer.setInterval((0 < groupInterval) ? groupInterval : defaultGroupInterval);
+
+    // Files waiting for the group would wait forever otherwise
+    if (Durability::Group != durability)
+        commit();
+}
+
+QString GPhotoSaveService::nextBaseName(const QString &directory)
+{
+    auto it = m_counters.find(directory);
+    if (m_counters.end() == it) {
+        // Directory is scanned once, then the counter only goes up
+        QRegExp pattern(QLatin1String(baseNamePrefix) + QLatin1String("(\\d+)"));
+        auto last = -1;
+        for (const auto &name : QDir(directory).entryList({QLatin1String(baseNamePrefix) + QLatin1Char('*')}, QDir::Files)) {
+            if (pattern.exactMatch(QFileInfo(name).completeBaseName()))
+                last = qMax(last, pattern.cap(1).toInt());
+        }
+
+        it = m_counters.insert(directory, last + 1);
+    }
+
+    return directory + QLatin1Char('/') + QLatin1String(baseNamePrefix)
+           + QString::number(it.value()++).rightJustified(baseNameDigits, QLatin1Char('0'));
+}
+
+void GPhotoSaveService::save(int id, const QString &fileName, const QByteArray &data, bool exclusive)
+{
+    auto task = new SaveTask(this, m_nextSequence++, id, fileName, exclusive, m_durability, m_writer.get());
+    task->setData(data);
+    m_thread.start(task);
+}
+
+void GPhotoSaveService::move(int id, const QString &tempFileName, const QString &fileName, bool exclusive)
+{
+    auto task = new SaveTask(this, m_nextSequence++, id, fileName, exclusive, m_durability, m_writer.get());
+    task->setTempFileName(tempFileName);
+    m_thread.start(task);
+}
+
+void GPhotoSaveService::onTaskFinished(int sequence, int id, const QString &fileName, const QString &pendingFileName,
+                                       bool exclusive, int errorCode, const QString &errorString, qint64 nsecs,
+                                       qint64 syncNsecs)
+{
+    // Tasks running in parallel finish in any order, they're reported in the order they were started
+    m_results.insert(sequence, {id, fileName, pendingFileName, exclusive, errorCode, errorString, nsecs, syncNsecs});
+
+    for (auto it = m_results.begin(); m_results.end() != it && it.key() == m_finishedSequence;
+         it = m_results.erase(it), ++m_finishedSequence) {
+        finishTask(it.value());
+    }
+}
+
+void GPhotoSaveService::onCommitFinished(int id, const QString &fileName, int errorCode, const QString &errorString,
+                                         qint64 syncNsecs)
+{
+    finishTask({id, fileName, QString(), false, errorCode, errorString, -1, syncNsecs});
+}
+
+void GPhotoSaveService::finishTask(const TaskResult &result)
+{
+    if (QCameraImageCapture::NoError != result.errorCode) {
+        emit saveError(result.id, result.errorCode, result.errorString);
+        return;
+    }
+
+    if (m_metrics && 0 <= result.nsecs)
+        m_metrics->record(GPhotoCameraMetrics::CaptureSave, result.nsecs);
+    if (m_metrics && 0 <= result.syncNsecs)
+        m_metrics->record(GPhotoCameraMetrics::CaptureSync, result.syncNsecs);
+
+    if (!result.pendingFileName.isEmpty()) {
+        m_pending.append({result.id, result.pendingFileName, result.fileName, result.exclusive});
+
+        if (m_groupFiles <= m_pending.size())
+            commit();
+        else if (!m_commitTimer.isActive())
+            m_commitTimer.start();
+
+        return;
+    }
+
+    emit imageSaved(result.id, result.fileName);
+}
+
+void GPhotoSaveService::commit()
+{
+    m_commitTimer.stop();
+
+    if (m_pending.isEmpty())
+        return;
+
+    m_thread.start(new CommitTask(this, m_pending));
+    m_pending.clear();
+}
@@ -0,0 +1,124 @@
+#ifndef GPHOTOSAVESERVICE_H
+#define GPHOTOSAVESERVICE_H
+
+#include <memory>
+
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QObject>
+#include <QThreadPool>
+#include <QTimer>
+
+class GPhotoCameraMetrics;
+class GPhotoFileWriter;
+
+/** Saves captured files to disk on a dedicated I/O thread.
+ *
+ * Names for the shots saved without a requested file name come from
+ * a counter seeded by a single scan of the directory, so picking a name
+ * costs nothing however many files are there. Such files are created
+ * exclusively: a name taken by someone else meanwhile gets a suffix
+ * instead of being overwritten.
+ *
+ * Every file is written under a temporary name and renamed into place,
+ * so other programs never see it half written. Whether it survives a crash
+ * intact depends on durability mode, which is set with GPHOTO_DURABILITY
+ * environment variable: "none", "file" or "group:<files>:<msecs>". Only the
+ * modes flushing data before the rename never leave a truncated file.
+ *
+ * Several files are written at once when the writer benefits from it,
+ * but they're still reported saved in the order they were requested.
+ */
+class GPhotoSaveService final : public QObject
+{
+    Q_OBJECT
+public:
+    enum class Durability {
+        /// Left to the OS, on power cut a file may be lost or left empty or short under its final name
+        None,
+        /// Every file is flushed before it's renamed into place
+        PerFile,
+        /// Files are flushed together, every few files or msecs, and renamed after that
+        Group
+    };
+    Q_ENUM(Durability)
+
+    /// File written under temporary name, waiting for the group commit
+    struct PendingFile {
+        int id;
+        QString tempFileName;
+        QString fileName;
+        bool exclusive;
+    };
+
+    explicit GPhotoSaveService(QObject *parent = nullptr);
+    ~GPhotoSaveService();
+
+    GPhotoSaveService(GPhotoSaveService&&) = delete;
+    GPhotoSaveService& operator=(GPhotoSaveService&&) = delete;
+
+    /// Save times are recorded there, may be null
+    void setMetrics(GPhotoCameraMetrics *metrics);
+
+    /** Sets how captured files are flushed to disk.
+     *
+     * In group mode files are reported saved when the group is committed,
+     * after @p groupFiles files or @p groupInterval msecs since the first one.
+     */
+    void setDurability(Durability durability, int groupFiles = 0, int groupInterval = 0);
+
+    /// Next unused "directory/DCIMnnnn" base name, without extension
+    QString nextBaseName(const QString &directory);
+
+    /** Writes @p data to @p fileName in background.
+     *
+     * @param exclusive never replace an existing file, pick another name instead
+     */
+    void save(int id, const QString &fileName, const QByteArray &data, bool exclusive);
+
+    /// Moves a downloaded temporary file to @p fileName in background
+    void move(int id, const QString &tempFileName, const QString &fileName, bool exclusive);
+
+signals:
+    void imageSaved(int id, const QString &fileName);
+    void saveError(int id, int errorCode, const QString &errorString);
+
+private slots:
+    void onTaskFinished(int sequence, int id, const QString &fileName, const QString &pendingFileName, bool exclusive,
+                        int errorCode, const QString &errorString, qint64 nsecs, qint64 syncNsecs);
+    void onCommitFinished(int id, const QString &fileName, int errorCode, const QString &errorString,
+                          qint64 syncNsecs);
+    void commit();
+
+private:
+    Q_DISABLE_COPY(GPhotoSaveService)
+
+    struct TaskResult {
+        int id;
+        QString fileName;
+        QString pendingFileName;
+        bool exclusive;
+        int errorCode;
+        QString errorString;
+        qint64 nsecs;
+        qint64 syncNsecs;
+    };
+
+    void finishTask(const TaskResult &result);
+
+    std::unique_ptr<GPhotoFileWriter> m_writer;
+    QThreadPool m_thread;
+    int m_nextSequence = 0;
+    int m_finishedSequence = 0;
+    QMap<int, TaskResult> m_results;
+    QHash<QString, int> m_counters;
+    GPhotoCameraMetrics *m_metrics = nullptr;
+
+    Durability m_durability = Durability::None;
+    int m_groupFiles = 0;
+    QList<PendingFile> m_pending;
+    QTimer m_commitTimer;
+};
+
+#endif // GPHOTOSAVESERVICE_H
@@ -0,0 +1,173 @@
+#include <vector>
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QThread>
+
+#include "gphototrace.h"
+
+namespace {
+    constexpr auto traceEnvironmentVariable = "GPHOTO_TRACE";
+    constexpr auto flushEventCount = 256;
+
+    struct TraceEvent {
+        const char *name;
+        int cameraIndex;
+        int threadId;
+        qint64 start;
+        qint64 duration;
+    };
+
+    /// Buffers events and appends them to the trace file in batches
+    class Tracer final
+    {
+    public:
+        Tracer()
+            : m_file(QString::fromLocal8Bit(qgetenv(traceEnvironmentVariable)))
+        {
+            if (m_file.fileName().isEmpty())
+                return;
+
+            if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+                qWarning() << "GPhoto: Unable to write trace to" << m_file.fileName() << ":" << m_file.errorString();
+                return;
+            }
+
+            m_file.write("[\n");
+            m_clock.start();
+            m_enabled = true;
+        }
+
+        ~Tracer()
+        {
+            if (!m_enabled)
+                return;
+
+            QMutexLocker locker(&m_mutex);
+            flush();
+            m_file.write("\n]\n");
+        }
+
+        bool isEnabled() const
+        {
+            return m_enabled;
+        }
+
+        qint64 now() const
+        {
+            return m_clock.nsecsElapsed() / 1000;
+        }
+
+        void add(const char *name, int cameraIndex, qint64 start)
+        {
+            auto end = now();
+
+            QMutexLocker locker(&m_mutex);
+            m_events.push_back({name, cameraIndex, threadId(), start, end - start});
+
+            if (size_t(flushEventCount) <= m_events.size())
+                flush();
+        }
+
+    private:
+        int threadId()
+        {
+            thread_local auto id = 0;
+            if (0 < id)
+                return id;
+
+            id = ++m_threadCount;
+
+            // Give the thread a readable name in the viewer
+            auto thread = QThread::currentThread();
+            auto name = thread->objectName();
+            if (name.isEmpty()) {
+                auto app = QCoreApplication::instance();
+                name = (app && app->thread() == thread) ? QStringLiteral("GUI")
+                                                        : QString(QLatin1String("Thread %1")).arg(id);
+            }
+
+            QJsonObject args;
+            args.insert(QLatin1String("name"), name);
+
+            QJsonObject event;
+            event.insert(QLatin1String("name"), QLatin1String("thread_name"));
+            event.insert(QLatin1String("ph"), QLatin1String("M"));
+            event.insert(QLatin1String("pid"), double(QCoreApplication::applicationPid()));
+            event.insert(QLatin1String("tid"), id);
+            event.insert(QLatin1String("args"), args);
+            write(event);
+
+            return id;
+        }
+
+        void flush()
+        {
+            for (const auto &e : m_events) {
+                QJsonObject event;
+                event.insert(QLatin1String("name"), QLatin1String(e.name));
+                event.insert(QLatin1String("cat"), QLatin1String("gphoto"));
+                event.insert(QLatin1String("ph"), QLatin1String("X"));
+                event.insert(QLatin1String("pid"), double(QCoreApplication::applicationPid()));
+                event.insert(QLatin1String("tid"), e.threadId);
+                event.insert(QLatin1String("ts"), double(e.start));
+                event.insert(QLatin1String("dur"), double(e.duration));
+
+                if (0 <= e.cameraIndex) {
+                    QJsonObject args;
+                    args.insert(QLatin1String("camera"), e.cameraIndex);
+                    event.insert(QLatin1String("args"), args);
+                }
+
+                write(event);
+            }
+
+            m_events.clear();
+            m_file.flush();
+        }
+
+        void write(const QJsonObject &event)
+        {
+            if (!m_empty)
+                m_file.write(",\n");
+
+            m_file.write(QJsonDocument(event).toJson(QJsonDocument::Compact));
+            m_empty = false;
+        }
+
+        QMutex m_mutex;
+        QFile m_file;
+        QElapsedTimer m_clock;
+        std::vector<TraceEvent> m_events;
+        int m_threadCount = 0;
+        bool m_enabled = false;
+        bool m_empty = true;
+    };
+
+    Tracer& tracer()
+    {
+        static Tracer instance;
+        return instance;
+    }
+}
+
+bool GPhotoTrace::isEnabled()
+{
+    return tracer().isEnabled();
+}
+
+qint64 GPhotoTrace::now()
+{
+    return tracer().now();
+}
+
+void GPhotoTrace::complete(const char *name, int cameraIndex, qint64 start)
+{
+    if (isEnabled())
+        tracer().add(name, cameraIndex, start);
+}
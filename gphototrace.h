@@ -0,0 +1,53 @@
+#ifndef GPHOTOTRACE_H
+#define GPHOTOTRACE_H
+
+#include <QtGlobal>
+
+/** Timeline of the camera pipeline in Chrome trace event format.
+ *
+ * Enabled with GPHOTO_TRACE environment variable set to the output file name,
+ * the file can be opened with chrome://tracing or https://ui.perfetto.dev.
+ * Spans are recorded per thread and tagged with the camera index, so stalls
+ * between GUI and worker threads are easy to see.
+ */
+class GPhotoTrace final
+{
+public:
+    static bool isEnabled();
+
+    /// Trace clock in usecs
+    static qint64 now();
+
+    /// Records the span started at @p start, @p name must be a string literal
+    static void complete(const char *name, int cameraIndex, qint64 start);
+
+private:
+    GPhotoTrace() = delete;
+};
+
+/// Records a span from construction till the end of the scope
+class GPhotoTraceSpan final
+{
+public:
+    explicit GPhotoTraceSpan(const char *name, int cameraIndex = -1)
+        : m_name(name)
+        , m_cameraIndex(cameraIndex)
+        , m_start(GPhotoTrace::isEnabled() ? GPhotoTrace::now() : -1)
+    {
+    }
+
+    ~GPhotoTraceSpan()
+    {
+        if (0 <= m_start)
+            GPhotoTrace::complete(m_name, m_cameraIndex, m_start);
+    }
+
+private:
+    Q_DISABLE_COPY(GPhotoTraceSpan)
+
+    const char *m_name;
+    int m_cameraIndex;
+    qint64 m_start;
+};
+
+#endif // GPHOTOTRACE_H
@@ -0,0 +1,129 @@
+#include <QDebug>
+
+#include "gphototransfermonitor.h"
+
+namespace {
+    constexpr auto logLinesEnvironmentVariable = "GPHOTO_LOG_LINES";
+    constexpr auto progressInterval = 100;
+}
+
+GPhotoTransferMonitor::GPhotoTransferMonitor(GPContext *context, QObject *parent)
+    : QObject(parent)
+    , m_context(context)
+{
+    gp_context_set_progress_funcs(m_context, progressStart, progressUpdate, progressStop, this);
+
+    // Debug logging makes libgphoto2 format every message, so it's off unless asked for
+    auto ok = false;
+    m_logLines = qEnvironmentVariableIntValue(logLinesEnvironmentVariable, &ok);
+    if (ok && 0 < m_logLines)
+        m_logFuncId = gp_log_add_func(GP_LOG_DEBUG, log, this);
+}
+
+GPhotoTransferMonitor::~GPhotoTransferMonitor()
+{
+    gp_context_set_progress_funcs(m_context, nullptr, nullptr, nullptr, nullptr);
+
+    if (0 <= m_logFuncId)
+        gp_log_remove_func(m_logFuncId);
+}
+
+void GPhotoTransferMonitor::beginTransfer(int cameraIndex, int id)
+{
+    m_transferring = true;
+    m_cameraIndex = cameraIndex;
+    m_id = id;
+    m_total = 0;
+    m_transferTimer.start();
+    m_progressTimer.invalidate();
+}
+
+qint64 GPhotoTransferMonitor::endTransfer(qint64 bytes)
+{
+    if (!m_transferring)
+        return 0;
+
+    m_transferring = false;
+
+    auto nsecs = m_transferTimer.nsecsElapsed();
+    if (bytes <= 0 || nsecs <= 0)
+        return 0;
+
+    auto bytesPerSecond = qint64(double(bytes) * 1000000000 / nsecs);
+    emit transferFinished(m_cameraIndex, m_id, bytes, bytesPerSecond);
+    return bytesPerSecond;
+}
+
+void GPhotoTransferMonitor::reportProgress(qint64 bytes, qint64 total)
+{
+    if (!m_transferring)
+        return;
+
+    // Throttled like driver progress, but the first and the last chunk always get through
+    auto last = (0 < total && total <= bytes);
+    if (!last && m_progressTimer.isValid() && !m_progressTimer.hasExpired(progressInterval))
+        return;
+
+    m_total = total;
+    m_progressTimer.start();
+    emit transferProgress(m_cameraIndex, m_id, bytes, total);
+}
+
+QStringList GPhotoTransferMonitor::recentLog() const
+{
+    QMutexLocker locker(&m_logMutex);
+    return m_log;
+}
+
+unsigned int GPhotoTransferMonitor::progressStart(GPContext *context, float target, const char *text, void *data)
+{
+    Q_UNUSED(context)
+    Q_UNUSED(text)
+
+    auto monitor = static_cast<GPhotoTransferMonitor*>(data);
+    monitor->m_total = qint64(target);
+
+    // Progress of other operations, e.g. reading the folders, is of no interest
+    if (monitor->m_transferring) {
+        monitor->m_progressTimer.start();
+        emit monitor->transferProgress(monitor->m_cameraIndex, monitor->m_id, 0, monitor->m_total);
+    }
+
+    return ++monitor->m_progressId;
+}
+
+void GPhotoTransferMonitor::progressUpdate(GPContext *context, unsigned int progressId, float current, void *data)
+{
+    Q_UNUSED(context)
+    Q_UNUSED(progressId)
+
+    // Camera drivers report every USB packet, that's far more than anyone could show
+    auto monitor = static_cast<GPhotoTransferMonitor*>(data);
+    if (monitor->m_transferring && monitor->m_progressTimer.hasExpired(progressInterval)) {
+        monitor->m_progressTimer.start();
+        emit monitor->transferProgress(monitor->m_cameraIndex, monitor->m_id, qint64(current), monitor->m_total);
+    }
+}
+
+void GPhotoTransferMonitor::progressStop(GPContext *context, unsigned int progressId, void *data)
+{
+    Q_UNUSED(context)
+    Q_UNUSED(progressId)
+
+    auto monitor = static_cast<GPhotoTransferMonitor*>(data);
+    if (monitor->m_transferring)
+        emit monitor->transferProgress(monitor->m_cameraIndex, monitor->m_id, monitor->m_total, monitor->m_total);
+}
+
+void GPhotoTransferMonitor::log(GPLogLevel level, const char *domain, const char *str, void *data)
+{
+    Q_UNUSED(level)
+
+    auto monitor = static_cast<GPhotoTransferMonitor*>(data);
+
+    QMutexLocker locker(&monitor->m_logMutex);
+    monitor->m_log.enqueue(QString(QLatin1String("%1: %2")).arg(QLatin1String(domain), QString::fromLocal8Bit(str).trimmed()));
+
+    while (monitor->m_logLines < monitor->m_log.size())
+        monitor->m_log.dequeue();
+}
@@ -0,0 +1,76 @@
+#ifndef GPHOTOTRANSFERMONITOR_H
+#define GPHOTOTRANSFERMONITOR_H
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QObject>
+#include <QQueue>
+#include <QStringList>
+
+#include <gphoto2/gphoto2-context.h>
+#include <gphoto2/gphoto2-port-log.h>
+
+/** Watches file downloads done through a libgphoto2 context.
+ *
+ * Turns context progress callbacks into signals and measures the speed
+ * of every transfer, so a slow camera can be told apart from a slow bus.
+ * Progress is throttled, so the signals don't flood the receiving event loop.
+ *
+ * Set GPHOTO_LOG_LINES environment variable to a number of recent libgphoto2
+ * debug log lines to keep, they are printed along with camera errors.
+ */
+class GPhotoTransferMonitor final : public QObject
+{
+    Q_OBJECT
+public:
+    explicit GPhotoTransferMonitor(GPContext *context, QObject *parent = nullptr);
+    ~GPhotoTransferMonitor();
+
+    GPhotoTransferMonitor(GPhotoTransferMonitor&&) = delete;
+    GPhotoTransferMonitor& operator=(GPhotoTransferMonitor&&) = delete;
+
+    /// Progress reported until endTransfer() belongs to the given capture
+    void beginTransfer(int cameraIndex, int id);
+
+    /** Finishes the current transfer.
+     *
+     * @param bytes size of the downloaded file, zero if download failed
+     * @return transfer speed in bytes per second.
+     */
+    qint64 endTransfer(qint64 bytes);
+
+    /// Progress of a transfer read in chunks, which the driver doesn't report itself
+    void reportProgress(qint64 bytes, qint64 total);
+
+    QStringList recentLog() const;
+
+signals:
+    /// Emitted at the start and the end of a transfer and at most every 100 msecs between them
+    void transferProgress(int cameraIndex, int id, qint64 bytes, qint64 total);
+    void transferFinished(int cameraIndex, int id, qint64 bytes, qint64 bytesPerSecond);
+
+private:
+    Q_DISABLE_COPY(GPhotoTransferMonitor)
+
+    static unsigned int progressStart(GPContext *context, float target, const char *text, void *data);
+    static void progressUpdate(GPContext *context, unsigned int progressId, float current, void *data);
+    static void progressStop(GPContext *context, unsigned int progressId, void *data);
+    static void log(GPLogLevel level, const char *domain, const char *str, void *data);
+
+    GPContext *m_context;
+
+    bool m_transferring = false;
+    int m_cameraIndex = -1;
+    int m_id = 0;
+    qint64 m_total = 0;
+    unsigned int m_progressId = 0;
+    QElapsedTimer m_transferTimer;
+    QElapsedTimer m_progressTimer;
+
+    int m_logFuncId = -1;
+    int m_logLines = 0;
+    mutable QMutex m_logMutex;
+    QQueue<QString> m_log;
+};
+
+#endif // GPHOTOTRANSFERMONITOR_H
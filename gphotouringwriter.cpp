@@ -0,0 +1,156 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <QDebug>
+
+#include "gphotouringwriter.h"
+
+namespace {
+    constexpr auto queueDepth = 8;
+}
+
+GPhotoUringWriter::~GPhotoUringWriter()
+{
+    io_uring_queue_exit(&m_ring);
+
+    for (auto buffer : m_buffers)
+        free(buffer);
+}
+
+std::unique_ptr<GPhotoUringWriter> GPhotoUringWriter::create()
+{
+    std::unique_ptr<GPhotoUringWriter> writer(new GPhotoUringWriter());
+
+    auto ret = io_uring_queue_init(queueDepth, &writer->m_ring, 0);
+    if (ret < 0) {
+        qWarning() << "GPhoto: io_uring is not available, using pwrite:" << strerror(-ret);
+        return nullptr;
+    }
+
+    for (auto i = 0; i < queueDepth; ++i) {
+        void *buffer = nullptr;
+        if (0 != ::posix_memalign(&buffer, size_t(GPhotoPwriteWriter::alignment), size_t(GPhotoPwriteWriter::chunkSize))) {
+            // Ring is set up already, so it's cleaned up by the destructor
+            return nullptr;
+        }
+
+        writer->m_buffers.push_back(buffer);
+    }
+
+    return writer;
+}
+
+bool GPhotoUringWriter::write(int fd, const QByteArray &data)
+{
+    auto aligned = GPhotoPwriteWriter::alignedSize(data.size());
+
+    // One ring serves all the files, they come from the single save thread anyway
+    if (0 < aligned && GPhotoPwriteWriter::setDirect(fd, true)) {
+        auto ok = false;
+        {
+            QMutexLocker locker(&m_mutex);
+            ok = !m_broken && writeDirect(fd, data.constData(), aligned);
+        }
+
+        GPhotoPwriteWriter::setDirect(fd, false);
+
+        if (ok)
+            return GPhotoPwriteWriter::writeBuffered(fd, data.constData() + aligned, data.size() - aligned, aligned);
+    }
+
+    // Whole file again, the ring could have written some chunks only
+    return GPhotoPwriteWriter::writeBuffered(fd, data.constData(), data.size(), 0);
+}
+
+int GPhotoUringWriter::concurrency() const
+{
+    return 1;
+}
+
+QString GPhotoUringWriter::name() const
+{
+    return QStringLiteral("io_uring");
+}
+
+bool GPhotoUringWriter::writeDirect(int fd, const char *data, qint64 size)
+{
+    std::vector<int> freeBuffers;
+    std::vector<qint64> chunks(size_t(queueDepth), 0);
+    for (auto i = queueDepth - 1; 0 <= i; --i)
+        freeBuffers.push_back(i);
+
+    qint64 offset = 0;
+    // Chunks prepared in the ring, some of them may not be submitted to the kernel yet
+    auto inFlight = 0;
+    auto unsubmitted = 0;
+    auto ok = true;
+
+    while ((ok && offset < size) || 0 < inFlight) {
+        // Keep the queue full while there's data left
+        while (ok && offset < size && !freeBuffers.empty()) {
+            auto sqe = io_uring_get_sqe(&m_ring);
+            if (!sqe)
+                break;
+
+            auto index = freeBuffers.back();
+            freeBuffers.pop_back();
+
+            auto chunk = qMin(GPhotoPwriteWriter::chunkSize, size - offset);
+            memcpy(m_buffers[size_t(index)], data + offset, size_t(chunk));
+            chunks[size_t(index)] = chunk;
+
+            io_uring_prep_write(sqe, fd, m_buffers[size_t(index)], unsigned(chunk), quint64(offset));
+            io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(quintptr(index)));
+
+            offset += chunk;
+            ++inFlight;
+            ++unsubmitted;
+        }
+
+        if (0 == inFlight)
+            break;
+
+        if (0 < unsubmitted) {
+            auto ret = io_uring_submit(&m_ring);
+            if (-EINTR == ret)
+                continue;
+
+            if (0 <= ret) {
+                unsubmitted -= ret;
+            } else {
+                qWarning() << "GPhoto: Failed to submit writes to io_uring:" << strerror(-ret);
+                ok = false;
+            }
+        }
+
+        // Nothing in the kernel to wait for, and the chunks left in the ring would go with the next file
+        if (inFlight == unsubmitted) {
+            m_broken = true;
+            return false;
+        }
+
+        io_uring_cqe *cqe = nullptr;
+        auto ret = io_uring_wait_cqe(&m_ring, &cqe);
+        if (-EINTR == ret)
+            continue;
+        if (ret < 0) {
+            // Kernel may still use the buffers and complete the chunks later, so the ring is never used again
+            qWarning() << "GPhoto: Failed to wait for io_uring writes:" << strerror(-ret);
+            m_broken = true;
+            return false;
+        }
+
+        auto index = int(quintptr(io_uring_cqe_get_data(cqe)));
+
+        // Short or failed write, the rest of the chunks are drained and the file is rewritten
+        if (cqe->res != chunks[size_t(index)])
+            ok = false;
+
+        freeBuffers.push_back(index);
+        io_uring_cqe_seen(&m_ring, cqe);
+        --inFlight;
+    }
+
+    return ok;
+}
@@ -0,0 +1,48 @@
+#ifndef GPHOTOURINGWRITER_H
+#define GPHOTOURINGWRITER_H
+
+#include <vector>
+
+#include <QMutex>
+
+#include <liburing.h>
+
+#include "gphotofilewriter.h"
+
+/** Writes files with io_uring, keeping several chunks of a file in flight.
+ *
+ * Chunks are written with O_DIRECT from a pool of aligned buffers, so a single
+ * thread keeps the disk queue full without copying through the page cache.
+ * Falls back to pwrite() for files the ring can't write, e.g. on file systems
+ * without O_DIRECT support.
+ */
+class GPhotoUringWriter final : public GPhotoFileWriter
+{
+public:
+    ~GPhotoUringWriter();
+
+    GPhotoUringWriter(GPhotoUringWriter&&) = delete;
+    GPhotoUringWriter& operator=(GPhotoUringWriter&&) = delete;
+
+    /// Null if io_uring isn't available in the running kernel
+    static std::unique_ptr<GPhotoUringWriter> create();
+
+    bool write(int fd, const QByteArray &data) final;
+    int concurrency() const final;
+    QString name() const final;
+
+private:
+    Q_DISABLE_COPY(GPhotoUringWriter)
+
+    GPhotoUringWriter() = default;
+
+    bool writeDirect(int fd, const char *data, qint64 size);
+
+    QMutex m_mutex;
+    io_uring m_ring;
+    std::vector<void*> m_buffers;
+    // Ring lost track of its writes, files are written with pwrite() from then on
+    bool m_broken = false;
+};
+
+#endif // GPHOTOURINGWRITER_H
@@ -8,16 +8,37 @@
 #include <gphoto2/gphoto2-port-result.h>
 
 #include "gphotocamera.h"
+#include "gphotodevicebackend.h"
+#include "gphotometrics.h"
+#ifdef GPHOTO_MOCK_BACKEND
+#include "gphotomockbackend.h"
+#endif
+#include "gphototransfermonitor.h"
 #include "gphotoworker.h"
 
 namespace {
     constexpr auto deviceCacheLifetime = 1000;
+    constexpr auto prewarmEnvironmentVariable = "GPHOTO_PREWARM";
+    constexpr auto tetherEnvironmentVariable = "GPHOTO_TETHER";
+    constexpr auto downloadEnvironmentVariable = "GPHOTO_DOWNLOAD";
+#ifdef GPHOTO_MOCK_BACKEND
+    constexpr auto mockPathPrefix = "mock:";
+    constexpr auto mockModel = "GPhoto Mock Camera";
+#endif
+
+    /// Switch variables are off when unset, empty, 0, false, no or off
+    bool isSwitchedOn(const char *variable)
+    {
+        static const QStringList offValues{QLatin1String("0"), QLatin1String("false"), QLatin1String("no"), QLatin1String("off")};
+        const auto &value = QString::fromLocal8Bit(qgetenv(variable)).trimmed();
+        return !value.isEmpty() && !offValues.contains(value, Qt::CaseInsensitive);
+    }
 }
 
-using CameraListPtr = std::unique_ptr<CameraList, int (*)(CameraList*)>;
-
-GPhotoWorker::GPhotoWorker()
-    : m_context(gp_context_new(), gp_context_unref)
+GPhotoWorker::GPhotoWorker(GPhotoMetrics *metrics)
+    : m_metrics(metrics)
+    , m_context(gp_context_new(), gp_context_unref)
+    , m_transferMonitor(new GPhotoTransferMonitor(m_context.get(), this))
     , m_portInfoList(nullptr, gp_port_info_list_free)
     , m_abilitiesList(nullptr, gp_abilities_list_free)
 {
@@ -28,16 +49,34 @@ GPhotoWorker::GPhotoWorker()
     CameraAbilitiesList *caList;
     gp_abilities_list_new(&caList);
     m_abilitiesList.reset(caList);
+
+    connect(m_transferMonitor.get(), &GPhotoTransferMonitor::transferFinished, this, &GPhotoWorker::transferFinished);
+    connect(m_transferMonitor.get(), &GPhotoTransferMonitor::transferProgress, this, &GPhotoWorker::transferProgress);
 }
 
 GPhotoWorker::~GPhotoWorker()
 {
 }
 
+bool GPhotoWorker::event(QEvent *event)
+{
+    // Requests from controller come as queued method calls
+    if (QEvent::MetaCall == event->type())
+        m_metrics->workerRequestDequeued();
+
+    return QObject::event(event);
+}
+
 bool GPhotoWorker::init()
 {
     Q_ASSERT(m_context);
 
+#ifdef GPHOTO_MOCK_BACKEND
+    // Mock cameras don't need any camera drivers
+    if (GPhotoMockBackend::isEnabled())
+        return true;
+#endif
+
     auto ret = gp_port_info_list_load(m_portInfoList.get());
     if (ret < GP_OK) {
         qWarning() << "GPhoto: unable to load port info list";
@@ -93,36 +132,74 @@ void GPhotoWorker::initCamera(int cameraIndex)
         return;
     }
 
-    auto ok = false;
+    std::unique_ptr<GPhotoBackend> backend;
 
-    const auto &abilities = getCameraAbilities(cameraIndex, &ok);
-    if (!ok) {
-        qWarning() << "GPhoto: Unable to get abilities for camera with index" << cameraIndex;
-        return;
-    }
+#ifdef GPHOTO_MOCK_BACKEND
+    if (path.startsWith(mockPathPrefix))
+        backend.reset(new GPhotoMockBackend(GPhotoMockBackend::environmentSettings(), m_context.get()));
+#endif
 
-    const auto &portInfo = getPortInfo(cameraIndex, &ok);
-    if (!ok) {
-        qWarning() << "GPhoto: Unable to get port info for camera with index" << cameraIndex;
-        return;
+    if (!backend) {
+        auto ok = false;
+
+        const auto &abilities = getCameraAbilities(cameraIndex, &ok);
+        if (!ok) {
+            qWarning() << "GPhoto: Unable to get abilities for camera with index" << cameraIndex;
+            return;
+        }
+
+        const auto &portInfo = getPortInfo(cameraIndex, &ok);
+        if (!ok) {
+            qWarning() << "GPhoto: Unable to get port info for camera with index" << cameraIndex;
+            return;
+        }
+
+        backend.reset(new GPhotoDeviceBackend(m_context.get(), abilities, portInfo));
     }
 
-    auto camera = new GPhotoCamera(m_context.get(), abilities, portInfo, this);
+    auto camera = new GPhotoCamera(cameraIndex, std::move(backend), m_metrics->camera(cameraIndex),
+                                   m_transferMonitor.get(), this);
 
     using Camera = GPhotoCamera;
     using Worker = GPhotoWorker;
     using namespace std::placeholders;
 
+    connect(camera, &Camera::bracketFrameCaptured, camera, std::bind(&Worker::bracketFrameCaptured, this, cameraIndex, _1, _2, _3, _4));
+    connect(camera, &Camera::cameraEvent, camera, std::bind(&Worker::cameraEvent, this, cameraIndex, _1));
     connect(camera, &Camera::captureModeChanged, camera, std::bind(&Worker::captureModeChanged, this, cameraIndex, _1));
     connect(camera, &Camera::error, camera, std::bind(&Worker::error, this, cameraIndex, _1, _2));
+    connect(camera, &Camera::fileDeferred, camera, std::bind(&Worker::fileDeferred, this, cameraIndex, _1, _2));
+    connect(camera, &Camera::fileImported, camera, std::bind(&Worker::fileImported, this, cameraIndex, _1, _2));
     connect(camera, &Camera::imageCaptureError, camera, std::bind(&Worker::imageCaptureError, this, cameraIndex, _1, _2, _3));
     connect(camera, &Camera::imageCaptured, camera, std::bind(&Worker::imageCaptured, this, cameraIndex, _1, _2, _3, _4));
+    connect(camera, &Camera::imageFileCaptured, camera, std::bind(&Worker::imageFileCaptured, this, cameraIndex, _1, _2, _3, _4));
+    connect(camera, &Camera::importFinished, camera, std::bind(&Worker::importFinished, this, cameraIndex, _1, _2));
+    connect(camera, &Camera::importProgress, camera, std::bind(&Worker::importProgress, this, cameraIndex, _1, _2, _3, _4));
     connect(camera, &Camera::previewCaptured, camera, std::bind(&Worker::previewCaptured, this, cameraIndex, _1));
     connect(camera, &Camera::readyForCaptureChanged, camera, std::bind(&Worker::readyForCaptureChanged, this, cameraIndex, _1));
+    connect(camera, &Camera::recordingChanged, camera, std::bind(&Worker::recordingChanged, this, cameraIndex, _1, _2));
     connect(camera, &Camera::stateChanged, camera, std::bind(&Worker::stateChanged, this, cameraIndex, _1));
     connect(camera, &Camera::statusChanged, camera, std::bind(&Worker::statusChanged, this, cameraIndex, _1));
+    connect(camera, &Camera::timelapseShotTriggered, camera, std::bind(&Worker::timelapseShotTriggered, this, cameraIndex, _1, _2, _3, _4));
+
+    // What libgphoto2 was doing right before the failure is often the only clue
+    connect(camera, &Camera::error, camera, std::bind(&Worker::logRecentGPhotoMessages, this));
+    connect(camera, &Camera::imageCaptureError, camera, std::bind(&Worker::logRecentGPhotoMessages, this));
 
     m_cameras.emplace(path, camera);
+
+    camera->setTethered(isSwitchedOn(tetherEnvironmentVariable));
+
+    // Either "all", "none" or a comma separated list of extensions to download
+    const auto &download = QString::fromLocal8Bit(qgetenv(downloadEnvironmentVariable)).trimmed();
+    if (0 == download.compare(QLatin1String("none"), Qt::CaseInsensitive))
+        camera->setDownloadPolicy(GPhotoCamera::DownloadPolicy::Deferred, {});
+    else if (!download.isEmpty() && 0 != download.compare(QLatin1String("all"), Qt::CaseInsensitive))
+        camera->setDownloadPolicy(GPhotoCamera::DownloadPolicy::ByExtension, download.split(QLatin1Char(',')));
+
+    // Connect and read config in background, so it's not done on the first user request
+    if (isSwitchedOn(prewarmEnvironmentVariable))
+        QMetaObject::invokeMethod(camera, "prewarm", Qt::QueuedConnection);
 }
 
 void GPhotoWorker::setState(int cameraIndex, QCamera::State state)
@@ -155,6 +232,136 @@ void GPhotoWorker::capturePhoto(int cameraIndex, int id, const QString &fileName
         m_cameras.at(path)->capturePhoto(id, fileName);
 }
 
+void GPhotoWorker::captureBracket(int cameraIndex, int id, const QString &fileName, const QVariantList &steps)
+{
+    if (!isCameraIndexValid(cameraIndex))
+        return;
+
+    const auto &path = m_paths.at(cameraIndex);
+    if (!path.isEmpty() && m_cameras.cend() != m_cameras.find(path))
+        m_cameras.at(path)->captureBracket(id, fileName, steps);
+}
+
+void GPhotoWorker::startTimelapse(int cameraIndex, int id, const QString &fileName, int interval, int count)
+{
+    if (!isCameraIndexValid(cameraIndex))
+        return;
+
+    const auto &path = m_paths.at(cameraIndex);
+    if (!path.isEmpty() && m_cameras.cend() != m_cameras.find(path))
+        m_cameras.at(path)->startTimelapse(id, fileName, interval, count);
+}
+
+void GPhotoWorker::stopTimelapse(int cameraIndex)
+{
+    if (!isCameraIndexValid(cameraIndex))
+        return;
+
+    const auto &path = m_paths.at(cameraIndex);
+    if (!path.isEmpty() && m_cameras.cend() != m_cameras.find(path))
+        m_cameras.at(path)->stopTimelapse();
+}
+
+void GPhotoWorker::startRecording(int cameraIndex, int id, const QString &fileName)
+{
+    if (!isCameraIndexValid(cameraIndex))
+        return;
+
+    const auto &path = m_paths.at(cameraIndex);
+    if (!path.isEmpty() && m_cameras.cend() != m_cameras.find(path))
+        m_cameras.at(path)->startRecording(id, fileName);
+}
+
+void GPhotoWorker::stopRecording(int cameraIndex)
+{
+    if (!isCameraIndexValid(cameraIndex))
+        return;
+
+    const auto &path = m_paths.at(cameraIndex);
+    if (!path.isEmpty() && m_cameras.cend() != m_cameras.find(path))
+        m_cameras.at(path)->stopRecording();
+}
+
+void GPhotoWorker::cancelCapture(int cameraIndex)
+{
+    if (!isCameraIndexValid(cameraIndex))
+        return;
+
+    const auto &path = m_paths.at(cameraIndex);
+    if (!path.isEmpty() && m_cameras.cend() != m_cameras.find(path))
+        m_cameras.at(path)->cancelCapture();
+}
+
+void GPhotoWorker::setTethered(int cameraIndex, bool tethered)
+{
+    if (!isCameraIndexValid(cameraIndex))
+        return;
+
+    const auto &path = m_paths.at(cameraIndex);
+    if (!path.isEmpty() && m_cameras.cend() != m_cameras.find(path))
+        m_cameras.at(path)->setTethered(tethered);
+}
+
+void GPhotoWorker::setDownloadPolicy(int cameraIndex, GPhotoCamera::DownloadPolicy policy, const QStringList &extensions)
+{
+    if (!isCameraIndexValid(cameraIndex))
+        return;
+
+    const auto &path = m_paths.at(cameraIndex);
+    if (!path.isEmpty() && m_cameras.cend() != m_cameras.find(path))
+        m_cameras.at(path)->setDownloadPolicy(policy, extensions);
+}
+
+void GPhotoWorker::setSaveDirectories(int cameraIndex, const QString &directory, const QVariantMap &formatDirectories)
+{
+    if (!isCameraIndexValid(cameraIndex))
+        return;
+
+    const auto &path = m_paths.at(cameraIndex);
+    if (!path.isEmpty() && m_cameras.cend() != m_cameras.find(path))
+        m_cameras.at(path)->setSaveDirectories(directory, formatDirectories);
+}
+
+QStringList GPhotoWorker::deferredFiles(int cameraIndex) const
+{
+    if (!isCameraIndexValid(cameraIndex))
+      return {};
+
+    const auto &path = m_paths.at(cameraIndex);
+    return (!path.isEmpty() && m_cameras.cend() != m_cameras.find(path))
+           ? m_cameras.at(path)->deferredFiles() : QStringList();
+}
+
+void GPhotoWorker::clearDeferredFiles(int cameraIndex)
+{
+    if (!isCameraIndexValid(cameraIndex))
+        return;
+
+    const auto &path = m_paths.at(cameraIndex);
+    if (!path.isEmpty() && m_cameras.cend() != m_cameras.find(path))
+        m_cameras.at(path)->clearDeferredFiles();
+}
+
+void GPhotoWorker::importFiles(int cameraIndex, const QString &destination)
+{
+    if (!isCameraIndexValid(cameraIndex))
+        return;
+
+    const auto &path = m_paths.at(cameraIndex);
+    if (!path.isEmpty() && m_cameras.cend() != m_cameras.find(path))
+        m_cameras.at(path)->importFiles(destination);
+}
+
+void GPhotoWorker::cancelImport(int cameraIndex)
+{
+    if (!isCameraIndexValid(cameraIndex))
+        return;
+
+    const auto &path = m_paths.at(cameraIndex);
+    if (!path.isEmpty() && m_cameras.cend() != m_cameras.find(path))
+        m_cameras.at(path)->cancelImport();
+}
+
 QVariant GPhotoWorker::parameter(int cameraIndex, const QString &name)
 {
     if (!isCameraIndexValid(cameraIndex))
@@ -185,6 +392,26 @@ QVariantList GPhotoWorker::parameterValues(int cameraIndex, const QString &name,
            ? m_cameras.at(path)->parameterValues(name, valueType) : QVariantList();
 }
 
+QJsonObject GPhotoWorker::snapshotConfig(int cameraIndex)
+{
+    if (!isCameraIndexValid(cameraIndex))
+      return {};
+
+    const auto &path = m_paths.at(cameraIndex);
+    return (!path.isEmpty() && m_cameras.cend() != m_cameras.find(path))
+           ? m_cameras.at(path)->snapshotConfig() : QJsonObject();
+}
+
+bool GPhotoWorker::applyConfig(int cameraIndex, const QJsonObject &snapshot)
+{
+    if (!isCameraIndexValid(cameraIndex))
+      return false;
+
+    const auto &path = m_paths.at(cameraIndex);
+    return (!path.isEmpty() && m_cameras.cend() != m_cameras.find(path))
+           ? m_cameras.at(path)->applyConfig(snapshot) : false;
+}
+
 CameraAbilities GPhotoWorker::getCameraAbilities(int cameraIndex, bool *ok)
 {
     CameraAbilities abilities;
@@ -261,6 +488,13 @@ void GPhotoWorker::updateDevices()
     m_names.clear();
     m_defaultCameraName.clear();
 
+#ifdef GPHOTO_MOCK_BACKEND
+    if (GPhotoMockBackend::isEnabled()) {
+        updateMockDevices();
+        return;
+    }
+#endif
+
     CameraList *cameraList;
     gp_list_new(&cameraList);
 
@@ -321,3 +555,43 @@ void GPhotoWorker::updateDevices()
         m_cacheAgeTimer.restart();
     }
 }
+
+void GPhotoWorker::logRecentGPhotoMessages() const
+{
+    const auto &lines = m_transferMonitor->recentLog();
+    if (lines.isEmpty())
+        return;
+
+    qWarning() << "GPhoto: Recent libgphoto2 messages:";
+    for (const auto &line : lines)
+        qWarning().noquote() << "  " << line;
+}
+
+#ifdef GPHOTO_MOCK_BACKEND
+void GPhotoWorker::updateMockDevices()
+{
+    // Mock cameras replace the real ones, so tests and benchmarks never touch hardware
+    auto cameraCount = GPhotoMockBackend::environmentSettings().cameras;
+
+    for (auto i = 0; i < cameraCount; ++i) {
+        auto path = QByteArray(mockPathPrefix) + QByteArray::number(i);
+        auto model = QByteArray(mockModel);
+        auto name = (0 < i) ? model + QString(QLatin1String(" (%1)")).arg(i).toLatin1() : model;
+
+        m_paths.append(path);
+        m_models.append(model);
+        m_names.append(name);
+
+        if (m_cameras.cend() == m_cameras.find(path))
+            initCamera(m_paths.size() - 1);
+    }
+
+    for (auto it = m_cameras.cbegin(); it != m_cameras.cend();)
+        it = !m_paths.contains(it->first) ? m_cameras.erase(it) : std::next(it);
+
+    if (!m_paths.isEmpty()) {
+        m_defaultCameraName = m_names.first();
+        m_cacheAgeTimer.restart();
+    }
+}
+#endif
@@ -12,7 +12,10 @@
 #include <gphoto2/gphoto2-context.h>
 #include <gphoto2/gphoto2-port-info-list.h>
 
-class GPhotoCamera;
+#include "gphotocamera.h"
+
+class GPhotoMetrics;
+class GPhotoTransferMonitor;
 
 using CameraAbilitiesListPtr = std::unique_ptr<CameraAbilitiesList, int (*)(CameraAbilitiesList*)>;
 using GPContextPtr = std::unique_ptr<GPContext, void (*)(GPContext*)>;
@@ -22,7 +25,7 @@ class GPhotoWorker final : public QObject
 {
     Q_OBJECT
 public:
-    GPhotoWorker();
+    explicit GPhotoWorker(GPhotoMetrics *metrics);
     ~GPhotoWorker();
 
     GPhotoWorker(GPhotoWorker&&) = delete;
@@ -37,20 +40,52 @@ public:
     Q_INVOKABLE void setState(int cameraIndex, QCamera::State state);
     Q_INVOKABLE void setCaptureMode(int cameraIndex, QCamera::CaptureModes captureMode);
     Q_INVOKABLE void capturePhoto(int cameraIndex, int id, const QString &fileName);
+    Q_INVOKABLE void captureBracket(int cameraIndex, int id, const QString &fileName, const QVariantList &steps);
+    Q_INVOKABLE void startTimelapse(int cameraIndex, int id, const QString &fileName, int interval, int count);
+    Q_INVOKABLE void stopTimelapse(int cameraIndex);
+    Q_INVOKABLE void startRecording(int cameraIndex, int id, const QString &fileName);
+    Q_INVOKABLE void stopRecording(int cameraIndex);
+    Q_INVOKABLE void cancelCapture(int cameraIndex);
+    Q_INVOKABLE void setTethered(int cameraIndex, bool tethered);
+    Q_INVOKABLE void setDownloadPolicy(int cameraIndex, GPhotoCamera::DownloadPolicy policy,
+                                       const QStringList &extensions);
+    Q_INVOKABLE void setSaveDirectories(int cameraIndex, const QString &directory,
+                                        const QVariantMap &formatDirectories);
+    Q_INVOKABLE QStringList deferredFiles(int cameraIndex) const;
+    Q_INVOKABLE void clearDeferredFiles(int cameraIndex);
+    Q_INVOKABLE void importFiles(int cameraIndex, const QString &destination);
+    Q_INVOKABLE void cancelImport(int cameraIndex);
     Q_INVOKABLE QVariant parameter(int cameraIndex, const QString &name);
     Q_INVOKABLE bool setParameter(int cameraIndex, const QString &name, const QVariant &value);
     Q_INVOKABLE QVariantList parameterValues(int cameraIndex, const QString &name, QMetaType::Type valueType) const;
+    Q_INVOKABLE QJsonObject snapshotConfig(int cameraIndex);
+    Q_INVOKABLE bool applyConfig(int cameraIndex, const QJsonObject &snapshot);
 
 signals:
+    void bracketFrameCaptured(int cameraIndex, int id, int frame, qint64 applyNsecs, qint64 captureNsecs);
+    void cameraEvent(int cameraIndex, const GPhotoCamera::CameraEvent &event);
     void captureModeChanged(int cameraIndex, QCamera::CaptureModes);
     void error(int cameraIndex, int errorCode, const QString &errorString);
+    void fileDeferred(int cameraIndex, int id, const QString &path);
+    void fileImported(int cameraIndex, const QString &cameraPath, const QString &fileName);
     void imageCaptureError(int cameraIndex, int id, int errorCode, const QString &errorString);
     void imageCaptured(int cameraIndex, int id, const QByteArray &imageData,
                        const QString &format, const QString &fileName);
+    void imageFileCaptured(int cameraIndex, int id, const QString &tempFileName,
+                           const QString &format, const QString &fileName);
+    void importFinished(int cameraIndex, int files, int errors);
+    void importProgress(int cameraIndex, int files, int totalFiles, qint64 bytes, qint64 bytesPerSecond);
     void previewCaptured(int cameraIndex, const QImage &image);
     void readyForCaptureChanged(int cameraIndex, bool readyForCapture);
+    void recordingChanged(int cameraIndex, int id, bool recording);
     void stateChanged(int cameraIndex, QCamera::State state);
     void statusChanged(int cameraIndex, QCamera::Status status);
+    void timelapseShotTriggered(int cameraIndex, int id, int shot, qint64 plannedNsecs, qint64 actualNsecs);
+    void transferFinished(int cameraIndex, int id, qint64 bytes, qint64 bytesPerSecond);
+    void transferProgress(int cameraIndex, int id, qint64 bytes, qint64 total);
+
+protected:
+    bool event(QEvent *event) override;
 
 private:
     Q_DISABLE_COPY(GPhotoWorker)
@@ -59,8 +94,14 @@ private:
     GPPortInfo getPortInfo(int cameraIndex, bool *ok = nullptr);
     bool isCameraIndexValid(int index) const;
     void updateDevices();
+#ifdef GPHOTO_MOCK_BACKEND
+    void updateMockDevices();
+#endif
+    void logRecentGPhotoMessages() const;
 
+    GPhotoMetrics *m_metrics;
     GPContextPtr m_context;
+    std::unique_ptr<GPhotoTransferMonitor> m_transferMonitor;
     GPPortInfoListPtr m_portInfoList;
     CameraAbilitiesListPtr m_abilitiesList;
 
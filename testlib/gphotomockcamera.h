@@ -0,0 +1,54 @@
+#ifndef GPHOTOMOCKCAMERA_H
+#define GPHOTOMOCKCAMERA_H
+
+#include <memory>
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QtTest>
+
+#include "gphotocamerasession.h"
+#include "gphotocontroller.h"
+
+/** Session of the first mock camera, shared by the tests and benchmarks.
+ *
+ * Mock settings are read when cameras are detected, see GPhotoMockBackend::Settings,
+ * so every camera opened here gets a controller of its own.
+ */
+struct GPhotoMockCamera
+{
+    /// Longest wait for anything the mock camera does, msecs
+    static constexpr int waitTimeout = 30000;
+
+    std::shared_ptr<GPhotoController> controller;
+    std::unique_ptr<GPhotoCameraSession> session;
+
+    /// Creates the camera described by @p settings and starts loading it
+    static GPhotoMockCamera open(const QByteArray &settings)
+    {
+        qputenv("GPHOTO_MOCK", settings);
+
+        GPhotoMockCamera camera;
+        camera.controller = std::make_shared<GPhotoController>();
+        camera.controller->init();
+        camera.session.reset(new GPhotoCameraSession(camera.controller));
+        camera.session->cameraNames();
+        camera.session->setCamera(0);
+        camera.session->setState(QCamera::LoadedState);
+        return camera;
+    }
+
+    /// Processes events till the session reaches @p status, false on timeout
+    bool waitForStatus(QCamera::Status status) const
+    {
+        QElapsedTimer timer;
+        timer.start();
+
+        while (session->status() != status && timer.elapsed() < waitTimeout)
+            QTest::qWait(1);
+
+        return session->status() == status;
+    }
+};
+
+#endif // GPHOTOMOCKCAMERA_H
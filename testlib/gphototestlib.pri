@@ -0,0 +1,52 @@
+# Plugin sources are built in, tests and benchmarks drive them with mock cameras
+QT       += core gui multimedia testlib
+CONFIG   += testcase console
+CONFIG   -= app_bundle
+
+INCLUDEPATH += $$PWD/.. $$PWD
+DEFINES += GPHOTO_MOCK_BACKEND
+
+SOURCES += \
+    $$PWD/../gphotocamera.cpp \
+    $$PWD/../gphotocamerafocuscontrol.cpp \
+    $$PWD/../gphotocamerasession.cpp \
+    $$PWD/../gphotocardindex.cpp \
+    $$PWD/../gphotocontroller.cpp \
+    $$PWD/../gphotodevicebackend.cpp \
+    $$PWD/../gphotofilewriter.cpp \
+    $$PWD/../gphotoimporter.cpp \
+    $$PWD/../gphotometrics.cpp \
+    $$PWD/../gphotomockbackend.cpp \
+    $$PWD/../gphotosaveservice.cpp \
+    $$PWD/../gphototrace.cpp \
+    $$PWD/../gphototransfermonitor.cpp \
+    $$PWD/../gphotoworker.cpp
+
+HEADERS += \
+    $$PWD/gphotomockcamera.h \
+    $$PWD/../gphotobackend.h \
+    $$PWD/../gphotocamera.h \
+    $$PWD/../gphotocamerafocuscontrol.h \
+    $$PWD/../gphotocamerasession.h \
+    $$PWD/../gphotocardindex.h \
+    $$PWD/../gphotocontroller.h \
+    $$PWD/../gphotodevicebackend.h \
+    $$PWD/../gphotofilewriter.h \
+    $$PWD/../gphotoimporter.h \
+    $$PWD/../gphotometrics.h \
+    $$PWD/../gphotomockbackend.h \
+    $$PWD/../gphotosaveservice.h \
+    $$PWD/../gphototrace.h \
+    $$PWD/../gphototransfermonitor.h \
+    $$PWD/../gphotoworker.h
+
+LIBS += -lgphoto2
+
+# io_uring writer is optional, pwrite is used without it
+CONFIG += link_pkgconfig
+packagesExist(liburing) {
+    DEFINES += HAVE_LIBURING
+    PKGCONFIG += liburing
+    SOURCES += $$PWD/../gphotouringwriter.cpp
+    HEADERS += $$PWD/../gphotouringwriter.h
+}
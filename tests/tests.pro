@@ -0,0 +1,5 @@
+TARGET = tst_gphoto
+
+include(../testlib/gphototestlib.pri)
+
+SOURCES += tst_gphoto.cpp
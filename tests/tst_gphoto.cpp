@@ -0,0 +1,629 @@
+#include <algorithm>
+#include <cstdlib>
+
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QSignalSpy>
+#include <QStorageInfo>
+#include <QTemporaryDir>
+#include <QtTest>
+
+#include <gphoto2/gphoto2-port-result.h>
+
+#include "gphotocardindex.h"
+#include "gphotomockbackend.h"
+#include "gphotomockcamera.h"
+#include "gphotosaveservice.h"
+
+namespace {
+    // Waits of the plugin for the camera to ack a config change and to complete a short exposure, msecs
+    constexpr auto configAckTimeout = 1000;
+    constexpr auto captureTimeout = 15000;
+    constexpr auto savedFileCount = 8;
+    constexpr auto waitTimeout = GPhotoMockCamera::waitTimeout;
+}
+
+/// Behaviour of the plugin parts checked with mock cameras, no hardware needed
+class GPhotoTests final : public QObject
+{
+    Q_OBJECT
+private slots:
+    void mockSettings();
+    void mockCapture();
+    void downloadPolicy();
+    void cardIndexRefresh();
+    void saveServiceNaming();
+    void choiceLookup_data();
+    void choiceLookup();
+    void saveServiceOrdering_data();
+    void saveServiceOrdering();
+    void saveServiceGroupDirectories();
+    void configAckDuringCapture_data();
+    void configAckDuringCapture();
+    void captureDeadline_data();
+    void captureDeadline();
+    void cancelQueuedCapture();
+    void configSnapshotRoundTrip();
+    void bracketRestore_data();
+    void bracketRestore();
+    void timelapseSchedule();
+    void movieRecording_data();
+    void movieRecording();
+};
+
+void GPhotoTests::mockSettings()
+{
+    const auto &settings = GPhotoMockBackend::Settings::fromString(
+                QStringLiteral("cameras=2; preview=1280x720; files=jpg:1000,CR2:2000; captureComplete=0; "
+                               "movieRate=5000000000; movieLength=100"));
+
+    QCOMPARE(settings.cameras, 2);
+    QCOMPARE(settings.preview, QSize(1280, 720));
+    QCOMPARE(settings.files.size(), 2);
+    QCOMPARE(settings.files.first(), qMakePair(QByteArray("JPG"), qint64(1000)));
+    QCOMPARE(settings.files.last(), qMakePair(QByteArray("CR2"), qint64(2000)));
+    QVERIFY(!settings.captureComplete);
+    QCOMPARE(settings.movieRate, qint64(5000000000));
+    QCOMPARE(settings.movieLength, 100);
+
+    // Settings not listed keep their defaults
+    QCOMPARE(settings.propertyEvents, 1);
+    QCOMPARE(settings.transferRate, qint64(0));
+}
+
+void GPhotoTests::mockCapture()
+{
+    GPhotoMockBackend backend(GPhotoMockBackend::Settings::fromString(QStringLiteral("files=JPG:1000,CR2:2000")));
+    QVERIFY(backend.open(nullptr));
+    QVERIFY(backend.triggerCapture() >= GP_OK);
+
+    // Every file of the shot is reported before the completion, like real cameras do
+    QByteArray folder;
+    QList<QByteArray> names;
+    CameraEventType type = GP_EVENT_UNKNOWN;
+    do {
+        void *data = nullptr;
+        QVERIFY(backend.waitForEvent(waitTimeout, &type, &data) >= GP_OK);
+        if (GP_EVENT_FILE_ADDED == type) {
+            const auto path = static_cast<CameraFilePath*>(data);
+            folder = path->folder;
+            names.append(path->name);
+        }
+        free(data);
+    } while (GP_EVENT_FILE_ADDED == type);
+
+    QCOMPARE(int(type), int(GP_EVENT_CAPTURE_COMPLETE));
+    QCOMPARE(names, (QList<QByteArray>{"IMG_0001.JPG", "IMG_0001.CR2"}));
+
+    // Files are on the card with the configured sizes
+    CameraFileInfo info;
+    QVERIFY(backend.fileGetInfo(folder.constData(), "IMG_0001.CR2", &info) >= GP_OK);
+    QCOMPARE(qint64(info.file.size), qint64(2000));
+
+    CameraList *list = nullptr;
+    QVERIFY(gp_list_new(&list) >= GP_OK);
+    QVERIFY(backend.folderListFiles(folder.constData(), list) >= GP_OK);
+    QCOMPARE(gp_list_count(list), 2);
+    gp_list_free(list);
+}
+
+void GPhotoTests::downloadPolicy()
+{
+    auto camera = GPhotoMockCamera::open("files=JPG:100000,CR2:200000");
+    QVERIFY(camera.waitForStatus(QCamera::LoadedStatus));
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    // RAW files stay on the card
+    camera.session->setDownloadPolicy(GPhotoCamera::DownloadPolicy::ByExtension, {QStringLiteral("jpg")});
+
+    QSignalSpy saved(camera.session.get(), &GPhotoCameraSession::imageSaved);
+    QSignalSpy deferred(camera.session.get(), &GPhotoCameraSession::fileDeferred);
+    QSignalSpy errors(camera.session.get(), &GPhotoCameraSession::imageCaptureError);
+
+    auto id = camera.session->capture(dir.path() + QLatin1String("/shot.JPG"));
+    QTRY_COMPARE_WITH_TIMEOUT(saved.count(), 1, waitTimeout);
+    QTRY_COMPARE_WITH_TIMEOUT(deferred.count(), 1, waitTimeout);
+    QCOMPARE(errors.count(), 0);
+
+    QCOMPARE(saved.first().at(0).toInt(), id);
+    QCOMPARE(saved.first().at(1).toString(), dir.path() + QLatin1String("/shot.JPG"));
+    QCOMPARE(deferred.first().at(0).toInt(), id);
+
+    const auto &path = deferred.first().at(1).toString();
+    QVERIFY(path.endsWith(QLatin1String(".CR2")));
+    QCOMPARE(camera.session->deferredFiles(), QStringList{path});
+    QVERIFY(!QFileInfo::exists(dir.path() + QLatin1String("/shot.CR2")));
+}
+
+void GPhotoTests::cardIndexRefresh()
+{
+    GPhotoMockBackend backend(GPhotoMockBackend::Settings::fromString(QStringLiteral("cardShots=3;files=JPG:1000,CR2:2000")));
+    QVERIFY(backend.open(nullptr));
+
+    // Index without a serial number isn't saved anywhere
+    GPhotoCardIndex index(&backend);
+    QVERIFY(index.refresh());
+    QVERIFY(index.isTracking());
+
+    auto files = index.files();
+    QCOMPARE(files.size(), 6);
+    for (const auto &file : files)
+        QCOMPARE(file.size, file.name.endsWith(QLatin1String(".JPG")) ? qint64(1000) : qint64(2000));
+
+    // Shot taken while the camera wasn't tracked is found by the next refresh,
+    // although the mock MISC folder sorts after the DCIM one
+    index.stopTracking();
+    QVERIFY(backend.triggerCapture() >= GP_OK);
+    QVERIFY(index.refresh());
+
+    files = index.files();
+    QCOMPARE(files.size(), 8);
+    QVERIFY(std::any_of(files.cbegin(), files.cend(), [] (const GPhotoCardIndex::File &file) {
+        return QLatin1String("IMG_0004.CR2") == file.name && 2000 == file.size;
+    }));
+}
+
+void GPhotoTests::saveServiceNaming()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    QFile taken(dir.path() + QLatin1String("/DCIM0007.JPG"));
+    QVERIFY(taken.open(QIODevice::WriteOnly));
+    taken.close();
+
+    // Counter continues after the last file in the directory
+    GPhotoSaveService service;
+    QCOMPARE(service.nextBaseName(dir.path()), dir.path() + QLatin1String("/DCIM0008"));
+    QCOMPARE(service.nextBaseName(dir.path()), dir.path() + QLatin1String("/DCIM0009"));
+
+    QFile replaced(dir.path() + QLatin1String("/replaced.JPG"));
+    QVERIFY(replaced.open(QIODevice::WriteOnly));
+    replaced.write("old");
+    replaced.close();
+
+    QSignalSpy saved(&service, &GPhotoSaveService::imageSaved);
+    QSignalSpy errors(&service, &GPhotoSaveService::saveError);
+
+    // Exclusive save never replaces the taken name, the other one does
+    service.save(1, taken.fileName(), QByteArray("exclusive"), true);
+    service.save(2, replaced.fileName(), QByteArray("new"), false);
+    QTRY_COMPARE_WITH_TIMEOUT(saved.count(), 2, waitTimeout);
+    QCOMPARE(errors.count(), 0);
+
+    QCOMPARE(saved.at(0).at(1).toString(), dir.path() + QLatin1String("/DCIM0007_1.JPG"));
+    QCOMPARE(QFileInfo(taken.fileName()).size(), qint64(0));
+
+    QCOMPARE(saved.at(1).at(1).toString(), replaced.fileName());
+    QVERIFY(replaced.open(QIODevice::ReadOnly));
+    QCOMPARE(replaced.readAll(), QByteArray("new"));
+
+    // No temporary files are left behind
+    QCOMPARE(QDir(dir.path()).entryList(QDir::Files | QDir::Hidden).size(), 3);
+}
+
+void GPhotoTests::choiceLookup_data()
+{
+    QTest::addColumn<QString>("name");
+    QTest::addColumn<QVariant>("value");
+    // Invalid when the value has no matching choice
+    QTest::addColumn<QVariant>("expected");
+
+    QTest::newRow("exact string") << "shutterspeed" << QVariant(QStringLiteral("1/250")) << QVariant(QStringLiteral("1/250"));
+    QTest::newRow("nearest double") << "aperture" << QVariant(5.65) << QVariant(QStringLiteral("5.6"));
+    QTest::newRow("negative double") << "exposurecompensation" << QVariant(-0.67) << QVariant(QStringLiteral("-0.7"));
+    QTest::newRow("double too far") << "aperture" << QVariant(7.0) << QVariant();
+    QTest::newRow("integer") << "iso" << QVariant(400) << QVariant(QStringLiteral("400"));
+    QTest::newRow("auto integer") << "iso" << QVariant(-1) << QVariant(QStringLiteral("Auto"));
+    QTest::newRow("missing integer") << "iso" << QVariant(300) << QVariant();
+}
+
+void GPhotoTests::choiceLookup()
+{
+    QFETCH(QString, name);
+    QFETCH(QVariant, value);
+    QFETCH(QVariant, expected);
+
+    auto camera = GPhotoMockCamera::open("propertyEvents=1");
+    QVERIFY(camera.waitForStatus(QCamera::LoadedStatus));
+
+    const auto &previous = camera.session->parameter(name);
+    QCOMPARE(camera.session->setParameter(name, value), expected.isValid());
+    QCOMPARE(camera.session->parameter(name), expected.isValid() ? expected : previous);
+}
+
+void GPhotoTests::saveServiceOrdering_data()
+{
+    QTest::addColumn<GPhotoSaveService::Durability>("durability");
+
+    QTest::newRow("none") << GPhotoSaveService::Durability::None;
+    QTest::newRow("file") << GPhotoSaveService::Durability::PerFile;
+    QTest::newRow("group") << GPhotoSaveService::Durability::Group;
+}
+
+void GPhotoTests::saveServiceOrdering()
+{
+    QFETCH(GPhotoSaveService::Durability, durability);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    GPhotoSaveService service;
+    service.setDurability(durability, savedFileCount / 2);
+
+    QSignalSpy saved(&service, &GPhotoSaveService::imageSaved);
+
+    // Bigger files first, so they'd finish last if several are written at once
+    for (auto i = 0; i < savedFileCount; ++i) {
+        const QByteArray data((savedFileCount - i) * 1024 * 1024, char('0' + i));
+        service.save(i, service.nextBaseName(dir.path()) + QLatin1String(".JPG"), data, true);
+    }
+
+    QTRY_COMPARE_WITH_TIMEOUT(saved.count(), savedFileCount, waitTimeout);
+
+    for (auto i = 0; i < savedFileCount; ++i) {
+        QCOMPARE(saved.at(i).at(0).toInt(), i);
+        QCOMPARE(QFileInfo(saved.at(i).at(1).toString()).size(), qint64(savedFileCount - i) * 1024 * 1024);
+    }
+}
+
+void GPhotoTests::saveServiceGroupDirectories()
+{
+    QTemporaryDir first;
+    QTemporaryDir second;
+    QVERIFY(first.isValid() && second.isValid());
+
+    // Single group with files going to two directories, like shots split by format directories
+    GPhotoSaveService service;
+    service.setDurability(GPhotoSaveService::Durability::Group, savedFileCount);
+
+    QSignalSpy saved(&service, &GPhotoSaveService::imageSaved);
+    QSignalSpy errors(&service, &GPhotoSaveService::saveError);
+
+    for (auto i = 0; i < savedFileCount; ++i) {
+        const auto &directory = (0 == i % 2) ? first.path() : second.path();
+        service.save(i, service.nextBaseName(directory) + QLatin1String(".JPG"), QByteArray(1024, char('0' + i)), true);
+    }
+
+    QTRY_COMPARE_WITH_TIMEOUT(saved.count(), savedFileCount, waitTimeout);
+    QCOMPARE(errors.count(), 0);
+
+    for (auto i = 0; i < savedFileCount; ++i) {
+        const auto &fileName = saved.at(i).at(1).toString();
+        QCOMPARE(saved.at(i).at(0).toInt(), i);
+        QCOMPARE(QFileInfo(fileName).path(), (0 == i % 2) ? first.path() : second.path());
+
+        QFile file(fileName);
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        QCOMPARE(file.readAll(), QByteArray(1024, char('0' + i)));
+    }
+
+    // Every temporary file was renamed into place
+    for (const auto &directory : {first.path(), second.path()}) {
+        const auto &files = QDir(directory).entryList(QDir::Files | QDir::Hidden);
+        QCOMPARE(files.size(), savedFileCount / 2);
+        for (const auto &file : files)
+            QVERIFY(!file.startsWith(QLatin1String(".gphoto-")));
+    }
+}
+
+void GPhotoTests::configAckDuringCapture_data()
+{
+    QTest::addColumn<int>("captures");
+
+    // Change comes while the only shot is exposing, or while another one waits behind it
+    QTest::newRow("exposing") << 1;
+    QTest::newRow("queued") << 2;
+}
+
+void GPhotoTests::configAckDuringCapture()
+{
+    QFETCH(int, captures);
+
+    // Files are due while the camera is still busy with the upload, so they come before the ack
+    constexpr auto configLatency = 600;
+    auto camera = GPhotoMockCamera::open("exposureLatency=300; configLatency=600; files=JPG:1000,CR2:2000");
+    QVERIFY(camera.waitForStatus(QCamera::LoadedStatus));
+
+    // Mirror is known to be down, so the shot doesn't flap it and the change is the only upload
+    QVERIFY(camera.session->setParameter(QStringLiteral("viewfinder"), false));
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    QSignalSpy saved(camera.session.get(), &GPhotoCameraSession::imageSaved);
+    QSignalSpy errors(camera.session.get(), &GPhotoCameraSession::imageCaptureError);
+    QSignalSpy events(camera.session.get(), &GPhotoCameraSession::cameraEvent);
+
+    for (auto i = 0; i < captures; ++i)
+        camera.session->capture(dir.path() + QLatin1String("/shot") + QString::number(i));
+
+    QElapsedTimer timer;
+    timer.start();
+    QVERIFY(camera.session->setParameter(QStringLiteral("aperture"), QStringLiteral("8")));
+
+    // Ack is the event naming the widget, not the first event nor the timeout
+    QVERIFY(timer.elapsed() >= configLatency);
+    QVERIFY(timer.elapsed() < configLatency + configAckTimeout);
+
+    QCoreApplication::sendPostedEvents();
+    const auto ack = std::find_if(events.cbegin(), events.cend(), [] (const QList<QVariant> &args) {
+        return QLatin1String("aperture") == args.first().value<GPhotoCamera::CameraEvent>().property;
+    });
+    QVERIFY(events.cend() != ack);
+    QVERIFY(std::any_of(events.cbegin(), ack, [] (const QList<QVariant> &args) {
+        return GP_EVENT_FILE_ADDED == args.first().value<GPhotoCamera::CameraEvent>().event;
+    }));
+
+    // Files pumped by the ack are still taken by their capture
+    QTRY_COMPARE_WITH_TIMEOUT(saved.count(), 2 * captures, waitTimeout);
+    QCOMPARE(errors.count(), 0);
+
+    for (const auto &args : saved) {
+        const auto &fileName = args.at(1).toString();
+        QCOMPARE(QFileInfo(fileName).size(), fileName.endsWith(QLatin1String(".JPG")) ? qint64(1000) : qint64(2000));
+    }
+
+    QCOMPARE(camera.session->parameter(QStringLiteral("aperture")), QVariant(QStringLiteral("8")));
+}
+
+void GPhotoTests::captureDeadline_data()
+{
+    QTest::addColumn<QByteArray>("files");
+
+    QTest::newRow("files received") << QByteArray("JPG:1000,CR2:2000");
+    QTest::newRow("nothing received") << QByteArray();
+}
+
+void GPhotoTests::captureDeadline()
+{
+    QFETCH(QByteArray, files);
+
+    // Camera never reports the capture complete, so only the deadline ends it
+    auto camera = GPhotoMockCamera::open("captureComplete=0; files=" + files);
+    QVERIFY(camera.waitForStatus(QCamera::LoadedStatus));
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    QSignalSpy saved(camera.session.get(), &GPhotoCameraSession::imageSaved);
+    QSignalSpy errors(camera.session.get(), &GPhotoCameraSession::imageCaptureError);
+
+    QElapsedTimer timer;
+    timer.start();
+    const auto id = camera.session->capture(dir.path() + QLatin1String("/shot"));
+
+    if (files.isEmpty()) {
+        QTRY_COMPARE_WITH_TIMEOUT(errors.count(), 1, waitTimeout);
+        QCOMPARE(errors.first().at(0).toInt(), id);
+        QCOMPARE(errors.first().at(1).toInt(), int(QCameraImageCapture::ResourceError));
+    } else {
+        // JPEG is downloaded right away, RAW waits for the end of the capture
+        QTRY_COMPARE_WITH_TIMEOUT(saved.count(), 1, waitTimeout);
+        QVERIFY(saved.first().at(1).toString().endsWith(QLatin1String(".JPG")));
+
+        QTRY_COMPARE_WITH_TIMEOUT(saved.count(), 2, waitTimeout);
+        QVERIFY(saved.last().at(1).toString().endsWith(QLatin1String(".CR2")));
+        QCOMPARE(errors.count(), 0);
+    }
+
+    QVERIFY(timer.elapsed() >= captureTimeout);
+}
+
+void GPhotoTests::cancelQueuedCapture()
+{
+    auto camera = GPhotoMockCamera::open("exposureLatency=1000; files=JPG:1000");
+    QVERIFY(camera.waitForStatus(QCamera::LoadedStatus));
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    QSignalSpy saved(camera.session.get(), &GPhotoCameraSession::imageSaved);
+    QSignalSpy errors(camera.session.get(), &GPhotoCameraSession::imageCaptureError);
+
+    // Second shot waits behind the exposing one when both are cancelled
+    const auto exposing = camera.session->capture(dir.path() + QLatin1String("/exposing"));
+    const auto queued = camera.session->capture(dir.path() + QLatin1String("/queued"));
+    camera.session->cancelCapture();
+
+    QTRY_COMPARE_WITH_TIMEOUT(errors.count(), 2, waitTimeout);
+    QCOMPARE(errors.at(0).at(0).toInt(), exposing);
+    QCOMPARE(errors.at(1).at(0).toInt(), queued);
+    for (const auto &args : errors)
+        QCOMPARE(args.at(1).toInt(), int(QCameraImageCapture::NotReadyError));
+
+    // Queued shot is never taken, files of the cancelled one stay on the card
+    QTest::qWait(2000);
+    QCOMPARE(saved.count(), 0);
+    QCOMPARE(errors.count(), 2);
+}
+
+void GPhotoTests::configSnapshotRoundTrip()
+{
+    auto camera = GPhotoMockCamera::open("propertyEvents=1");
+    QVERIFY(camera.waitForStatus(QCamera::LoadedStatus));
+
+    const auto &snapshot = camera.controller->snapshotConfig(0);
+    QCOMPARE(snapshot.value(QLatin1String("aperture")).toString(), QStringLiteral("5.6"));
+    QCOMPARE(snapshot.value(QLatin1String("iso")).toString(), QStringLiteral("Auto"));
+
+    // Applying a preset never presses anything nor turns back the camera clock
+    for (const auto &name : {"viewfinder", "autofocusdrive", "cancelautofocus", "movie", "datetime", "syncdatetime"})
+        QVERIFY2(!snapshot.contains(QLatin1String(name)), name);
+
+    // Unchanged settings cost nothing
+    auto requests = GPhotoMockBackend::configRequestCount();
+    QVERIFY(camera.controller->applyConfig(0, snapshot));
+    QCOMPARE(GPhotoMockBackend::configRequestCount(), requests);
+
+    QVERIFY(camera.session->setParameter(QStringLiteral("aperture"), QStringLiteral("8")));
+    QVERIFY(camera.session->setParameter(QStringLiteral("iso"), QStringLiteral("400")));
+    QCOMPARE(camera.controller->snapshotConfig(0).value(QLatin1String("aperture")).toString(), QStringLiteral("8"));
+
+    // Both changes go back in a single upload
+    requests = GPhotoMockBackend::configRequestCount();
+    QVERIFY(camera.controller->applyConfig(0, snapshot));
+    QCOMPARE(GPhotoMockBackend::configRequestCount(), requests + 1);
+
+    QCOMPARE(camera.controller->snapshotConfig(0), snapshot);
+}
+
+void GPhotoTests::bracketRestore_data()
+{
+    QTest::addColumn<bool>("cancel");
+
+    QTest::newRow("last frame") << false;
+    QTest::newRow("cancelled") << true;
+}
+
+void GPhotoTests::bracketRestore()
+{
+    QFETCH(bool, cancel);
+
+    auto camera = GPhotoMockCamera::open("exposureLatency=300; files=JPG:1000");
+    QVERIFY(camera.waitForStatus(QCamera::LoadedStatus));
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    QSignalSpy saved(camera.session.get(), &GPhotoCameraSession::imageSaved);
+    QSignalSpy errors(camera.session.get(), &GPhotoCameraSession::imageCaptureError);
+
+    QVariantList steps;
+    for (auto offset : {-1, 0, 1}) {
+        steps.append(QVariantMap{{QStringLiteral("aperture"), offset},
+                                 {QStringLiteral("exposurecompensation"), 3 * offset}});
+    }
+
+    camera.session->captureBracket(steps, dir.path() + QLatin1String("/bracket"));
+
+    // First frame has its settings applied by the time the cancel comes
+    if (cancel) {
+        camera.session->cancelCapture();
+        QTRY_COMPARE_WITH_TIMEOUT(errors.count(), steps.size(), waitTimeout);
+    } else {
+        QTRY_COMPARE_WITH_TIMEOUT(saved.count(), steps.size(), waitTimeout);
+        QCOMPARE(errors.count(), 0);
+    }
+
+    QCOMPARE(camera.session->parameter(QStringLiteral("aperture")), QVariant(QStringLiteral("5.6")));
+    QCOMPARE(camera.session->parameter(QStringLiteral("exposurecompensation")), QVariant(QStringLiteral("0")));
+}
+
+void GPhotoTests::timelapseSchedule()
+{
+    constexpr auto interval = 300;
+    constexpr auto count = 8;
+    constexpr auto tolerance = qint64(100) * 1000000;
+
+    // Config upload holding the camera is longer than two intervals, so at least one shot is skipped
+    auto camera = GPhotoMockCamera::open("configLatency=700; files=JPG:1000");
+    QVERIFY(camera.waitForStatus(QCamera::LoadedStatus));
+
+    // Mirror is known to be down, so shots don't flap it
+    QVERIFY(camera.session->setParameter(QStringLiteral("viewfinder"), false));
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    QSignalSpy triggered(camera.session.get(), &GPhotoCameraSession::timelapseShotTriggered);
+    QSignalSpy errors(camera.session.get(), &GPhotoCameraSession::imageCaptureError);
+
+    const auto id = camera.session->startTimelapse(interval, count, dir.path() + QLatin1String("/timelapse"));
+
+    QTRY_VERIFY_WITH_TIMEOUT(3 <= triggered.count(), waitTimeout);
+    QVERIFY(camera.session->setParameter(QStringLiteral("aperture"), QStringLiteral("8")));
+
+    QTRY_COMPARE_WITH_TIMEOUT(triggered.count() + errors.count(), count, waitTimeout);
+    QVERIFY(0 < errors.count());
+    for (const auto &args : errors) {
+        QVERIFY(id <= args.at(0).toInt() && args.at(0).toInt() < id + count);
+        QCOMPARE(args.at(1).toInt(), int(QCameraImageCapture::NotReadyError));
+    }
+
+    // Plan stays on the grid, only the shot due when the camera got free is late, and by less than an interval
+    for (const auto &args : triggered) {
+        const auto shot = args.at(1).toInt();
+        const auto planned = args.at(2).toLongLong();
+        const auto actual = args.at(3).toLongLong();
+
+        QCOMPARE(args.at(0).toInt(), id + shot);
+        QCOMPARE(planned, shot * qint64(interval) * 1000000);
+        QVERIFY2(-tolerance < actual - planned && actual - planned < qint64(interval) * 1000000 + tolerance,
+                 qPrintable(QStringLiteral("shot %1 is %2 msecs off").arg(shot).arg((actual - planned) / 1000000)));
+    }
+
+    // Skipped shots don't push the rest of the plan back
+    const auto &last = triggered.last();
+    QCOMPARE(last.at(1).toInt(), count - 1);
+    QVERIFY(qAbs(last.at(3).toLongLong() - last.at(2).toLongLong()) < tolerance);
+}
+
+void GPhotoTests::movieRecording_data()
+{
+    QTest::addColumn<QByteArray>("settings");
+    // Zero when the movie is stopped by us and its size depends on how long it took
+    QTest::addColumn<qint64>("size");
+
+    QTest::newRow("stopped") << QByteArray("movieRate=10000000") << qint64(0);
+    // Bigger than any 32-bit size, the body stops it after a fixed length
+    QTest::newRow("body stopped") << QByteArray("movieRate=45000000000; movieLength=100") << qint64(4500000000);
+}
+
+void GPhotoTests::movieRecording()
+{
+    QFETCH(QByteArray, settings);
+    QFETCH(qint64, size);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    if (QStorageInfo(dir.path()).bytesAvailable() < 2 * size)
+        QSKIP("Not enough disk space for the movie");
+
+    auto camera = GPhotoMockCamera::open(settings);
+    QVERIFY(camera.waitForStatus(QCamera::LoadedStatus));
+
+    // Movie is streamed to disk and renamed into place, flushing it isn't what's checked here
+    camera.session->setSaveDurability(GPhotoSaveService::Durability::None);
+    camera.session->setCaptureMode(QCamera::CaptureVideo);
+
+    QSignalSpy recording(camera.session.get(), &GPhotoCameraSession::recordingChanged);
+    QSignalSpy saved(camera.session.get(), &GPhotoCameraSession::imageSaved);
+    QSignalSpy errors(camera.session.get(), &GPhotoCameraSession::imageCaptureError);
+
+    QElapsedTimer timer;
+    timer.start();
+    const auto id = camera.session->startRecording(dir.path() + QLatin1String("/movie"));
+    QTRY_COMPARE_WITH_TIMEOUT(recording.count(), 1, waitTimeout);
+    QCOMPARE(recording.first(), (QList<QVariant>{id, true}));
+
+    if (0 == size) {
+        QTest::qWait(200);
+        camera.session->stopRecording();
+    }
+
+    QTRY_COMPARE_WITH_TIMEOUT(saved.count(), 1, waitTimeout);
+    QCOMPARE(errors.count(), 0);
+    QCOMPARE(recording.count(), 2);
+    QCOMPARE(recording.last(), (QList<QVariant>{id, false}));
+
+    const auto &fileName = saved.first().at(1).toString();
+    QCOMPARE(saved.first().at(0).toInt(), id);
+    QCOMPARE(fileName, dir.path() + QLatin1String("/movie.MOV"));
+
+    if (0 < size) {
+        QCOMPARE(QFileInfo(fileName).size(), size);
+    } else {
+        QVERIFY(0 < QFileInfo(fileName).size());
+        QVERIFY(QFileInfo(fileName).size() <= timer.elapsed() * 10000000 / 1000);
+    }
+}
+
+QTEST_MAIN(GPhotoTests)
+
+#include "tst_gphoto.moc"